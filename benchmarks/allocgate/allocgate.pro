@@ -0,0 +1,22 @@
+TARGET = allocgate
+
+QT += network
+QT -= gui
+
+# testcase adds a "make check" target that runs the gate.
+CONFIG += console release c++11 thread testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src
+LIBS += -L../../lib
+
+win32 {
+    debug: LIBS += -lqhttpserverd
+    else: LIBS += -lqhttpserver
+} else {
+    LIBS += -lqhttpserver
+}
+
+include(../common/common.pri)
+
+SOURCES += allocgate.cpp
@@ -0,0 +1,5 @@
+TEMPLATE = subdirs
+
+# The load generator drives the server through epoll; the other benchmarks
+# interpose glibc's malloc. All of them are Linux only.
+linux: SUBDIRS += loadgen microbench allocgate maskbench deflatebench
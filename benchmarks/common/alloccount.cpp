@@ -0,0 +1,107 @@
+#include "alloccount.h"
+
+#include <atomic>
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+
+std::atomic<uint64_t> s_allocations(0);
+std::atomic<uint64_t> s_frees(0);
+std::atomic<uint64_t> s_bytes(0);
+
+inline void countAllocation(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    s_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+}
+
+extern "C" {
+
+void *malloc(size_t size)
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    // Growing a buffer in place is still a trip through the allocator.
+    countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+        s_frees.fetch_add(1, std::memory_order_relaxed);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    countAllocation(size);
+    void *p = __libc_memalign(alignment, size);
+    if (!p)
+        return 12; // ENOMEM
+    *ptr = p;
+    return 0;
+}
+
+}
+
+AllocCount::Snapshot AllocCount::snapshot()
+{
+    Snapshot s = { s_allocations.load(std::memory_order_relaxed),
+                   s_frees.load(std::memory_order_relaxed),
+                   s_bytes.load(std::memory_order_relaxed) };
+    return s;
+}
+
+bool AllocCount::enabled()
+{
+    return true;
+}
+
+#else
+
+AllocCount::Snapshot AllocCount::snapshot()
+{
+    Snapshot s = { 0, 0, 0 };
+    return s;
+}
+
+bool AllocCount::enabled()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/// Process wide heap allocation counters.
+/** Linking alloccount.cpp into an executable interposes malloc(), calloc(),
+    realloc(), free() and the aligned variants (glibc only), so allocations
+    made by Qt, libstdc++ and QHttpServer are all counted. operator new ends
+    up in malloc() as well. */
+namespace AllocCount
+{
+
+struct Snapshot {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+
+    Snapshot operator-(const Snapshot &o) const {
+        Snapshot d = { allocations - o.allocations, frees - o.frees, bytes - o.bytes };
+        return d;
+    }
+};
+
+/// Returns the counters accumulated since process start.
+Snapshot snapshot();
+
+/// True when the malloc interposition is active on this platform.
+bool enabled();
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Entry {
+    const char *name;
+    BenchmarkFunction function;
+};
+
+std::vector<Entry> &registry()
+{
+    static std::vector<Entry> entries;
+    return entries;
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocsPerOp;
+    double bytesPerOp;
+};
+
+Result run(const Entry &entry, double minTimeNs)
+{
+    uint64_t iterations = 1;
+    for (;;) {
+        BenchmarkState state(iterations);
+        entry.function(state);
+
+        double elapsed = state.elapsedNs();
+        if (elapsed >= minTimeNs || iterations >= 1000000000ull) {
+            Result r;
+            r.name = entry.name;
+            r.iterations = iterations;
+            r.nsPerOp = elapsed / iterations;
+            r.allocsPerOp = double(state.allocations().allocations) / iterations;
+            r.bytesPerOp = double(state.allocations().bytes) / iterations;
+            return r;
+        }
+
+        // Same growth policy as Google Benchmark: aim 40% past the target,
+        // but never grow more than 10x from one round to the next.
+        double multiplier = elapsed > 0 ? minTimeNs * 1.4 / elapsed : 10.0;
+        if (multiplier > 10.0)
+            multiplier = 10.0;
+        uint64_t next = uint64_t(iterations * multiplier);
+        iterations = next > iterations ? next : iterations + 1;
+    }
+}
+
+}
+
+BenchmarkState::BenchmarkState(uint64_t iterations)
+    : m_iterations(iterations),
+      m_done(0),
+      m_running(false),
+      m_elapsedNs(0)
+{
+    AllocCount::Snapshot zero = { 0, 0, 0 };
+    m_allocStart = zero;
+    m_allocations = zero;
+}
+
+void BenchmarkState::pauseTiming()
+{
+    if (!m_running)
+        return;
+    Clock::time_point now = Clock::now();
+    AllocCount::Snapshot allocs = AllocCount::snapshot();
+    m_elapsedNs += std::chrono::duration<double, std::nano>(now - m_start).count();
+    AllocCount::Snapshot delta = allocs - m_allocStart;
+    m_allocations.allocations += delta.allocations;
+    m_allocations.frees += delta.frees;
+    m_allocations.bytes += delta.bytes;
+    m_running = false;
+}
+
+void BenchmarkState::resumeTiming()
+{
+    if (m_running)
+        return;
+    m_running = true;
+    m_allocStart = AllocCount::snapshot();
+    m_start = Clock::now();
+}
+
+BenchmarkRegistrar::BenchmarkRegistrar(const char *name, BenchmarkFunction function)
+{
+    Entry e = { name, function };
+    registry().push_back(e);
+}
+
+int runBenchmarks(int argc, char **argv)
+{
+    const char *filter = 0;
+    double minTime = 0.5;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            minTime = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else {
+            fprintf(stderr, "usage: %s [--filter SUBSTRING] [--min-time SECONDS] [--json]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (!AllocCount::enabled())
+        fprintf(stderr, "warning: allocation counting is not available on this platform\n");
+
+    if (json)
+        printf("{\n  \"benchmarks\": [");
+    else
+        printf("%-40s %14s %12s %12s %12s\n%s\n", "Benchmark", "Time (ns/op)", "Iterations",
+               "Allocs/op", "Bytes/op", std::string(94, '-').c_str());
+
+    bool first = true;
+    const std::vector<Entry> &entries = registry();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (filter && !strstr(entries[i].name, filter))
+            continue;
+        Result r = run(entries[i], minTime * 1e9);
+        if (json) {
+            printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f,"
+                   " \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+                   first ? "" : ",", r.name.c_str(), (unsigned long long)r.iterations,
+                   r.nsPerOp, r.allocsPerOp, r.bytesPerOp);
+        } else {
+            printf("%-40s %14.1f %12llu %12.2f %12.1f\n", r.name.c_str(), r.nsPerOp,
+                   (unsigned long long)r.iterations, r.allocsPerOp, r.bytesPerOp);
+        }
+        fflush(stdout);
+        first = false;
+    }
+    if (json)
+        printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <cstdint>
+
+#include "alloccount.h"
+
+/// Per-run state handed to a benchmark function.
+/** The function loops on keepRunning(); everything inside the loop is timed
+    and its heap allocations are counted. Set-up work that should not be
+    measured goes between pauseTiming() and resumeTiming().
+
+    @code
+    static void parseSomething(BenchmarkState &state)
+    {
+        while (state.keepRunning())
+            parse(input);
+    }
+    BENCHMARK(parseSomething);
+    @endcode */
+class BenchmarkState
+{
+public:
+    explicit BenchmarkState(uint64_t iterations);
+
+    bool keepRunning()
+    {
+        if (m_done < m_iterations) {
+            if (m_done++ == 0)
+                resumeTiming();
+            return true;
+        }
+        pauseTiming();
+        return false;
+    }
+
+    void pauseTiming();
+    void resumeTiming();
+
+    uint64_t iterations() const { return m_iterations; }
+    double elapsedNs() const { return m_elapsedNs; }
+    const AllocCount::Snapshot &allocations() const { return m_allocations; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t m_iterations;
+    uint64_t m_done;
+    bool m_running;
+    Clock::time_point m_start;
+    AllocCount::Snapshot m_allocStart;
+    double m_elapsedNs;
+    AllocCount::Snapshot m_allocations;
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkState &state);
+
+struct BenchmarkRegistrar
+{
+    BenchmarkRegistrar(const char *name, BenchmarkFunction function);
+};
+
+#define BENCHMARK(function) \
+    static BenchmarkRegistrar function##_registrar(#function, function)
+
+/// Runs every registered benchmark and prints ns/op and allocations/op.
+/** Recognised arguments: <tt>--filter SUBSTRING</tt>, <tt>--min-time SECONDS</tt>
+    and <tt>--json</tt> for machine readable output.
+    @return Process exit code. */
+int runBenchmarks(int argc, char **argv);
+
+#endif
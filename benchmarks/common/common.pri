@@ -0,0 +1,7 @@
+# Shared helpers for the Qt based benchmarks: allocation counting and the
+# microbenchmark runner.
+
+INCLUDEPATH += $$PWD
+
+HEADERS += $$PWD/alloccount.h $$PWD/benchmark.h
+SOURCES += $$PWD/alloccount.cpp $$PWD/benchmark.cpp
@@ -0,0 +1,219 @@
+// Round trips of the permessage-deflate extension, QWebSocketDeflate, through
+// a session negotiated with context takeover and one negotiated without it,
+// followed by the cost of compressing and inflating a 1 KiB and a 64 KiB
+// message in either mode. Divide the message size by ns/op for bytes per
+// nanosecond (GB/s).
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+#include <cstdio>
+
+#include "qwebsocketdeflate_p.h"
+
+#include "benchmark.h"
+
+static const quint64 maxMessageSize = 64 * 1024 * 1024;
+
+/// The compressors of both ends of a connection, set up the way a handshake
+/// would: the server accepts the client's offer and the client parses the
+/// server's response.
+class Session
+{
+public:
+    explicit Session(const QString &offer)
+    {
+        QWebSocketDeflateOptions accepted;
+        QWebSocketDeflateOptions response;
+        m_valid = QWebSocketDeflateOptions::negotiate(offer, &accepted) &&
+                  QWebSocketDeflateOptions::parse(accepted.toString(), &response);
+        server = new QWebSocketDeflate(accepted, true);
+        client = new QWebSocketDeflate(response, false);
+    }
+    ~Session()
+    {
+        delete server;
+        delete client;
+    }
+
+    bool isValid() const { return m_valid; }
+
+    QWebSocketDeflate *server;
+    QWebSocketDeflate *client;
+
+private:
+    Q_DISABLE_COPY(Session)
+
+    bool m_valid;
+};
+
+static const char contextTakeoverOffer[] = "permessage-deflate; client_max_window_bits";
+static const char noContextTakeoverOffer[] =
+    "permessage-deflate; server_no_context_takeover; client_no_context_takeover";
+
+/// Text with some repetition, roughly what a JSON API sends.
+static QByteArray textMessage(int size)
+{
+    static const char *const words[] = {
+        "{\"id\":", "\"name\":", "\"value\":", "true", "false", "null", "},", "[", "]",
+        "\"status\":\"ok\"", "\"items\":", "\"count\":"
+    };
+    QByteArray message;
+    message.reserve(size);
+    quint32 seed = 12345;
+    while (message.size() < size) {
+        seed = seed * 1103515245u + 12345u;
+        message.append(words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))]);
+        message.append(QByteArray::number((seed >> 8) & 0xfff));
+    }
+    message.truncate(size);
+    return message;
+}
+
+/// Bytes deflate cannot shrink, so the output needs more room than the input.
+static QByteArray randomMessage(int size)
+{
+    QByteArray message(size, '\0');
+    quint32 seed = 67890;
+    for (int i = 0; i < size; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        message[i] = char(seed >> 24);
+    }
+    return message;
+}
+
+/// Sends @c message from @c sender to @c receiver, split into @c frames
+/// frames of about the same size the way a fragmented message arrives.
+static bool roundTrip(QWebSocketDeflate *sender, QWebSocketDeflate *receiver,
+                      const QByteArray &message, int frames, QByteArray *compressed)
+{
+    if (!sender->compress(message.constData(), message.size(), compressed))
+        return false;
+
+    QByteArray inflated;
+    const int frameSize = compressed->size() / frames;
+    int offset = 0;
+    for (int frame = 0; frame < frames; ++frame) {
+        const bool isFinal = frame == frames - 1;
+        const int size = isFinal ? compressed->size() - offset : frameSize;
+        if (receiver->decompress(compressed->constData() + offset, size, isFinal, &inflated,
+                                 maxMessageSize) != QWebSocketDeflate::Decompressed)
+            return false;
+        offset += size;
+    }
+    return inflated == message;
+}
+
+/// Without context takeover a message compresses the same every time; with
+/// it, a repeated message shrinks to a back reference to the first one.
+static bool verifyContextTakeover(const char *offer, bool contextTakeover)
+{
+    Session session(QString::fromLatin1(offer));
+    if (!session.isValid() ||
+        session.server->hasDeflateContextTakeover() != contextTakeover ||
+        session.client->hasDeflateContextTakeover() != contextTakeover) {
+        fprintf(stderr, "deflate: cannot negotiate \"%s\"\n", offer);
+        return false;
+    }
+
+    const QByteArray message = textMessage(1024);
+    QByteArray first;
+    QByteArray second;
+    if (!roundTrip(session.server, session.client, message, 1, &first) ||
+        !roundTrip(session.server, session.client, message, 1, &second) ||
+        (contextTakeover ? second.size() >= first.size() : second != first)) {
+        fprintf(stderr, "deflate: repeated message ignores \"%s\"\n", offer);
+        return false;
+    }
+    return true;
+}
+
+/// Every message must come back intact in both directions and both modes,
+/// whether it arrives in one frame or in several.
+static bool verify()
+{
+    QList<QByteArray> messages;
+    messages << QByteArray() << QByteArray("Hello World!") << textMessage(1024)
+             << textMessage(256 * 1024) << randomMessage(64 * 1024)
+             << QByteArray(1024 * 1024, 'a');
+
+    static const char *const offers[] = { contextTakeoverOffer, noContextTakeoverOffer };
+    for (int mode = 0; mode < 2; ++mode) {
+        if (!verifyContextTakeover(offers[mode], mode == 0))
+            return false;
+
+        //one session for all messages, so later ones may refer to earlier ones
+        Session session(QString::fromLatin1(offers[mode]));
+        for (int i = 0; i < messages.size(); ++i) {
+            const QByteArray &message = messages.at(i);
+            for (int frames = 1; frames <= 3; ++frames) {
+                QByteArray compressed;
+                if (!roundTrip(session.server, session.client, message, frames, &compressed) ||
+                    !roundTrip(session.client, session.server, message, frames, &compressed)) {
+                    fprintf(stderr, "deflate: %d byte message in %d frames corrupted, \"%s\"\n",
+                            message.size(), frames, offers[mode]);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void compress(BenchmarkState &state, const char *offer, const QByteArray &message)
+{
+    Session session(QString::fromLatin1(offer));
+    QByteArray compressed;
+    while (state.keepRunning())
+        session.server->compress(message.constData(), message.size(), &compressed);
+}
+
+/// Inflates a message compressed without context takeover, which any
+/// receiver can take again and again.
+static void decompress(BenchmarkState &state, const char *offer, const QByteArray &message)
+{
+    Session session(QString::fromLatin1(offer));
+    Session source(QString::fromLatin1(noContextTakeoverOffer));
+    QByteArray compressed;
+    source.server->compress(message.constData(), message.size(), &compressed);
+    QByteArray inflated;
+    inflated.reserve(message.size());
+    while (state.keepRunning()) {
+        inflated.resize(0);
+        session.client->decompress(compressed.constData(), compressed.size(), true, &inflated,
+                                   maxMessageSize);
+    }
+}
+
+#define DEFLATE_BENCHMARKS(label, size) \
+    static void compressContextTakeover##label(BenchmarkState &state) \
+    { \
+        compress(state, contextTakeoverOffer, textMessage(size)); \
+    } \
+    BENCHMARK(compressContextTakeover##label); \
+    static void compressNoContextTakeover##label(BenchmarkState &state) \
+    { \
+        compress(state, noContextTakeoverOffer, textMessage(size)); \
+    } \
+    BENCHMARK(compressNoContextTakeover##label); \
+    static void decompressContextTakeover##label(BenchmarkState &state) \
+    { \
+        decompress(state, contextTakeoverOffer, textMessage(size)); \
+    } \
+    BENCHMARK(decompressContextTakeover##label); \
+    static void decompressNoContextTakeover##label(BenchmarkState &state) \
+    { \
+        decompress(state, noContextTakeoverOffer, textMessage(size)); \
+    } \
+    BENCHMARK(decompressNoContextTakeover##label)
+
+DEFLATE_BENCHMARKS(1k, 1024);
+DEFLATE_BENCHMARKS(64k, 64 * 1024);
+
+int main(int argc, char **argv)
+{
+    if (!verify())
+        return 1;
+    return runBenchmarks(argc, argv);
+}
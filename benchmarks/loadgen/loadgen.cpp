@@ -0,0 +1,821 @@
+// loadgen - HTTP/1.1 load generator for QHttpServer.
+//
+// Every worker thread owns a slice of the connections and drives them from
+// its own edge-triggered epoll instance. Requests are picked from a weighted
+// mix, optionally pipelined, and the time between writing a request and
+// reading the last byte of its response is recorded. The result is printed
+// as a single JSON object so release-to-release runs can be diffed by scripts.
+//
+// Typical run against examples/helloworld (listens on 8080 and accepts
+// maxConnsPerThread=10 connections with its default QHttpServer settings):
+//
+//     ./loadgen --port 8080 --threads 2 --connections 8 --duration 10
+//               --pipeline 4 --mix "GET /:9,POST /echo 512:1"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct RequestTemplate {
+    std::string method;
+    std::string path;
+    size_t bodySize;
+    unsigned weight;
+    std::string wire;   // fully rendered request bytes
+    bool head;          // the response has no body
+};
+
+struct Options {
+    std::string host;
+    int port;
+    int threads;
+    int connections;
+    double duration;
+    double warmup;
+    int pipeline;
+    bool keepAlive;
+    std::string mix;
+    std::string output;
+
+    Options()
+        : host("127.0.0.1"), port(8080), threads(2), connections(8), duration(10.0),
+          warmup(1.0), pipeline(1), keepAlive(true), mix("GET /:1") {
+    }
+};
+
+// Incremented by one worker thread and read by the main thread while the
+// worker runs, so single-writer relaxed atomics suffice.
+struct Counter {
+    std::atomic<uint64_t> value;
+
+    Counter() : value(0) {}
+
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+    Counter &operator+=(uint64_t n) {
+        value.store(load() + n, std::memory_order_relaxed);
+        return *this;
+    }
+    Counter &operator++() { return *this += 1; }
+};
+
+struct Counters {
+    Counter requests;
+    Counter bytesRead;
+    Counter bytesWritten;
+    Counter connects;
+    Counter connectErrors;
+    Counter readErrors;
+    Counter writeErrors;
+    Counter parseErrors;
+    Counter non2xx;
+    Counter reconnects;
+
+    void add(const Counters &o) {
+        requests += o.requests.load();
+        bytesRead += o.bytesRead.load();
+        bytesWritten += o.bytesWritten.load();
+        connects += o.connects.load();
+        connectErrors += o.connectErrors.load();
+        readErrors += o.readErrors.load();
+        writeErrors += o.writeErrors.load();
+        parseErrors += o.parseErrors.load();
+        non2xx += o.non2xx.load();
+        reconnects += o.reconnects.load();
+    }
+};
+
+/// Incremental HTTP/1.1 response parser. Handles Content-Length and chunked
+/// bodies, and responses delimited by connection close.
+class ResponseParser {
+public:
+    enum Result { NeedMore, Complete, Error };
+
+    ResponseParser() : m_bodyless(false) { reset(); }
+
+    void reset() {
+        m_state = StatusLine;
+        m_line.clear();
+        m_status = 0;
+        m_contentLength = -1;
+        m_chunked = false;
+        m_close = false;
+        m_remaining = 0;
+    }
+
+    /// Whether the response being parsed answers a HEAD request.
+    /** Kept across reset(), the caller sets it for every response. */
+    void setBodyless(bool bodyless) { m_bodyless = bodyless; }
+
+    int status() const { return m_status; }
+    bool closeAfter() const { return m_close; }
+    bool readsUntilEof() const { return m_state == BodyUntilEof; }
+
+    /// Consumes bytes up to the end of the current response.
+    /** @return Complete when a response finished, *consumed tells how much
+        of @c data belonged to it. */
+    Result feed(const char *data, size_t len, size_t *consumed) {
+        size_t i = 0;
+        while (i < len) {
+            switch (m_state) {
+            case StatusLine:
+            case Header:
+            case ChunkSize:
+            case ChunkDataEnd:
+            case Trailer: {
+                const char *nl = static_cast<const char *>(memchr(data + i, '\n', len - i));
+                if (!nl) {
+                    m_line.append(data + i, len - i);
+                    if (m_line.size() > 16384)
+                        return Error;
+                    i = len;
+                    break;
+                }
+                m_line.append(data + i, nl - (data + i));
+                i = (nl - data) + 1;
+                if (!m_line.empty() && m_line[m_line.size() - 1] == '\r')
+                    m_line.resize(m_line.size() - 1);
+                Result r = line();
+                m_line.clear();
+                if (r == Error)
+                    return Error;
+                if (r == Complete) {
+                    *consumed = i;
+                    return Complete;
+                }
+                break;
+            }
+            case Body:
+            case ChunkData: {
+                size_t take = std::min<uint64_t>(m_remaining, len - i);
+                m_remaining -= take;
+                i += take;
+                if (m_remaining == 0) {
+                    if (m_state == ChunkData) {
+                        m_state = ChunkDataEnd;
+                    } else {
+                        *consumed = i;
+                        return Complete;
+                    }
+                }
+                break;
+            }
+            case BodyUntilEof:
+                i = len;
+                break;
+            }
+        }
+        *consumed = len;
+        return NeedMore;
+    }
+
+private:
+    enum State { StatusLine, Header, Body, BodyUntilEof, ChunkSize, ChunkData, ChunkDataEnd, Trailer };
+
+    static bool startsWithNoCase(const std::string &s, const char *prefix) {
+        size_t n = strlen(prefix);
+        return s.size() >= n && strncasecmp(s.c_str(), prefix, n) == 0;
+    }
+
+    static std::string valueOf(const std::string &s) {
+        size_t colon = s.find(':');
+        if (colon == std::string::npos)
+            return std::string();
+        size_t b = s.find_first_not_of(" \t", colon + 1);
+        return b == std::string::npos ? std::string() : s.substr(b);
+    }
+
+    Result line() {
+        switch (m_state) {
+        case StatusLine:
+            if (m_line.compare(0, 5, "HTTP/") != 0 || m_line.size() < 12)
+                return Error;
+            m_status = atoi(m_line.c_str() + 9);
+            // HTTP/1.0 defaults to close
+            m_close = m_line.compare(5, 3, "1.0") == 0;
+            m_state = Header;
+            return NeedMore;
+        case Header:
+            if (m_line.empty())
+                return headersDone();
+            if (startsWithNoCase(m_line, "content-length:")) {
+                m_contentLength = strtoll(valueOf(m_line).c_str(), 0, 10);
+            } else if (startsWithNoCase(m_line, "transfer-encoding:")) {
+                m_chunked = strcasestr(m_line.c_str(), "chunked") != 0;
+            } else if (startsWithNoCase(m_line, "connection:")) {
+                std::string v = valueOf(m_line);
+                if (strcasecmp(v.c_str(), "close") == 0)
+                    m_close = true;
+                else if (strcasecmp(v.c_str(), "keep-alive") == 0)
+                    m_close = false;
+            }
+            return NeedMore;
+        case ChunkSize:
+            m_remaining = strtoull(m_line.c_str(), 0, 16);
+            m_state = m_remaining ? ChunkData : Trailer;
+            return NeedMore;
+        case ChunkDataEnd:
+            m_state = ChunkSize;
+            return NeedMore;
+        case Trailer:
+            return m_line.empty() ? Complete : NeedMore;
+        default:
+            return Error;
+        }
+    }
+
+    Result headersDone() {
+        // 1xx interim responses carry no body and precede the real one
+        if (m_status >= 100 && m_status < 200) {
+            int keepClose = m_close;
+            reset();
+            m_close = keepClose;
+            return NeedMore;
+        }
+        if (m_bodyless || m_status == 204 || m_status == 304)
+            return Complete;
+        if (m_chunked) {
+            m_state = ChunkSize;
+            return NeedMore;
+        }
+        if (m_contentLength >= 0) {
+            if (m_contentLength == 0)
+                return Complete;
+            m_remaining = m_contentLength;
+            m_state = Body;
+            return NeedMore;
+        }
+        m_close = true;
+        m_state = BodyUntilEof;
+        return NeedMore;
+    }
+
+    State m_state;
+    std::string m_line;
+    int m_status;
+    long long m_contentLength;
+    bool m_chunked;
+    bool m_close;
+    uint64_t m_remaining;
+    bool m_bodyless;
+};
+
+struct Pending {
+    Clock::time_point sent;
+    bool head;
+};
+
+struct Connection {
+    int fd;
+    bool connected;
+    std::string out;            // bytes queued for the socket
+    size_t outPos;
+    std::deque<Pending> inFlight;
+    ResponseParser parser;
+    uint32_t rng;
+
+    Connection() : fd(-1), connected(false), outPos(0), rng(0) {}
+};
+
+struct Worker {
+    const Options *options;
+    const std::vector<RequestTemplate> *mix;
+    unsigned totalWeight;
+    sockaddr_in address;
+    int epfd;
+    int connectionCount;
+    std::vector<Connection> connections;
+    std::vector<uint32_t> latencies;    // microseconds, measured phase only
+    Counters counters;
+    std::atomic<bool> *measuring;
+    std::atomic<bool> *stop;
+    std::thread thread;
+
+    void run();
+    bool open(Connection &c);
+    void close(Connection &c, bool reconnect);
+    void fill(Connection &c);
+    bool flush(Connection &c);
+    bool drain(Connection &c);
+    const RequestTemplate &pick(Connection &c);
+};
+
+const RequestTemplate &Worker::pick(Connection &c)
+{
+    if (mix->size() == 1)
+        return mix->front();
+    // xorshift32, one stream per connection
+    c.rng ^= c.rng << 13;
+    c.rng ^= c.rng >> 17;
+    c.rng ^= c.rng << 5;
+    unsigned ticket = c.rng % totalWeight;
+    for (size_t i = 0; i < mix->size(); ++i) {
+        if (ticket < (*mix)[i].weight)
+            return (*mix)[i];
+        ticket -= (*mix)[i].weight;
+    }
+    return mix->back();
+}
+
+bool Worker::open(Connection &c)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0) {
+        ++counters.connectErrors;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 &&
+            errno != EINPROGRESS) {
+        ++counters.connectErrors;
+        ::close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+
+    c.connected = false;
+    c.out.clear();
+    c.outPos = 0;
+    c.inFlight.clear();
+    c.parser.reset();
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+
+    fill(c);
+    return true;
+}
+
+void Worker::close(Connection &c, bool reconnect)
+{
+    if (c.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, 0);
+        ::close(c.fd);
+        c.fd = -1;
+    }
+    if (reconnect && !stop->load(std::memory_order_relaxed)) {
+        ++counters.reconnects;
+        open(c);
+    }
+}
+
+void Worker::fill(Connection &c)
+{
+    // Without keep-alive every connection carries exactly one request.
+    int depth = options->keepAlive ? options->pipeline : 1;
+    while (int(c.inFlight.size()) < depth) {
+        const RequestTemplate &t = pick(c);
+        if (c.outPos == c.out.size()) {
+            c.out.clear();
+            c.outPos = 0;
+        }
+        c.out += t.wire;
+        Pending p;
+        p.sent = Clock::now();
+        p.head = t.head;
+        c.inFlight.push_back(p);
+    }
+}
+
+bool Worker::flush(Connection &c)
+{
+    while (c.outPos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno == EINTR)
+                continue;
+            ++counters.writeErrors;
+            return false;
+        }
+        c.outPos += n;
+        counters.bytesWritten += n;
+    }
+    return true;
+}
+
+bool Worker::drain(Connection &c)
+{
+    char buffer[64 * 1024];
+    for (;;) {
+        ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+        if (n == 0) {
+            // Peer closed: completes an EOF-delimited body, anything else in
+            // flight is lost.
+            if (c.parser.readsUntilEof() && !c.inFlight.empty()) {
+                c.parser.reset();
+                c.inFlight.pop_front();
+                ++counters.requests;
+            }
+            if (!c.inFlight.empty())
+                ++counters.readErrors;
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno == EINTR)
+                continue;
+            ++counters.readErrors;
+            return false;
+        }
+        counters.bytesRead += n;
+
+        size_t offset = 0;
+        while (offset < size_t(n)) {
+            size_t consumed = 0;
+            if (!c.inFlight.empty())
+                c.parser.setBodyless(c.inFlight.front().head);
+            ResponseParser::Result r = c.parser.feed(buffer + offset, n - offset, &consumed);
+            offset += consumed;
+            if (r == ResponseParser::Error) {
+                ++counters.parseErrors;
+                return false;
+            }
+            if (r == ResponseParser::NeedMore)
+                break;
+
+            if (c.inFlight.empty()) {
+                ++counters.parseErrors;     // unsolicited response
+                return false;
+            }
+            Clock::time_point sent = c.inFlight.front().sent;
+            c.inFlight.pop_front();
+            ++counters.requests;
+            if (c.parser.status() < 200 || c.parser.status() > 299)
+                ++counters.non2xx;
+            if (measuring->load(std::memory_order_relaxed)) {
+                long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            Clock::now() - sent).count();
+                latencies.push_back(uint32_t(std::min<long long>(us, UINT32_MAX)));
+            }
+            bool closeAfter = c.parser.closeAfter() || !options->keepAlive;
+            c.parser.reset();
+            if (closeAfter)
+                return false;
+            if (!stop->load(std::memory_order_relaxed)) {
+                fill(c);
+                if (!flush(c))
+                    return false;
+            }
+        }
+    }
+}
+
+void Worker::run()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    connections.resize(connectionCount);
+    for (size_t i = 0; i < connections.size(); ++i) {
+        connections[i].rng = uint32_t(0x9E3779B9u * (i + 1) + uintptr_t(this));
+        open(connections[i]);
+    }
+
+    std::vector<epoll_event> events(256);
+    while (!stop->load(std::memory_order_relaxed)) {
+        int n = epoll_wait(epfd, events.data(), int(events.size()), 50);
+        for (int i = 0; i < n; ++i) {
+            Connection &c = *static_cast<Connection *>(events[i].data.ptr);
+            if (c.fd < 0)
+                continue;
+            uint32_t e = events[i].events;
+
+            if (!c.connected && (e & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    ++counters.connectErrors;
+                    close(c, true);
+                    continue;
+                }
+                c.connected = true;
+                ++counters.connects;
+            }
+            if (!c.connected)
+                continue;
+
+            bool ok = true;
+            if (e & EPOLLOUT)
+                ok = flush(c);
+            if (ok && (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                ok = drain(c);
+            if (!ok)
+                close(c, true);
+        }
+
+        // Connections whose socket could not even be created are retried
+        // here, so the run keeps --connections connections open.
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (connections[i].fd < 0 && !stop->load(std::memory_order_relaxed)) {
+                ++counters.reconnects;
+                open(connections[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < connections.size(); ++i)
+        close(connections[i], false);
+    ::close(epfd);
+}
+
+bool parseMix(const Options &options, std::vector<RequestTemplate> *mix)
+{
+    // "METHOD PATH [BODYBYTES]:WEIGHT,..."
+    std::string spec = options.mix;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(start, end - start);
+        start = end + 1;
+        if (item.empty())
+            continue;
+
+        RequestTemplate t;
+        t.bodySize = 0;
+        t.weight = 1;
+        size_t colon = item.rfind(':');
+        if (colon != std::string::npos && colon > item.find('/')) {
+            t.weight = unsigned(atoi(item.c_str() + colon + 1));
+            item.resize(colon);
+        }
+        char method[32], path[2048];
+        unsigned long body = 0;
+        int fields = sscanf(item.c_str(), "%31s %2047s %lu", method, path, &body);
+        if (fields < 2 || t.weight == 0)
+            return false;
+        t.method = method;
+        t.path = path;
+        t.bodySize = body;
+        t.head = t.method == "HEAD";
+
+        t.wire = t.method + " " + t.path + " HTTP/1.1\r\n";
+        t.wire += "Host: " + options.host + ":" + std::to_string(options.port) + "\r\n";
+        t.wire += "User-Agent: qhttpserver-loadgen\r\n";
+        if (!options.keepAlive)
+            t.wire += "Connection: close\r\n";
+        if (t.bodySize || t.method == "POST" || t.method == "PUT") {
+            t.wire += "Content-Type: application/octet-stream\r\n";
+            t.wire += "Content-Length: " + std::to_string(t.bodySize) + "\r\n";
+        }
+        t.wire += "\r\n";
+        t.wire.append(t.bodySize, 'x');
+        mix->push_back(t);
+    }
+    return !mix->empty();
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --host ADDR          IPv4 address of the server (default 127.0.0.1)\n"
+            "  --port N             server port (default 8080)\n"
+            "  --threads N          worker threads, one epoll loop each (default 2)\n"
+            "  --connections N      total concurrent connections (default 8)\n"
+            "  --duration SECONDS   measured run time (default 10)\n"
+            "  --warmup SECONDS     unmeasured ramp-up time (default 1)\n"
+            "  --pipeline N         requests in flight per connection (default 1)\n"
+            "  --no-keepalive       one request per connection\n"
+            "  --mix SPEC           \"METHOD PATH [BODYBYTES]:WEIGHT,...\" (default \"GET /:1\")\n"
+            "  --output FILE        write the JSON report to FILE instead of stdout\n",
+            argv0);
+}
+
+bool parseArgs(int argc, char **argv, Options *o)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--no-keepalive") {
+            o->keepAlive = false;
+        } else if (a == "--help" || a == "-h") {
+            return false;
+        } else if (!hasValue) {
+            return false;
+        } else if (a == "--host") {
+            o->host = argv[++i];
+        } else if (a == "--port") {
+            o->port = atoi(argv[++i]);
+        } else if (a == "--threads") {
+            o->threads = atoi(argv[++i]);
+        } else if (a == "--connections") {
+            o->connections = atoi(argv[++i]);
+        } else if (a == "--duration") {
+            o->duration = atof(argv[++i]);
+        } else if (a == "--warmup") {
+            o->warmup = atof(argv[++i]);
+        } else if (a == "--pipeline") {
+            o->pipeline = atoi(argv[++i]);
+        } else if (a == "--mix") {
+            o->mix = argv[++i];
+        } else if (a == "--output") {
+            o->output = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return o->port > 0 && o->threads > 0 && o->connections >= o->threads &&
+            o->duration > 0 && o->warmup >= 0 && o->pipeline > 0;
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = size_t(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void appendf(std::string *s, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(0, 0, format, copy);
+    va_end(copy);
+    if (len > 0) {
+        size_t at = s->size();
+        s->resize(at + len + 1);
+        vsnprintf(&(*s)[at], len + 1, format, args);
+        s->resize(at + len);
+    }
+    va_end(args);
+}
+
+std::string jsonString(const std::string &s)
+{
+    std::string r = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        char ch = s[i];
+        if (ch == '"' || ch == '\\') {
+            r += '\\';
+            r += ch;
+        } else if (uint8_t(ch) < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+            r += esc;
+        } else {
+            r += ch;
+        }
+    }
+    return r + "\"";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseArgs(argc, argv, &options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<RequestTemplate> mix;
+    if (!parseMix(options, &mix)) {
+        fprintf(stderr, "invalid --mix: %s\n", options.mix.c_str());
+        return 2;
+    }
+    unsigned totalWeight = 0;
+    for (size_t i = 0; i < mix.size(); ++i)
+        totalWeight += mix[i].weight;
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uint16_t(options.port));
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+        fprintf(stderr, "invalid --host: %s\n", options.host.c_str());
+        return 2;
+    }
+
+    std::atomic<bool> measuring(false);
+    std::atomic<bool> stop(false);
+    std::vector<Worker> workers(options.threads);
+    for (int i = 0; i < options.threads; ++i) {
+        Worker &w = workers[i];
+        w.options = &options;
+        w.mix = &mix;
+        w.totalWeight = totalWeight;
+        w.address = address;
+        w.connectionCount = options.connections / options.threads +
+                (i < options.connections % options.threads ? 1 : 0);
+        w.measuring = &measuring;
+        w.stop = &stop;
+        w.latencies.reserve(1 << 20);
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].thread = std::thread(&Worker::run, &workers[i]);
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    // The counters the rates are computed from are taken together with the
+    // clock at both ends of the measurement.
+    Counters before;
+    for (size_t i = 0; i < workers.size(); ++i)
+        before.add(workers[i].counters);
+    measuring = true;
+    Clock::time_point started = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    measuring = false;
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+    Counters after;
+    for (size_t i = 0; i < workers.size(); ++i)
+        after.add(workers[i].counters);
+    stop = true;
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].thread.join();
+
+    Counters total;
+    std::vector<uint32_t> latencies;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        total.add(workers[i].counters);
+        latencies.insert(latencies.end(), workers[i].latencies.begin(),
+                         workers[i].latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for (size_t i = 0; i < latencies.size(); ++i)
+        mean += latencies[i];
+    if (!latencies.empty())
+        mean /= latencies.size();
+
+    uint64_t measured = after.requests.load() - before.requests.load();
+    // Built in a string, the mix can be arbitrarily long.
+    std::string report;
+    appendf(&report,
+        "{\n"
+        "  \"config\": {\"host\": %s, \"port\": %d, \"threads\": %d, \"connections\": %d,"
+        " \"pipeline\": %d, \"keepalive\": %s, \"duration_s\": %.3f, \"warmup_s\": %.3f,"
+        " \"mix\": %s},\n"
+        "  \"elapsed_s\": %.3f,\n"
+        "  \"requests\": %llu,\n"
+        "  \"rps\": %.1f,\n"
+        "  \"throughput_bytes_per_s\": {\"read\": %.1f, \"written\": %.1f},\n"
+        "  \"latency_us\": {\"min\": %u, \"mean\": %.1f, \"p50\": %u, \"p90\": %u,"
+        " \"p99\": %u, \"p999\": %u, \"max\": %u},\n"
+        "  \"totals\": {\"requests\": %llu, \"connects\": %llu, \"reconnects\": %llu},\n"
+        "  \"errors\": {\"connect\": %llu, \"read\": %llu, \"write\": %llu, \"parse\": %llu,"
+        " \"non_2xx\": %llu}\n"
+        "}\n",
+        jsonString(options.host).c_str(), options.port, options.threads, options.connections,
+        options.pipeline, options.keepAlive ? "true" : "false", options.duration, options.warmup,
+        jsonString(options.mix).c_str(),
+        elapsed,
+        (unsigned long long)measured,
+        measured / elapsed,
+        (after.bytesRead.load() - before.bytesRead.load()) / elapsed,
+        (after.bytesWritten.load() - before.bytesWritten.load()) / elapsed,
+        latencies.empty() ? 0 : latencies.front(), mean,
+        percentile(latencies, 50), percentile(latencies, 90),
+        percentile(latencies, 99), percentile(latencies, 99.9),
+        latencies.empty() ? 0 : latencies.back(),
+        (unsigned long long)total.requests.load(), (unsigned long long)total.connects.load(),
+        (unsigned long long)total.reconnects.load(),
+        (unsigned long long)total.connectErrors.load(), (unsigned long long)total.readErrors.load(),
+        (unsigned long long)total.writeErrors.load(), (unsigned long long)total.parseErrors.load(),
+        (unsigned long long)total.non2xx.load());
+
+    FILE *out = stdout;
+    if (!options.output.empty()) {
+        out = fopen(options.output.c_str(), "w");
+        if (!out) {
+            perror(options.output.c_str());
+            return 1;
+        }
+    }
+    fwrite(report.data(), 1, report.size(), out);
+    if (out != stdout)
+        fclose(out);
+
+    return measured ? 0 : 1;
+}
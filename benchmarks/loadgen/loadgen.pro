@@ -0,0 +1,7 @@
+TARGET = loadgen
+
+TEMPLATE = app
+CONFIG += console release c++11 thread
+CONFIG -= qt app_bundle
+
+SOURCES = loadgen.cpp
@@ -0,0 +1,20 @@
+TARGET = maskbench
+
+QT -= gui
+
+CONFIG += console release c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src/websockets
+LIBS += -L../../lib
+
+win32 {
+    debug: LIBS += -lqhttpserverd
+    else: LIBS += -lqhttpserver
+} else {
+    LIBS += -lqhttpserver
+}
+
+include(../common/common.pri)
+
+SOURCES += maskbench.cpp
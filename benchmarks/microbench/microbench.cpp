@@ -0,0 +1,284 @@
+// Microbenchmarks for the QHttpConnection parser callbacks and QHttpResponse
+// serialization. Requests are fed through an in-memory socket and responses
+// are written into a null sink, so nothing but the library code is measured.
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QTcpSocket>
+
+#include <cstdio>
+#include <cstring>
+
+#include "qhttpserver.h"
+#include "qhttpconnection.h"
+#include "qhttprequest.h"
+#include "qhttpresponse.h"
+#include "qhttphandler.h"
+
+#include "benchmark.h"
+
+/// QTcpSocket stand-in that reads from a byte array and discards writes.
+class MemorySocket : public QTcpSocket
+{
+public:
+    MemorySocket() : m_pos(0), m_written(0)
+    {
+        setOpenMode(QIODevice::ReadWrite | QIODevice::Unbuffered);
+    }
+
+    /// Make @c data readable and emit readyRead(), which runs the parser.
+    void feed(const QByteArray &data)
+    {
+        m_input = data;
+        m_pos = 0;
+        Q_EMIT readyRead();
+    }
+
+    qint64 written() const { return m_written; }
+
+    qint64 bytesAvailable() const
+    {
+        return m_input.size() - m_pos;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        qint64 n = qMin(maxSize, qint64(m_input.size() - m_pos));
+        memcpy(data, m_input.constData() + m_pos, n);
+        m_pos += n;
+        return n;
+    }
+
+    qint64 writeData(const char *, qint64 size)
+    {
+        // Never emit bytesWritten() from here, the connection only expects it
+        // from the event loop.
+        m_written += size;
+        return size;
+    }
+
+private:
+    QByteArray m_input;
+    int m_pos;
+    qint64 m_written;
+};
+
+/// Two connections, one dispatching through signals and one through a
+/// QHttpHandler, plus the request/response pair of the last parsed message.
+struct Fixture
+{
+    MemorySocket *socket;
+    QHttpConnection *connection;
+    MemorySocket *handlerSocket;
+    QHttpConnection *handlerConnection;
+    QHttpRequest *request;
+    QHttpResponse *response;
+    bool storeBody;
+
+    /// Release the objects of the last message the way an application would.
+    void release()
+    {
+        delete response;
+        response = 0;
+        delete request;
+        request = 0;
+        QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+    }
+};
+
+static Fixture fixture;
+
+static const QByteArray minimalGet("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+static const QByteArray browserGet(
+    "GET /search/results?q=qhttpserver+benchmark&page=2&sort=desc HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://www.example.com/search\r\n"
+    "Cookie: session=7f3c9a1e2b4d6f80; theme=dark; tracking=off\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n");
+
+static QByteArray postRequest(int bodySize)
+{
+    QByteArray r("POST /upload HTTP/1.1\r\n"
+                 "Host: localhost\r\n"
+                 "Content-Type: application/octet-stream\r\n"
+                 "Content-Length: ");
+    r += QByteArray::number(bodySize);
+    r += "\r\n\r\n";
+    r += QByteArray(bodySize, 'x');
+    return r;
+}
+
+static const QByteArray post1k = postRequest(1024);
+
+class BenchmarkHandler : public QHttpHandler
+{
+public:
+    void onRequest(QHttpRequest *request, QHttpResponse *response)
+    {
+        fixture.request = request;
+        fixture.response = response;
+    }
+};
+
+static void parse(BenchmarkState &state, const QByteArray &request, bool storeBody,
+                  MemorySocket *socket)
+{
+    fixture.storeBody = storeBody;
+    while (state.keepRunning()) {
+        socket->feed(request);
+
+        state.pauseTiming();
+        fixture.release();
+        state.resumeTiming();
+    }
+}
+
+static void parseMinimalGet(BenchmarkState &state)
+{
+    parse(state, minimalGet, false, fixture.socket);
+}
+BENCHMARK(parseMinimalGet);
+
+static void parseBrowserGet(BenchmarkState &state)
+{
+    parse(state, browserGet, false, fixture.socket);
+}
+BENCHMARK(parseBrowserGet);
+
+static void parsePost1k(BenchmarkState &state)
+{
+    parse(state, post1k, false, fixture.socket);
+}
+BENCHMARK(parsePost1k);
+
+static void parsePost1kStoreBody(BenchmarkState &state)
+{
+    parse(state, post1k, true, fixture.socket);
+}
+BENCHMARK(parsePost1kStoreBody);
+
+static void parseMinimalGetHandler(BenchmarkState &state)
+{
+    parse(state, minimalGet, false, fixture.handlerSocket);
+}
+BENCHMARK(parseMinimalGetHandler);
+
+static void parsePost1kHandler(BenchmarkState &state)
+{
+    parse(state, post1k, false, fixture.handlerSocket);
+}
+BENCHMARK(parsePost1kHandler);
+
+static void respond(BenchmarkState &state, const QByteArray &body, bool setHeaders)
+{
+    fixture.storeBody = false;
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        fixture.socket->feed(minimalGet);
+        QHttpResponse *response = fixture.response;
+        fixture.response = 0;
+        state.resumeTiming();
+
+        if (setHeaders) {
+            response->setHeader("Content-Type", "text/plain");
+            response->setHeader("Content-Length", QString::number(body.size()));
+        }
+        response->writeHead(200);
+        response->end(body);
+
+        state.pauseTiming();
+        fixture.release();
+        state.resumeTiming();
+    }
+}
+
+static void respondHeadOnly(BenchmarkState &state)
+{
+    respond(state, QByteArray(), false);
+}
+BENCHMARK(respondHeadOnly);
+
+static void respondHelloWorld(BenchmarkState &state)
+{
+    respond(state, QByteArray("Hello World!\n"), true);
+}
+BENCHMARK(respondHelloWorld);
+
+static void respond4k(BenchmarkState &state)
+{
+    respond(state, QByteArray(4096, 'x'), true);
+}
+BENCHMARK(respond4k);
+
+/// Runs the benchmarks on the thread that owns the socket, as QHttpConnection
+/// insists on living in a different thread than the server.
+class BenchmarkThread : public QThread
+{
+public:
+    BenchmarkThread(int argc, char **argv) : m_argc(argc), m_argv(argv), m_result(1) {}
+
+    int result() const { return m_result; }
+
+protected:
+    void run()
+    {
+        m_result = runBenchmarks(m_argc, m_argv);
+        delete fixture.connection;
+        fixture.connection = 0;
+        delete fixture.handlerConnection;
+        fixture.handlerConnection = 0;
+    }
+
+private:
+    int m_argc;
+    char **m_argv;
+    int m_result;
+};
+
+static void quietMessageHandler(QtMsgType type, const QMessageLogContext &, const QString &msg)
+{
+    if (type != QtDebugMsg && type != QtInfoMsg)
+        fprintf(stderr, "%s\n", qPrintable(msg));
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    qInstallMessageHandler(quietMessageHandler);
+
+    QHttpServer server(0, false);
+    BenchmarkThread thread(argc, argv);
+
+    fixture.socket = new MemorySocket;
+    fixture.socket->moveToThread(&thread);
+    fixture.connection = new QHttpConnection(&server, fixture.socket);
+
+    BenchmarkHandler handler;
+    server.setHandler(&handler);
+    fixture.handlerSocket = new MemorySocket;
+    fixture.handlerSocket->moveToThread(&thread);
+    fixture.handlerConnection = new QHttpConnection(&server, fixture.handlerSocket);
+    fixture.request = 0;
+    fixture.response = 0;
+    fixture.storeBody = false;
+
+    QObject::connect(fixture.connection, &QHttpConnection::newRequest,
+                     [](QHttpRequest *request, QHttpResponse *response) {
+        fixture.request = request;
+        fixture.response = response;
+        if (fixture.storeBody)
+            request->storeBody();
+    });
+
+    thread.start();
+    thread.wait();
+    return thread.result();
+}
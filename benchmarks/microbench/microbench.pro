@@ -0,0 +1,21 @@
+TARGET = microbench
+
+QT += network
+QT -= gui
+
+CONFIG += console release c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src
+LIBS += -L../../lib
+
+win32 {
+    debug: LIBS += -lqhttpserverd
+    else: LIBS += -lqhttpserver
+} else {
+    LIBS += -lqhttpserver
+}
+
+include(../common/common.pri)
+
+SOURCES += microbench.cpp
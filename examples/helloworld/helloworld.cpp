@@ -12,6 +12,10 @@ QThread *mainThread;
 HelloWorld::HelloWorld()
 {
     QHttpServer *server = new QHttpServer(this);
+    if (QCoreApplication::arguments().contains("--epoll"))
+        server->setIoBackend(QHttpServer::EpollBackend);
+    else if (QCoreApplication::arguments().contains("--io-uring"))
+        server->setIoBackend(QHttpServer::IoUringBackend);
     connect(server, SIGNAL(newRequest(QHttpRequest*, QHttpResponse*)),
             this, SLOT(handleRequest(QHttpRequest*, QHttpResponse*)));
 
@@ -3,6 +3,8 @@ CONFIG += ordered
 TEMPLATE = subdirs
 
 SUBDIRS += src \
-           examples
+           examples \
+           benchmarks
 
 examples.depends = src
+benchmarks.depends = src
@@ -24,34 +24,73 @@
 
 #include <QTcpSocket>
 #include <QHostAddress>
+#include <QMetaMethod>
+#include <QTextStream>
+
+#include <climits>
 
 #include "http_parser.h"
 #include "qhttprequest.h"
 #include "qhttpresponse.h"
 #include "qhttpserver.h"
+#include "qhttphandler.h"
+#include "qhttptransport.h"
+#include "websockets/qwebsocket_p.h"
+#include "websockets/qwebsockethandshakerequest_p.h"
+#include "websockets/qwebsockethandshakeresponse_p.h"
 
 /// @cond nodoc
 
+// Period over which QHttpServer::setMinimumBodyRate() is enforced
+static const int BodyRateWindow = 5000;
+
 QHttpConnection::QHttpConnection(QHttpServer *parent, QTcpSocket *socket)
+    : QHttpConnection(parent, socket, 0, socket->thread())
+{
+}
+
+QHttpConnection::QHttpConnection(QHttpServer *parent, QHttpTransport *transport, QThread *thread)
+    : QHttpConnection(parent, 0, transport, thread)
+{
+}
+
+QHttpConnection::QHttpConnection(QHttpServer *parent, QTcpSocket *socket,
+                                 QHttpTransport *transport, QThread *thread)
 // NOTE this should exist in socket thread, but
 // instantiated in main thread:
     : QObject(0),
       m_socket(socket),
+      m_transport(transport),
       m_parser(0),
       m_parserSettings(0),
       m_request(0),
       m_response(0),
       m_transmitLen(0),
       m_transmitPos(0),
-      m_requestFinished(false)
+      m_drainWatermark(-1),
+      m_requestFinished(false),
+      m_upgradeResponse(0),
+      m_handler(parent->handler()),
+      m_idleTimeout(parent->idleTimeout()),
+      m_headerTimeout(parent->headerTimeout()),
+      m_minBodyRate(parent->minimumBodyRate()),
+      m_maxBodySize(parent->maxBodySize()),
+      m_timeoutState(Idle),
+      m_timeout(this),
+      m_bodyBytes(0),
+      m_bodyBytesChecked(0),
+      m_pendingResponses(0),
+      m_currentResponseDone(true),
+      m_pooling(parent->objectPooling()),
+      m_spareRequest(0),
+      m_spareResponse(0)
 {
-    ASSERT_THREADS_MATCH(thread(), parent->thread());
-    ASSERT_THREADS_DIFFERENT(thread(), socket->thread());
+    ASSERT_THREADS_MATCH(this->thread(), parent->thread());
+    ASSERT_THREADS_DIFFERENT(this->thread(), thread);
 
     // NOTE this should exist in socket thread, but
     // instantiated in main thread:
-    moveToThread(socket->thread());
-    socket->setParent(this);
+    moveToThread(thread);
 
     m_parser = (http_parser *)malloc(sizeof(http_parser));
     http_parser_init(m_parser, HTTP_REQUEST);
@@ -69,22 +108,39 @@ QHttpConnection::QHttpConnection(QHttpServer *parent, QTcpSocket *socket)
 
     m_parser->data = this;
 
-    // NOTE this should exist in socket thread, but
-    // instantiated in main thread:
-    connect(socket, SIGNAL(readyRead()), this, SLOT(parseRequest()), Qt::DirectConnection);
-    connect(socket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()), Qt::DirectConnection);
-    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(updateWriteCount(qint64)), Qt::DirectConnection);
+    if (socket) {
+        socket->setParent(this);
+
+        // NOTE this should exist in socket thread, but
+        // instantiated in main thread:
+        connect(socket, SIGNAL(readyRead()), this, SLOT(parseRequest()), Qt::DirectConnection);
+        connect(socket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()), Qt::DirectConnection);
+        connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(updateWriteCount(qint64)), Qt::DirectConnection);
+    } else {
+        transport->setConnection(this);
+    }
 
-    qDebug() << "QHttpConnection ready : " << s(*socket);
+    // Timers run on the wheel of the socket thread, so arm the first one there.
+    QMetaObject::invokeMethod(this, "start", Qt::QueuedConnection);
 }
 
 QHttpConnection::~QHttpConnection()
 {
-    qDebug() << "QHttpConnection ~ : " << s(*m_socket);
+    if (m_spareRequest) {
+        disconnect(m_spareRequest, 0, this, 0);
+        delete m_spareRequest;
+        m_spareRequest = 0;
+    }
+    delete m_spareResponse;
+    m_spareResponse = 0;
 
-    m_socket->close();
-    delete m_socket;
-    m_socket = 0;
+    if (m_socket) {
+        m_socket->close();
+        delete m_socket;
+        m_socket = 0;
+    }
+    delete m_transport;
+    m_transport = 0;
 
     free(m_parser);
     m_parser = 0;
@@ -95,28 +151,156 @@ QHttpConnection::~QHttpConnection()
 
 void QHttpConnection::socketDisconnected()
 {
-    qDebug() << "QHttpConnection::socketDisconnected   deleteLater : " <<  s(*m_socket);
     deleteLater();
+    m_timeout.stop();
+
+    // Pooled requests belong to the connection. The ones still paired with an
+    // unfinished response are disposed of by QHttpResponse::connectionClosed().
+    QHttpRequest *request = m_request;
+    bool paired = m_response && m_response->m_request == request && !m_response->m_finished;
+
     invalidateRequest();
+
+    if (m_pooling && request && !paired)
+        request->dispose();
 }
 
 void QHttpConnection::invalidateRequest()
 {
     if (m_request && !m_request->successful()) {
-        Q_EMIT m_request->end();
-        Q_EMIT requestFinished(m_request, m_response);
+        if (m_handler) {
+            m_handler->onEnd(m_request, m_response);
+        } else {
+            Q_EMIT m_request->end();
+            Q_EMIT requestFinished(m_request, m_response);
+        }
     }
 
     m_request = NULL;
     m_response = NULL;
 }
 
+void QHttpConnection::requestDestroyed(QObject *request)
+{
+    if (request == m_spareRequest)
+        m_spareRequest = 0;
+    else if (request == m_request)
+        invalidateRequest();
+}
+
+void QHttpConnection::start()
+{
+    if (m_timeoutState == Idle)
+        setTimeoutState(Idle);
+    if (m_transport)
+        m_transport->start();
+}
+
+QString QHttpConnection::description() const
+{
+    if (m_transport)
+        return m_transport->description();
+    if (m_socket)
+        return s(*m_socket);
+    return "<disposed>";
+}
+
+void QHttpConnection::disconnectFromHost()
+{
+    if (m_transport)
+        m_transport->disconnectFromHost();
+    else if (m_socket)
+        m_socket->disconnectFromHost();
+}
+
+void QHttpConnection::setTimeoutState(TimeoutState state)
+{
+    m_timeoutState = state;
+
+    int msec = 0;
+    switch (state) {
+    case Idle:
+        msec = m_idleTimeout;
+        break;
+    case ReadingHeaders:
+        msec = m_headerTimeout;
+        break;
+    case ReadingBody:
+        m_bodyBytesChecked = m_bodyBytes;
+        msec = m_minBodyRate > 0 ? BodyRateWindow : 0;
+        break;
+    case Waiting:
+        break;
+    }
+
+    if (msec > 0)
+        m_timeout.start(msec);
+    else
+        m_timeout.stop();
+}
+
+void QHttpConnection::timeout()
+{
+    switch (m_timeoutState) {
+    case Idle:
+        disconnectFromHost();
+        break;
+    case ReadingHeaders:
+        rejectRequest(408);
+        break;
+    case ReadingBody:
+        if (!m_currentResponseDone && m_response->m_expectContinue && !m_response->m_continueSent) {
+            // The client is waiting for us, not the other way round.
+            m_timeout.start(BodyRateWindow);
+        } else if ((m_bodyBytes - m_bodyBytesChecked) * 1000 >= qint64(m_minBodyRate) * BodyRateWindow) {
+            m_bodyBytesChecked = m_bodyBytes;
+            m_timeout.start(BodyRateWindow);
+        } else {
+            rejectRequest(408);
+        }
+        break;
+    case Waiting:
+        break;
+    }
+}
+
+void QHttpConnection::rejectRequest(int status)
+{
+    // Only answer when nothing else is being written for this connection,
+    // otherwise just close it.
+    bool hasResponse = m_timeoutState == ReadingBody && !m_currentResponseDone;
+    bool canAnswer = hasResponse ? !m_response->m_headerWritten : m_pendingResponses == 0;
+
+    finishRequest();
+    setTimeoutState(Waiting);
+
+    if (canAnswer && hasResponse) {
+        // end() closes the connection because of the Connection header.
+        m_response->setHeader("Connection", "close");
+        m_response->setHeader("Content-Length", "0");
+        m_response->writeHead(status);
+        m_response->end();
+        return;
+    }
+
+    if (canAnswer) {
+        write(QString("HTTP/1.1 %1 %2\r\nConnection: close\r\nContent-Length: 0\r\n\r\n")
+                  .arg(status).arg(STATUS_CODES[status]).toLatin1());
+    }
+    disconnectFromHost();
+}
+
 void QHttpConnection::updateWriteCount(qint64 count)
 {
     Q_ASSERT(m_transmitPos + count <= m_transmitLen);
 
     m_transmitPos += count;
 
+    if (m_drainWatermark >= 0 && m_transmitLen - m_transmitPos <= m_drainWatermark) {
+        m_drainWatermark = -1;
+        Q_EMIT writable();
+    }
+
     if (m_transmitPos == m_transmitLen)
     {
         m_transmitLen = 0;
@@ -131,32 +315,129 @@ void QHttpConnection::parseRequest()
 
     while (!m_requestFinished && m_socket->bytesAvailable()) {
         QByteArray arr = m_socket->readAll();
-        http_parser_execute(m_parser, m_parserSettings, arr.constData(), arr.size());
+        size_t parsed = http_parser_execute(m_parser, m_parserSettings, arr.constData(), arr.size());
+        if (m_parser->upgrade && HTTP_PARSER_ERRNO(m_parser) == HPE_OK) {
+            upgradeRequested(arr.constData() + parsed, arr.size() - parsed);
+            break;
+        }
     }
 }
 
-void QHttpConnection::write(const QByteArray &data, int offset, int len)
+void QHttpConnection::received(const char *data, qint64 length)
 {
-    if (!m_socket) {
-        qWarning() << "Write to QHttpConnection after disposed:" << (void*)thread();
+    Q_ASSERT(m_parser);
+
+    if (m_requestFinished)
         return;
-    }
+    size_t parsed = http_parser_execute(m_parser, m_parserSettings, data, length);
+    if (m_parser->upgrade && HTTP_PARSER_ERRNO(m_parser) == HPE_OK)
+        upgradeRequested(data + parsed, length - parsed);
+}
+
+// Puts back what was read past the upgrade request. The new owner of the
+// socket only reads on readyRead(), so make sure it gets one.
+static void pushBack(QTcpSocket *socket, const QByteArray &data)
+{
+    for (int i = data.size() - 1; i >= 0; --i)
+        socket->ungetChar(data.at(i));
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(socket, "readyRead", Qt::QueuedConnection);
+}
+
+void QHttpConnection::upgradeRequested(const char *data, qint64 length)
+{
+    // Whatever follows is in the new protocol, stop parsing HTTP.
+    finishRequest();
+
+    if (m_upgradedSocket)
+        pushBack(m_upgradedSocket, QByteArray::fromRawData(data, length));
+    else
+        m_upgradeHead.append(data, length);
+}
+
+QWebSocket *QHttpConnection::upgradeToWebSocket(QHttpRequest *request, QHttpResponse *response,
+                                                const QStringList &protocols)
+{
+    ASSERT_THREADS_MATCH(QThread::currentThread(), thread());
+
+    // Native transports have no QTcpSocket to hand over, and responses to
+    // pipelined requests would end up in the WebSocket stream.
+    if (!m_socket || response != m_upgradeResponse || m_pendingResponses != 1)
+        return 0;
+
+    QWebSocketHandshakeRequest handshakeRequest(m_socket->peerPort(), false);
+    handshakeRequest.setHandshake(
+        QString::fromLatin1(http_method_str(static_cast<http_method>(request->method()))),
+        request->url(), request->httpVersion().toFloat(), request->headers());
+    if (!handshakeRequest.isValid())
+        return 0;
+
+    QList<QWebSocketProtocol::Version> versions;
+    versions << QWebSocketProtocol::currentVersion();
+    QWebSocketHandshakeResponse handshakeResponse(handshakeRequest, QStringLiteral("QHttpServer"),
+                                                  true, versions, protocols, QStringList());
+    if (!handshakeResponse.isValid() || !handshakeResponse.canUpgrade())
+        return 0;
+
+    QTextStream httpStream(m_socket);
+    httpStream << handshakeResponse;
+    httpStream.flush();
+
+    // The 101 ends the response.
+    m_upgradeResponse = 0;
+    response->m_headerWritten = true;
+    response->m_finished = true;
+    Q_EMIT response->done();
+    responseDone(response);
+
+    // From here on the socket belongs to the WebSocket, and this connection
+    // goes away without closing it.
+    QTcpSocket *socket = m_socket;
+    finishRequest();
+    disconnect(socket, 0, this, 0);
+    m_socket = 0;
+    setTimeoutState(Waiting);
+
+    QWebSocket *webSocket = QWebSocketPrivate::upgradeFrom(socket, handshakeRequest,
+                                                           handshakeResponse);
+    socket->setParent(webSocket);
+    m_upgradedSocket = socket;
+    pushBack(socket, m_upgradeHead);
+    m_upgradeHead.clear();
+
+    deleteLater();
+    return webSocket;
+}
+
+void QHttpConnection::write(const QByteArray &data, int offset, int len)
+{
     if (len<0) len = data.size()-offset;
-    m_socket->write(data.constData()+offset, len);
-    m_transmitLen += len;
+    write(data.constData(), offset, len);
 }
 void QHttpConnection::write(const char* data, int offset, int len)
 {
-    if (!m_socket) {
+    if (m_transport) {
+        m_transport->write(data+offset, len);
+    } else if (m_socket) {
+        m_socket->write(data+offset, len);
+    } else {
         qWarning() << "Write to QHttpConnection after disposed:" << (void*)thread();
         return;
     }
-    m_socket->write(data+offset, len);
     m_transmitLen += len;
 }
 
+void QHttpConnection::waitForDrain(qint64 lowWatermark)
+{
+    m_drainWatermark = lowWatermark;
+}
+
 void QHttpConnection::flush()
 {
+    if (m_transport) {
+        m_transport->flush();
+        return;
+    }
     if (!m_socket) {
         qWarning() << "Flush QHttpConnection after disposed:" << (void*)thread();
         return;
@@ -166,6 +447,11 @@ void QHttpConnection::flush()
 
 void QHttpConnection::waitForBytesWritten()
 {
+    if (m_transport) {
+        // Native transports never block, send what the socket accepts.
+        m_transport->flush();
+        return;
+    }
     if (!m_socket) {
         qWarning() << "waitForBytesWritten in QHttpConnection after disposed:" << (void*)thread();
         return;
@@ -176,21 +462,97 @@ void QHttpConnection::waitForBytesWritten()
 void QHttpConnection::finishRequest() {
     ASSERT_THREADS_MATCH(QThread::currentThread(), thread());
 
-    disconnect(m_socket, SIGNAL(readyRead()), this, SLOT(parseRequest()));
+    if (m_socket)
+        disconnect(m_socket, SIGNAL(readyRead()), this, SLOT(parseRequest()));
 
     m_requestFinished = true;
 }
 
 
-void QHttpConnection::responseDone()
+QHttpRequest *QHttpConnection::takeRequest()
 {
-    if (!m_socket) {
+    QHttpRequest *request = m_spareRequest;
+    if (request) {
+        m_spareRequest = 0;
+        request->reset();
+        return request;
+    }
+
+    // The QHttpRequest should not be parented to this, since it's memory
+    // management is the responsibility of the user of the library (or of
+    // recycle() when pooling).
+    request = new QHttpRequest(this);
+
+    // Invalidate the request when it is deleted to prevent keep-alive requests
+    // from calling a signal on a deleted object.
+    connect(request, SIGNAL(destroyed(QObject*)), this, SLOT(requestDestroyed(QObject*)));
+    return request;
+}
+
+QHttpResponse *QHttpConnection::takeResponse()
+{
+    QHttpResponse *response = m_spareResponse;
+    if (response) {
+        m_spareResponse = 0;
+        response->reset();
+        return response;
+    }
+
+    response = new QHttpResponse(this);
+    connect(this, SIGNAL(destroyed()), response, SLOT(connectionClosed()));
+    return response;
+}
+
+void QHttpConnection::responseDone(QHttpResponse *response)
+{
+    // After a request to switch protocols the connection cannot be reused.
+    bool last = response->m_last || response == m_upgradeResponse;
+    if (response == m_upgradeResponse)
+        m_upgradeResponse = 0;
+
+    if (response == m_response)
+        m_currentResponseDone = true;
+    if (--m_pendingResponses == 0 && m_timeoutState == Waiting)
+        setTimeoutState(Idle);
+
+    if (!m_pooling) {
+        response->dispose();
+    } else if (!response->m_request || response->m_request->successful()) {
+        // Otherwise MessageComplete() recycles the pair once the request
+        // has been received completely.
+        recycle(response->m_request, response);
+    }
+
+    if (!m_socket && !m_transport) {
         qWarning() << "responseDone in QHttpConnection after disposed:" << (void*)thread();
         return;
     }
-    QHttpResponse *response = qobject_cast<QHttpResponse *>(QObject::sender());
-    if (response->m_last)
-        m_socket->disconnectFromHost();
+    if (last)
+        disconnectFromHost();
+}
+
+void QHttpConnection::recycle(QHttpRequest *request, QHttpResponse *response)
+{
+    if (request)
+        recycleRequest(request);
+
+    if (response == m_response)
+        m_response = 0;
+    response->m_request = 0;
+    if (!m_spareResponse && !response->m_retainCount)
+        m_spareResponse = response;
+    else
+        response->dispose();
+}
+
+void QHttpConnection::recycleRequest(QHttpRequest *request)
+{
+    if (request == m_request)
+        m_request = 0;
+    if (m_pooling && !m_spareRequest && !request->m_retainCount)
+        m_spareRequest = request;
+    else
+        request->dispose();
 }
 
 /* URL Utilities */
@@ -241,13 +603,8 @@ int QHttpConnection::MessageBegin(http_parser *parser)
     theConnection->m_currentUrl.clear();
     theConnection->m_currentUrl.reserve(128);
 
-    // The QHttpRequest should not be parented to this, since it's memory
-    // management is the responsibility of the user of the library.
-    theConnection->m_request = new QHttpRequest(theConnection);
-
-    // Invalidate the request when it is deleted to prevent keep-alive requests
-    // from calling a signal on a deleted object.
-    connect(theConnection->m_request, SIGNAL(destroyed(QObject*)), theConnection, SLOT(invalidateRequest()));
+    theConnection->m_request = theConnection->takeRequest();
+    theConnection->setTimeoutState(ReadingHeaders);
 
     return 0;
 }
@@ -258,7 +615,15 @@ int QHttpConnection::HeadersComplete(http_parser *parser)
     QHttpConnection *theConnection = static_cast<QHttpConnection *>(parser->data);
     Q_ASSERT(theConnection->m_request);
 
-    qDebug() << "QHttpConnection . HeadersComplete ... : " << s(*theConnection->m_socket);
+    // Refuse oversized bodies before the application sees the request.
+    if (theConnection->m_maxBodySize >= 0 && !(parser->flags & F_CHUNKED) &&
+        parser->content_length != ULLONG_MAX &&
+        parser->content_length > quint64(theConnection->m_maxBodySize)) {
+        // The application never saw the request, it goes back to the pool.
+        theConnection->recycleRequest(theConnection->m_request);
+        theConnection->rejectRequest(413);
+        return -1;
+    }
 
     /** set method **/
     theConnection->m_request->setMethod(static_cast<QHttpRequest::HttpMethod>(parser->method));
@@ -276,6 +641,11 @@ int QHttpConnection::HeadersComplete(http_parser *parser)
     Q_UNUSED(r);
 
     theConnection->m_request->setUrl(createUrl(theConnection->m_currentUrl.constData(), urlInfo));
+    if (urlInfo.field_set & (1 << UF_QUERY)) {
+        theConnection->m_request->m_rawQuery = QByteArray(
+            theConnection->m_currentUrl.constData() + urlInfo.field_data[UF_QUERY].off,
+            urlInfo.field_data[UF_QUERY].len);
+    }
 
     // Insert last remaining header
     theConnection->m_currentHeaders[theConnection->m_currentHeaderField.toLower()] =
@@ -283,20 +653,51 @@ int QHttpConnection::HeadersComplete(http_parser *parser)
     theConnection->m_request->setHeaders(theConnection->m_currentHeaders);
 
     /** set client information **/
-    theConnection->m_request->m_remoteAddress = theConnection->m_socket->peerAddress().toString();
-    theConnection->m_request->m_remotePort = theConnection->m_socket->peerPort();
+    if (theConnection->m_transport) {
+        theConnection->m_request->m_remoteAddress = theConnection->m_transport->peerAddress().toString();
+        theConnection->m_request->m_remotePort = theConnection->m_transport->peerPort();
+    } else {
+        theConnection->m_request->m_remoteAddress = theConnection->m_socket->peerAddress().toString();
+        theConnection->m_request->m_remotePort = theConnection->m_socket->peerPort();
+    }
 
-    theConnection->m_response = new QHttpResponse(theConnection);
+    theConnection->m_response = theConnection->takeResponse();
     if (parser->http_major < 1 || parser->http_minor < 1)
         theConnection->m_response->m_keepAlive = false;
+    // See upgradeToWebSocket(), the response closes the connection otherwise.
+    if (parser->upgrade) {
+        theConnection->m_response->m_keepAlive = false;
+        theConnection->m_upgradeResponse = theConnection->m_response;
+    }
+    if (theConnection->m_pooling)
+        theConnection->m_response->m_request = theConnection->m_request;
 
-    connect(theConnection, SIGNAL(destroyed()), theConnection->m_response, SLOT(connectionClosed()));
-    connect(theConnection->m_response, SIGNAL(done()), theConnection, SLOT(responseDone()));
-
-    qDebug() << "QHttpConnection . newRequest ... : " << s(*theConnection->m_socket);
+    ++theConnection->m_pendingResponses;
+    theConnection->m_currentResponseDone = false;
+    theConnection->m_bodyBytes = 0;
+    theConnection->setTimeoutState(ReadingBody);
 
     // we are good to go!
-    Q_EMIT theConnection->newRequest(theConnection->m_request, theConnection->m_response);
+    QHttpRequest *request = theConnection->m_request;
+    QHttpResponse *response = theConnection->m_response;
+    if (request->expectsContinue()) {
+        static const QMetaMethod checkContinueSignal =
+            QMetaMethod::fromSignal(&QHttpConnection::checkContinue);
+
+        response->m_expectContinue = true;
+        if (theConnection->m_handler) {
+            theConnection->m_handler->onCheckContinue(request, response);
+        } else if (theConnection->isSignalConnected(checkContinueSignal)) {
+            Q_EMIT theConnection->checkContinue(request, response);
+        } else {
+            response->writeContinue();
+            Q_EMIT theConnection->newRequest(request, response);
+        }
+    } else if (theConnection->m_handler) {
+        theConnection->m_handler->onRequest(request, response);
+    } else {
+        Q_EMIT theConnection->newRequest(request, response);
+    }
     return 0;
 }
 
@@ -307,8 +708,21 @@ int QHttpConnection::MessageComplete(http_parser *parser)
     Q_ASSERT(theConnection->m_request);
 
     theConnection->m_request->setSuccessful(true);
-    Q_EMIT theConnection->m_request->end();
-    Q_EMIT theConnection->requestFinished(theConnection->m_request, theConnection->m_response);
+    theConnection->setTimeoutState(theConnection->m_pendingResponses ? Waiting : Idle);
+    if (theConnection->m_handler) {
+        theConnection->m_handler->onEnd(theConnection->m_request, theConnection->m_response);
+    } else {
+        Q_EMIT theConnection->m_request->end();
+        Q_EMIT theConnection->requestFinished(theConnection->m_request, theConnection->m_response);
+    }
+
+    // A pooled pair is recycled once both sides are done. If the response is
+    // still being written, responseDone() takes care of it.
+    QHttpRequest *request = theConnection->m_request;
+    QHttpResponse *response = theConnection->m_response;
+    if (theConnection->m_pooling && request && response && response->m_finished &&
+        response->m_request == request)
+        theConnection->recycle(request, response);
     return 0;
 }
 
@@ -381,7 +795,22 @@ int QHttpConnection::Body(http_parser *parser, const char *at, size_t length)
     QHttpConnection *theConnection = static_cast<QHttpConnection *>(parser->data);
     Q_ASSERT(theConnection->m_request);
 
-    Q_EMIT theConnection->m_request->data(QByteArray(at, length));
+    // Bodies without Content-Length can only be checked as they arrive.
+    theConnection->m_bodyBytes += length;
+    if (theConnection->m_maxBodySize >= 0 &&
+        theConnection->m_bodyBytes > theConnection->m_maxBodySize) {
+        theConnection->rejectRequest(413);
+        return -1;
+    }
+
+    QHttpRequest *request = theConnection->m_request;
+    if (request->m_storeBody)
+        request->appendBody(at, length);
+
+    if (theConnection->m_handler)
+        theConnection->m_handler->onBody(request, at, length);
+    else if (request->hasDataReceivers())
+        Q_EMIT request->data(QByteArray(at, length));
     return 0;
 }
 
@@ -25,20 +25,28 @@
 
 #include "qhttpserverapi.h"
 #include "qhttpserverfwd.h"
+#include "qhttptimerwheel.h"
 
 #include <QObject>
+#include <QPointer>
+#include <QStringList>
 
 /// @cond nodoc
 
+class QHttpTransport;
+
 class QHTTPSERVER_API QHttpConnection : public QObject
 {
     friend class QHttpRequest;
     friend class QHttpResponse;
+    friend class QHttpTransport;
 
     Q_OBJECT
 
 public:
     QHttpConnection(QHttpServer *parent, QTcpSocket *socket);
+    /// Connection on a native transport, see QHttpServer::setIoBackend().
+    QHttpConnection(QHttpServer *parent, QHttpTransport *transport, QThread *thread);
     virtual ~QHttpConnection();
 
     void write(const QByteArray &data, int offset=0, int len=-1);
@@ -46,9 +54,18 @@ public:
     void flush();
     void waitForBytesWritten();
 
+    /// Bytes handed to the socket that have not been sent yet.
+    inline qint64 bufferedBytes() const { return m_transmitLen - m_transmitPos; }
+    /// Emit writable() once no more than @c lowWatermark bytes are buffered.
+    void waitForDrain(qint64 lowWatermark);
+
+    /// The socket, or 0 when a native transport is used.
     inline QTcpSocket const *socket() const { return m_socket; }
     inline QTcpSocket *socket() { return m_socket; }
 
+    /// Peer and thread, for debug output.
+    QString description() const;
+
     inline QString header(QString const & key) const {
         return m_currentHeaders[key];
     }
@@ -57,19 +74,63 @@ public:
     }
     void finishRequest();
 
+    /// Switches the connection of @c response to the WebSocket protocol.
+    QWebSocket *upgradeToWebSocket(QHttpRequest *request, QHttpResponse *response,
+                                   const QStringList &protocols);
+
 Q_SIGNALS:
     void newRequest(QHttpRequest *, QHttpResponse *);
     void requestFinished(QHttpRequest *request, QHttpResponse *response);
+    void checkContinue(QHttpRequest *request, QHttpResponse *response);
     void allBytesWritten();
+    void writable();
 
 private Q_SLOTS:
     void parseRequest();
-    void responseDone();
+    void start();
     void socketDisconnected();
     void invalidateRequest();
+    void requestDestroyed(QObject *request);
     void updateWriteCount(qint64);
 
 private:
+    QHttpConnection(QHttpServer *parent, QTcpSocket *socket, QHttpTransport *transport,
+                    QThread *thread);
+
+    void received(const char *data, qint64 length);
+    void upgradeRequested(const char *data, qint64 length);
+    void disconnectFromHost();
+
+    QHttpRequest *takeRequest();
+    QHttpResponse *takeResponse();
+    void responseDone(QHttpResponse *response);
+    void recycle(QHttpRequest *request, QHttpResponse *response);
+    void recycleRequest(QHttpRequest *request);
+
+    // What the connection timer is currently guarding
+    enum TimeoutState {
+        Idle,           // waiting for the next request
+        ReadingHeaders, // header deadline, see QHttpServer::setHeaderTimeout()
+        ReadingBody,    // body rate, see QHttpServer::setMinimumBodyRate()
+        Waiting         // the application is responding, no timeout
+    };
+
+    class Timeout : public QHttpTimer
+    {
+    public:
+        explicit Timeout(QHttpConnection *connection) : m_connection(connection) {}
+
+    protected:
+        void timeout() { m_connection->timeout(); }
+
+    private:
+        QHttpConnection *m_connection;
+    };
+
+    void setTimeoutState(TimeoutState state);
+    void timeout();
+    void rejectRequest(int status);
+
     static int MessageBegin(http_parser *parser);
     static int Protocol(http_parser *parser, const char *at, size_t length);
     static int Url(http_parser *parser, const char *at, size_t length);
@@ -82,6 +143,8 @@ private:
 
 private:
     QTcpSocket *m_socket;
+    // Used instead of m_socket by native backends
+    QHttpTransport *m_transport;
     http_parser *m_parser;
     http_parser_settings *m_parserSettings;
 
@@ -100,8 +163,39 @@ private:
     // Keep track of transmit buffer status
     qint64 m_transmitLen;
     qint64 m_transmitPos;
+    // Low watermark writable() is waiting for, -1 if nobody waits
+    qint64 m_drainWatermark;
 
     bool m_requestFinished;
+
+    // The response to a request with "Connection: upgrade", parsing stops there
+    QHttpResponse *m_upgradeResponse;
+    // Bytes the client sent after that request
+    QByteArray m_upgradeHead;
+    // The socket handed to a QWebSocket by upgradeToWebSocket()
+    QPointer<QTcpSocket> m_upgradedSocket;
+
+    // Called instead of emitting signals when set, see QHttpServer::setHandler()
+    QHttpHandler *m_handler;
+
+    // Timeouts, all in milliseconds or bytes per second, 0 disables
+    int m_idleTimeout;
+    int m_headerTimeout;
+    int m_minBodyRate;
+    // See QHttpServer::setMaxBodySize(), -1 for no limit
+    qint64 m_maxBodySize;
+    TimeoutState m_timeoutState;
+    Timeout m_timeout;
+    qint64 m_bodyBytes;
+    qint64 m_bodyBytesChecked;
+    // Responses not ended yet, and whether m_response is one of them
+    int m_pendingResponses;
+    bool m_currentResponseDone;
+
+    // Object pooling, see QHttpServer::setObjectPooling()
+    bool m_pooling;
+    QHttpRequest *m_spareRequest;
+    QHttpResponse *m_spareResponse;
 };
 
 /// @endcond
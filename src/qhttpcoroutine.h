@@ -0,0 +1,484 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_COROUTINE
+#define Q_HTTP_COROUTINE
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define QHTTPSERVER_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef QHTTPSERVER_HAS_COROUTINES
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+#include "qhttphandler.h"
+#include "qhttprequest.h"
+#include "qhttpresponse.h"
+#include "qhttptimerwheel.h"
+
+#include <QByteArray>
+#include <QObject>
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+
+/// Per-thread free lists for coroutine frames.
+/** Frames are rounded up to multiples of 64 bytes and blocks of up to 4 KiB
+    are kept on a free list of the thread that released them, so that a
+    worker thread running the same handlers over and over stops allocating
+    once its lists are warm. Larger frames go straight to the heap. The
+    lists are bounded and freed when the thread exits. */
+class QHttpFramePool
+{
+public:
+    enum {
+        Granularity = 64,
+        Classes = 64,
+        MaxCached = 256
+    };
+
+    static void *allocate(std::size_t size)
+    {
+        std::size_t index = classOf(size);
+        if (index < Classes) {
+            Lists &l = lists();
+            if (Block *block = l.heads[index]) {
+                l.heads[index] = block->next;
+                --l.counts[index];
+                return block;
+            }
+            return ::operator new((index + 1) * Granularity);
+        }
+        return ::operator new(size);
+    }
+
+    static void deallocate(void *p, std::size_t size)
+    {
+        std::size_t index = classOf(size);
+        if (index < Classes) {
+            Lists &l = lists();
+            if (l.counts[index] < MaxCached) {
+                Block *block = static_cast<Block *>(p);
+                block->next = l.heads[index];
+                l.heads[index] = block;
+                ++l.counts[index];
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    struct Lists
+    {
+        Block *heads[Classes] = {};
+        int counts[Classes] = {};
+
+        ~Lists()
+        {
+            for (int i = 0; i < Classes; ++i) {
+                while (Block *block = heads[i]) {
+                    heads[i] = block->next;
+                    ::operator delete(block);
+                }
+            }
+        }
+    };
+
+    static std::size_t classOf(std::size_t size)
+    {
+        return size ? (size - 1) / Granularity : 0;
+    }
+
+    static Lists &lists()
+    {
+        static thread_local Lists l;
+        return l;
+    }
+};
+
+/// Return type of request handling coroutines.
+/** The coroutine starts running as soon as it is called and frees its frame
+    when it returns; nobody awaits it. Frames come from QHttpFramePool. An
+    exception escaping the coroutine terminates the program, as it would if
+    thrown from a slot. @sa QHttpCoroutineHandler */
+class QHttpTask
+{
+public:
+    struct promise_type
+    {
+        QHttpTask get_return_object() { return QHttpTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void *operator new(std::size_t size)
+        {
+            return QHttpFramePool::allocate(size);
+        }
+
+        static void operator delete(void *p, std::size_t size)
+        {
+            QHttpFramePool::deallocate(p, size);
+        }
+    };
+};
+
+/// @cond nodoc
+
+// Shared between the handler, which feeds it from the parser callbacks, and
+// the QHttpExchange copies held by the coroutine.
+struct QHttpExchangeState
+{
+    enum Wait {
+        None,
+        Body,
+        Writable
+    };
+
+    QHttpRequest *request;
+    QHttpResponse *response;
+    QByteArray pending;
+    bool ended;
+    int refs;
+    Wait wait;
+    std::coroutine_handle<> waiter;
+    QMetaObject::Connection done;
+    QMetaObject::Connection writable;
+
+    static QHttpExchangeState *create(QHttpRequest *request, QHttpResponse *response)
+    {
+        QHttpExchangeState *state =
+            new (QHttpFramePool::allocate(sizeof(QHttpExchangeState))) QHttpExchangeState;
+        state->request = request;
+        state->response = response;
+        state->ended = false;
+        state->refs = 1;
+        state->wait = None;
+        // done() is emitted by end() and when the connection closes; either
+        // way the response must not be used afterwards.
+        state->done = QObject::connect(response, &QHttpResponse::done, [state]() {
+            state->response = 0;
+            state->resume(Writable);
+        });
+        return state;
+    }
+
+    void ref() { ++refs; }
+
+    void deref()
+    {
+        if (--refs)
+            return;
+        QObject::disconnect(done);
+        QObject::disconnect(writable);
+        this->~QHttpExchangeState();
+        QHttpFramePool::deallocate(this, sizeof(QHttpExchangeState));
+    }
+
+    // Resumes the coroutine if it waits for @c what. Must be the last use of
+    // the state by the caller, as the coroutine may drop its reference.
+    void resume(Wait what)
+    {
+        if (wait != what)
+            return;
+        std::coroutine_handle<> handle = waiter;
+        waiter = nullptr;
+        wait = None;
+        handle.resume();
+    }
+};
+
+/// @endcond
+
+/// A request/response pair as seen from a handling coroutine.
+/** Passed to QHttpCoroutineHandler::handle(). Copies share the same state,
+    which lives as long as any copy or the request does, so the coroutine
+    can keep it in its frame across suspension points without tracking the
+    lifetime of the request and response objects by hand.
+
+    A QHttpExchange must only be used from the thread serving the request. */
+class QHttpExchange
+{
+public:
+    explicit QHttpExchange(QHttpExchangeState *state) : m_state(state)
+    {
+        m_state->ref();
+    }
+
+    QHttpExchange(const QHttpExchange &other) : m_state(other.m_state)
+    {
+        m_state->ref();
+    }
+
+    ~QHttpExchange()
+    {
+        m_state->deref();
+    }
+
+    QHttpExchange &operator=(const QHttpExchange &other)
+    {
+        other.m_state->ref();
+        m_state->deref();
+        m_state = other.m_state;
+        return *this;
+    }
+
+    /// The request being handled.
+    /** Valid until the body has been read to the end and the response has
+        ended, the same as for QHttpHandler. */
+    QHttpRequest *request() const
+    {
+        return m_state->request;
+    }
+
+    /// The response, or 0 once it has ended or its connection was closed.
+    QHttpResponse *response() const
+    {
+        return m_state->response;
+    }
+
+    /// Whether the whole request body has been received.
+    bool atEnd() const
+    {
+        return m_state->ended && m_state->pending.isEmpty();
+    }
+
+    /// Awaitable for the next block of request body data.
+    /** Resumes with the data received since the last read, or an empty
+        array once the request has ended. Check QHttpRequest::successful()
+        to tell a complete body from a closed connection. */
+    class BodyAwaiter
+    {
+    public:
+        explicit BodyAwaiter(QHttpExchangeState *state, bool all) : m_state(state), m_all(all) {}
+
+        bool await_ready() const
+        {
+            return m_state->ended || (!m_all && !m_state->pending.isEmpty());
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_state->wait = QHttpExchangeState::Body;
+            m_state->waiter = handle;
+        }
+
+        QByteArray await_resume()
+        {
+            QByteArray data;
+            data.swap(m_state->pending);
+            return data;
+        }
+
+    private:
+        QHttpExchangeState *m_state;
+        bool m_all;
+    };
+
+    /// Awaitable for the response to drain below its high watermark.
+    /** Resumes with true when the response is writable, or false if it has
+        ended or its connection was closed meanwhile.
+        @sa QHttpResponse::isWritable() */
+    class WritableAwaiter
+    {
+    public:
+        explicit WritableAwaiter(QHttpExchangeState *state) : m_state(state) {}
+
+        bool await_ready() const
+        {
+            return !m_state->response || m_state->response->isWritable();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            QHttpExchangeState *state = m_state;
+            state->wait = QHttpExchangeState::Writable;
+            state->waiter = handle;
+            state->writable = QObject::connect(state->response, &QHttpResponse::writable,
+                                               [state]() { state->resume(QHttpExchangeState::Writable); });
+        }
+
+        bool await_resume()
+        {
+            QObject::disconnect(m_state->writable);
+            return m_state->response != 0;
+        }
+
+    private:
+        QHttpExchangeState *m_state;
+    };
+
+    /// Awaitable pause of the coroutine, see sleep().
+    class SleepAwaiter : public QHttpTimer
+    {
+    public:
+        SleepAwaiter(QHttpExchangeState *state, int msec) : m_state(state), m_msec(msec) {}
+
+        bool await_ready() const
+        {
+            return m_msec <= 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            start(m_msec);
+        }
+
+        bool await_resume()
+        {
+            return m_state->response != 0;
+        }
+
+    protected:
+        void timeout() override
+        {
+            m_handle.resume();
+        }
+
+    private:
+        QHttpExchangeState *m_state;
+        int m_msec;
+        std::coroutine_handle<> m_handle;
+    };
+
+    /// Wait for the next block of body data: <tt>co_await exchange.read()</tt>.
+    BodyAwaiter read() const
+    {
+        return BodyAwaiter(m_state, false);
+    }
+
+    /// Wait for the rest of the body: <tt>co_await exchange.readAll()</tt>.
+    /** The body is buffered in memory, see QHttpServer::setMaxBodySize() to
+        bound it. */
+    BodyAwaiter readAll() const
+    {
+        return BodyAwaiter(m_state, true);
+    }
+
+    /// Wait until the response accepts more data: <tt>co_await exchange.writable()</tt>.
+    WritableAwaiter writable() const
+    {
+        return WritableAwaiter(m_state);
+    }
+
+    /// Suspend for about @c msec milliseconds: <tt>co_await exchange.sleep(500)</tt>.
+    /** Runs on the QHttpTimerWheel of the serving thread, so the delay is
+        rounded up to its 100 ms tick. Resumes with false if the response
+        has ended or its connection was closed meanwhile. */
+    SleepAwaiter sleep(int msec) const
+    {
+        return SleepAwaiter(m_state, msec);
+    }
+
+private:
+    QHttpExchangeState *m_state;
+};
+
+/// QHttpHandler running a coroutine per request.
+/** Implement handle() as a coroutine returning QHttpTask. It is started
+    from onRequest() and can co_await request body data, the response
+    becoming writable and timers, all on the thread serving the connection,
+    with no further bookkeeping:
+
+    \code
+    class Echo : public QHttpCoroutineHandler
+    {
+        QHttpTask handle(QHttpExchange exchange) override
+        {
+            exchange.response()->writeHead(200);
+            for (;;) {
+                QByteArray data = co_await exchange.read();
+                if (data.isEmpty() || !exchange.response())
+                    break;
+                exchange.response()->write(data);
+                if (!co_await exchange.writable())
+                    co_return;
+            }
+            if (exchange.response())
+                exchange.response()->end();
+        }
+    };
+    \endcode
+
+    Coroutine frames and the per-request state come from QHttpFramePool and
+    no QObject is created, so with QHttpServer::setObjectPooling() a warm
+    thread serves coroutine handlers without allocating QObjects. The
+    rules of QHttpHandler apply otherwise: without pooling, the request must
+    be deleted by the application once it has ended.
+
+    This header requires a C++20 compiler; the library itself does not. */
+class QHttpCoroutineHandler : public QHttpHandler
+{
+public:
+    /// Handle a request. Called once per request from onRequest().
+    virtual QHttpTask handle(QHttpExchange exchange) = 0;
+
+    void onRequest(QHttpRequest *request, QHttpResponse *response) override
+    {
+        QHttpExchangeState *state = QHttpExchangeState::create(request, response);
+        request->setHandlerData(state);
+        handle(QHttpExchange(state));
+    }
+
+    void onBody(QHttpRequest *request, const char *data, size_t length) override
+    {
+        QHttpExchangeState *state = static_cast<QHttpExchangeState *>(request->handlerData());
+        // Nobody is left to read the data once the coroutine has returned.
+        if (!state || state->refs == 1)
+            return;
+        state->pending.append(data, int(length));
+        state->resume(QHttpExchangeState::Body);
+    }
+
+    void onEnd(QHttpRequest *request, QHttpResponse *response) override
+    {
+        Q_UNUSED(response);
+        QHttpExchangeState *state = static_cast<QHttpExchangeState *>(request->handlerData());
+        if (!state)
+            return;
+        request->setHandlerData(0);
+        state->ended = true;
+        // Keep the state alive past the resumed coroutine, then drop the
+        // reference taken in onRequest().
+        state->ref();
+        state->resume(QHttpExchangeState::Body);
+        state->deref();
+        state->deref();
+    }
+};
+
+#endif
+
+#endif
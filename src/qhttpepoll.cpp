@@ -0,0 +1,311 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttpepoll.h"
+
+#ifdef Q_OS_LINUX
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <QThreadStorage>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+
+/// @cond nodoc
+
+static QThreadStorage<QHttpEpollLoop *> loops;
+
+QHttpEpollLoop *QHttpEpollLoop::instance()
+{
+    if (!loops.hasLocalData())
+        loops.setLocalData(new QHttpEpollLoop());
+    return loops.localData();
+}
+
+QHttpEpollLoop::QHttpEpollLoop()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+      m_wakeUp(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_wakeUpPending(false),
+      m_dispatching(false),
+      m_notifier(0),
+      m_receiveBuffer(ReceiveBufferSize, Qt::Uninitialized)
+{
+    if (m_epoll < 0 || m_wakeUp < 0) {
+        qCritical() << "QHttpEpollLoop: cannot create epoll set:" << strerror(errno);
+        return;
+    }
+
+    // A null data pointer marks the wake-up descriptor.
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = 0;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeUp, &event);
+
+    m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read);
+    QObject::connect(m_notifier, &QSocketNotifier::activated, [this]() { activated(); });
+}
+
+QHttpEpollLoop::~QHttpEpollLoop()
+{
+    delete m_notifier;
+    if (m_wakeUp >= 0)
+        ::close(m_wakeUp);
+    if (m_epoll >= 0)
+        ::close(m_epoll);
+}
+
+bool QHttpEpollLoop::add(QHttpEpollTransport *transport)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = transport;
+    return m_epoll >= 0 && epoll_ctl(m_epoll, EPOLL_CTL_ADD, transport->m_descriptor, &event) == 0;
+}
+
+void QHttpEpollLoop::remove(QHttpEpollTransport *transport)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, transport->m_descriptor, 0);
+
+    // Keep indices stable, flushScheduled() may be iterating.
+    if (transport->m_scheduled) {
+        for (int i = 0; i < m_scheduled.size(); ++i) {
+            if (m_scheduled.at(i) == transport)
+                m_scheduled[i] = 0;
+        }
+        transport->m_scheduled = false;
+    }
+}
+
+void QHttpEpollLoop::schedule(QHttpEpollTransport *transport)
+{
+    if (transport->m_scheduled)
+        return;
+
+    transport->m_scheduled = true;
+    m_scheduled.append(transport);
+    if (!m_dispatching)
+        wakeUp();
+}
+
+void QHttpEpollLoop::wakeUp()
+{
+    if (m_wakeUpPending)
+        return;
+
+    m_wakeUpPending = true;
+    const quint64 one = 1;
+    if (::write(m_wakeUp, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        qWarning() << "QHttpEpollLoop: cannot wake up:" << strerror(errno);
+}
+
+void QHttpEpollLoop::activated()
+{
+    // Handlers running a nested event loop must not reenter the dispatch,
+    // the receive buffer is still being parsed.
+    m_notifier->setEnabled(false);
+    m_dispatching = true;
+
+    struct epoll_event events[MaxEvents];
+    int count;
+    do {
+        count = epoll_wait(m_epoll, events, MaxEvents, 0);
+        for (int i = 0; i < count; ++i) {
+            QHttpEpollTransport *transport = static_cast<QHttpEpollTransport *>(events[i].data.ptr);
+            if (transport) {
+                transport->ready(events[i].events);
+            } else {
+                quint64 value;
+                if (::read(m_wakeUp, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                    qWarning() << "QHttpEpollLoop: cannot read wake-up:" << strerror(errno);
+                m_wakeUpPending = false;
+            }
+        }
+        flushScheduled();
+    } while (count == MaxEvents);
+
+    m_dispatching = false;
+    m_notifier->setEnabled(true);
+}
+
+void QHttpEpollLoop::flushScheduled()
+{
+    // Flushing reports written bytes, which may schedule more writes.
+    for (int i = 0; i < m_scheduled.size(); ++i) {
+        QHttpEpollTransport *transport = m_scheduled.at(i);
+        if (!transport)
+            continue;
+        transport->m_scheduled = false;
+        transport->flush();
+    }
+    m_scheduled.resize(0);
+}
+
+QHttpEpollTransport::QHttpEpollTransport(qintptr descriptor, QTcpClientPeerThread *peerThread)
+    : QHttpTransport(descriptor, peerThread),
+      m_loop(0),
+      m_outputPos(0),
+      m_scheduled(false),
+      m_closing(false)
+{
+    fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+
+    readPeerAddress();
+}
+
+QHttpEpollTransport::~QHttpEpollTransport()
+{
+    close(false);
+}
+
+void QHttpEpollTransport::start()
+{
+    m_loop = QHttpEpollLoop::instance();
+    if (!m_loop->add(this)) {
+        qWarning() << "QHttpEpollTransport: cannot watch socket:" << strerror(errno);
+        close(true);
+    }
+}
+
+void QHttpEpollTransport::write(const char *data, qint64 length)
+{
+    if (m_descriptor < 0 || m_closing || !m_loop)
+        return;
+
+    m_output.append(data, length);
+    m_loop->schedule(this);
+}
+
+void QHttpEpollTransport::flush()
+{
+    if (m_descriptor < 0)
+        return;
+
+    qint64 sent = 0;
+    while (m_outputPos < m_output.size()) {
+        ssize_t n = ::send(m_descriptor, m_output.constData() + m_outputPos,
+                           m_output.size() - m_outputPos, MSG_NOSIGNAL);
+        if (n > 0) {
+            m_outputPos += n;
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // EPOLLOUT resumes once the socket drains.
+            break;
+        } else {
+            close(true);
+            return;
+        }
+    }
+
+    if (m_outputPos == m_output.size()) {
+        m_output.resize(0);
+        m_outputPos = 0;
+    }
+
+    if (sent)
+        written(sent);
+
+    if (m_closing && m_descriptor >= 0 && m_output.isEmpty())
+        close(true);
+}
+
+void QHttpEpollTransport::disconnectFromHost()
+{
+    if (m_descriptor < 0 || m_closing)
+        return;
+
+    m_closing = true;
+    if (m_loop)
+        m_loop->schedule(this);
+    else
+        close(true);
+}
+
+void QHttpEpollTransport::ready(quint32 events)
+{
+    if (m_descriptor < 0)
+        return;
+
+    if (events & EPOLLERR) {
+        close(true);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        readAll(events & (EPOLLRDHUP | EPOLLHUP));
+        if (m_descriptor < 0)
+            return;
+    }
+    if ((events & EPOLLOUT) && m_outputPos < m_output.size())
+        flush();
+}
+
+void QHttpEpollTransport::readAll(bool hungUp)
+{
+    char *buffer = m_loop->receiveBuffer();
+    for (;;) {
+        ssize_t n = ::recv(m_descriptor, buffer, QHttpEpollLoop::ReceiveBufferSize, 0);
+        if (n > 0) {
+            received(buffer, n);
+            // A short read drained the socket, new data raises a new edge.
+            // A FIN raises none, so read on until recv() reports it.
+            if (m_descriptor < 0 || (n < QHttpEpollLoop::ReceiveBufferSize && !hungUp))
+                return;
+        } else if (n == 0) {
+            close(true);
+            return;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                close(true);
+            return;
+        }
+    }
+}
+
+void QHttpEpollTransport::close(bool notify)
+{
+    if (m_descriptor < 0)
+        return;
+
+    if (m_loop)
+        m_loop->remove(this);
+    ::close(m_descriptor);
+    m_descriptor = -1;
+    m_output.clear();
+    m_outputPos = 0;
+    releaseDescriptor();
+
+    if (notify)
+        disconnected();
+}
+
+/// @endcond
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_EPOLL
+#define Q_HTTP_EPOLL
+
+#include "qhttpserverapi.h"
+#include "qhttptransport.h"
+
+#include <QByteArray>
+#include <QVector>
+
+class QSocketNotifier;
+
+/// @cond nodoc
+
+class QHttpEpollTransport;
+
+/// Per-thread edge-triggered epoll set for QHttpEpollTransport sockets.
+/** The epoll descriptor is watched by a single QSocketNotifier, so the
+    thread keeps running its Qt event loop for timers and queued calls while
+    all of its sockets are multiplexed by one epoll_wait(). Data written by
+    transports is collected and sent once the current batch of events has
+    been handled, coalescing the small writes of a response into one send(). */
+class QHTTPSERVER_API QHttpEpollLoop
+{
+public:
+    enum {
+        MaxEvents = 256,
+        ReceiveBufferSize = 64 * 1024
+    };
+
+    /// The loop of the calling thread, created on first use.
+    static QHttpEpollLoop *instance();
+
+    ~QHttpEpollLoop();
+
+    bool add(QHttpEpollTransport *transport);
+    void remove(QHttpEpollTransport *transport);
+
+    /// Flush @c transport after the current batch of events.
+    void schedule(QHttpEpollTransport *transport);
+
+    char *receiveBuffer() { return m_receiveBuffer.data(); }
+
+private:
+    QHttpEpollLoop();
+    Q_DISABLE_COPY(QHttpEpollLoop)
+
+    void activated();
+    void wakeUp();
+    void flushScheduled();
+
+    int m_epoll;
+    // eventfd waking the loop for writes made outside of activated()
+    int m_wakeUp;
+    bool m_wakeUpPending;
+    bool m_dispatching;
+    QSocketNotifier *m_notifier;
+    QVector<QHttpEpollTransport *> m_scheduled;
+    // Shared by all transports of the thread, the parser copies what it keeps
+    QByteArray m_receiveBuffer;
+};
+
+/// Raw, non-blocking socket driven by the thread's QHttpEpollLoop.
+class QHTTPSERVER_API QHttpEpollTransport : public QHttpTransport
+{
+public:
+    QHttpEpollTransport(qintptr descriptor, QTcpClientPeerThread *peerThread);
+    ~QHttpEpollTransport();
+
+    void start();
+    void write(const char *data, qint64 length);
+    void flush();
+    void disconnectFromHost();
+
+private:
+    friend class QHttpEpollLoop;
+
+    void ready(quint32 events);
+    void readAll(bool hungUp);
+    void close(bool notify);
+
+    QHttpEpollLoop *m_loop;
+    QByteArray m_output;
+    int m_outputPos;
+    bool m_scheduled;
+    bool m_closing;
+};
+
+/// @endcond
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttpformdecoder.h"
+
+#include <cstring>
+
+static inline int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes the escape at data[i] into *c and returns its encoded length.
+static inline int decodeAt(const char *data, int i, int length, char *c)
+{
+    if (data[i] == '+') {
+        *c = ' ';
+        return 1;
+    }
+    if (data[i] == '%' && i + 2 < length) {
+        const int high = hexValue(data[i + 1]);
+        const int low = hexValue(data[i + 2]);
+        if (high >= 0 && low >= 0) {
+            *c = static_cast<char>((high << 4) | low);
+            return 3;
+        }
+    }
+    *c = data[i];
+    return 1;
+}
+
+// Compares an encoded key with a decoded one without decoding into a buffer.
+static bool keyMatches(const char *data, int length, const char *key)
+{
+    int i = 0;
+    while (i < length) {
+        char c;
+        i += decodeAt(data, i, length, &c);
+        if (*key == '\0' || *key != c)
+            return false;
+        ++key;
+    }
+    return *key == '\0';
+}
+
+// Returns the end of the field starting at from, and its '=' or -1.
+static inline int fieldEnd(const char *data, int from, int size, int *equals)
+{
+    const char *ampersand = static_cast<const char *>(memchr(data + from, '&', size - from));
+    const int end = ampersand ? ampersand - data : size;
+    const char *separator = static_cast<const char *>(memchr(data + from, '=', end - from));
+    *equals = separator ? separator - data : -1;
+    return end;
+}
+
+QHttpFormDecoder::const_iterator::const_iterator(const QByteArray &data, int position)
+    : m_data(&data), m_position(position), m_next(position)
+{
+    ++*this;
+}
+
+QHttpFormDecoder::const_iterator &QHttpFormDecoder::const_iterator::operator++()
+{
+    const char *data = m_data->constData();
+    const int size = m_data->size();
+
+    int from = m_next;
+    while (from < size) {
+        int equals;
+        const int end = fieldEnd(data, from, size, &equals);
+        if (end > from) {
+            const int keyEnd = equals >= 0 ? equals : end;
+            const int valueStart = equals >= 0 ? equals + 1 : end;
+            m_field.rawKey = QByteArray::fromRawData(data + from, keyEnd - from);
+            m_field.rawValue = QByteArray::fromRawData(data + valueStart, end - valueStart);
+            m_position = from;
+            m_next = end + 1;
+            return *this;
+        }
+        from = end + 1;
+    }
+
+    m_field = Field();
+    m_position = size;
+    m_next = size;
+    return *this;
+}
+
+QHttpFormDecoder::QHttpFormDecoder()
+{
+}
+
+QHttpFormDecoder::QHttpFormDecoder(const QByteArray &data)
+    : m_data(data)
+{
+}
+
+bool QHttpFormDecoder::isEmpty() const
+{
+    return begin() == end();
+}
+
+int QHttpFormDecoder::count() const
+{
+    int fields = 0;
+    for (const_iterator it = begin(), e = end(); it != e; ++it)
+        ++fields;
+    return fields;
+}
+
+bool QHttpFormDecoder::contains(const char *key) const
+{
+    int valueStart, valueEnd;
+    return find(key, 0, &valueStart, &valueEnd) >= 0;
+}
+
+QByteArray QHttpFormDecoder::value(const char *key, const QByteArray &defaultValue) const
+{
+    int valueStart, valueEnd;
+    if (find(key, 0, &valueStart, &valueEnd) < 0)
+        return defaultValue;
+    return decode(m_data.constData() + valueStart, valueEnd - valueStart);
+}
+
+QString QHttpFormDecoder::stringValue(const char *key, const QString &defaultValue) const
+{
+    int valueStart, valueEnd;
+    if (find(key, 0, &valueStart, &valueEnd) < 0)
+        return defaultValue;
+    return QString::fromUtf8(decode(m_data.constData() + valueStart, valueEnd - valueStart));
+}
+
+QByteArray QHttpFormDecoder::rawValue(const char *key) const
+{
+    int valueStart, valueEnd;
+    if (find(key, 0, &valueStart, &valueEnd) < 0)
+        return QByteArray();
+    return view(valueStart, valueEnd);
+}
+
+QList<QByteArray> QHttpFormDecoder::values(const char *key) const
+{
+    QList<QByteArray> result;
+    int valueStart, valueEnd;
+    int from = 0;
+    while ((from = find(key, from, &valueStart, &valueEnd)) >= 0)
+        result.append(decode(m_data.constData() + valueStart, valueEnd - valueStart));
+    return result;
+}
+
+QHttpFormDecoder::const_iterator QHttpFormDecoder::begin() const
+{
+    return const_iterator(m_data, 0);
+}
+
+QHttpFormDecoder::const_iterator QHttpFormDecoder::end() const
+{
+    return const_iterator(m_data, m_data.size());
+}
+
+QByteArray QHttpFormDecoder::decode(const QByteArray &data)
+{
+    return decode(data.constData(), data.size());
+}
+
+QByteArray QHttpFormDecoder::decode(const char *data, int length)
+{
+    // Most values contain nothing to decode, copy those in one go.
+    int i = 0;
+    while (i < length && data[i] != '%' && data[i] != '+')
+        ++i;
+    if (i == length)
+        return QByteArray(data, length);
+
+    QByteArray result(length, Qt::Uninitialized);
+    char *out = result.data();
+    memcpy(out, data, i);
+    out += i;
+    while (i < length)
+        i += decodeAt(data, i, length, out++);
+    result.resize(out - result.constData());
+    return result;
+}
+
+// Finds the first field named key at or after from. Returns the position
+// following it, or -1.
+int QHttpFormDecoder::find(const char *key, int from, int *valueStart, int *valueEnd) const
+{
+    const char *data = m_data.constData();
+    const int size = m_data.size();
+
+    while (from < size) {
+        int equals;
+        const int end = fieldEnd(data, from, size, &equals);
+        const int keyEnd = equals >= 0 ? equals : end;
+        if (end > from && keyMatches(data + from, keyEnd - from, key)) {
+            *valueStart = equals >= 0 ? equals + 1 : end;
+            *valueEnd = end;
+            return end + 1;
+        }
+        from = end + 1;
+    }
+    return -1;
+}
+
+QByteArray QHttpFormDecoder::view(int start, int end) const
+{
+    return QByteArray::fromRawData(m_data.constData() + start, end - start);
+}
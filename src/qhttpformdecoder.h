@@ -0,0 +1,145 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_FORM_DECODER
+#define Q_HTTP_FORM_DECODER
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+/// Decoder for query strings and application/x-www-form-urlencoded bodies.
+/** Unlike QUrlQuery, the decoder does not split the data up front. It keeps
+    a shared reference to the encoded bytes and every lookup is a single
+    scan over them that compares keys while decoding, so no map or per-field
+    strings are built. Values are percent-decoded only when requested.
+
+    @code
+    void MyApp::handle(QHttpRequest *request, QHttpResponse *response)
+    {
+        QHttpFormDecoder query(request->rawQuery());
+        int page = query.value("page", "1").toInt();
+        ...
+    }
+    @endcode
+
+    Fields can also be iterated:
+
+    @code
+    QHttpFormDecoder form(request->body());
+    for (const QHttpFormDecoder::Field &field : form)
+        qDebug() << field.key() << field.value();
+    @endcode */
+class QHTTPSERVER_API QHttpFormDecoder
+{
+public:
+    /// A single key/value pair.
+    /** rawKey and rawValue are still encoded and refer to the decoder's
+        data without copying it. */
+    struct Field
+    {
+        QByteArray rawKey;
+        QByteArray rawValue;
+
+        /// Decoded key.
+        QByteArray key() const { return QHttpFormDecoder::decode(rawKey); }
+        /// Decoded value.
+        QByteArray value() const { return QHttpFormDecoder::decode(rawValue); }
+    };
+
+    /// Forward iterator over the fields, in order of appearance.
+    class QHTTPSERVER_API const_iterator
+    {
+    public:
+        const Field &operator*() const { return m_field; }
+        const Field *operator->() const { return &m_field; }
+        const_iterator &operator++();
+        bool operator==(const const_iterator &other) const { return m_position == other.m_position; }
+        bool operator!=(const const_iterator &other) const { return m_position != other.m_position; }
+
+    private:
+        friend class QHttpFormDecoder;
+        const_iterator(const QByteArray &data, int position);
+
+        const QByteArray *m_data;
+        int m_position;
+        int m_next;
+        Field m_field;
+    };
+
+    /// Construct a decoder for empty data.
+    QHttpFormDecoder();
+
+    /// Construct a decoder for encoded @c data.
+    /** @param data A query string without the leading '?' or a form body.
+        The bytes are shared, not copied. */
+    explicit QHttpFormDecoder(const QByteArray &data);
+
+    /// The encoded data.
+    const QByteArray &data() const { return m_data; }
+
+    /// Whether the data contains no fields.
+    bool isEmpty() const;
+
+    /// Number of fields. Scans the data.
+    int count() const;
+
+    /// Whether a field named @c key is present.
+    /** @param key Decoded key. */
+    bool contains(const char *key) const;
+
+    /// Decoded value of the first field named @c key.
+    /** @param key Decoded key.
+        @param defaultValue Returned when there is no such field. */
+    QByteArray value(const char *key, const QByteArray &defaultValue = QByteArray()) const;
+
+    /// Decoded value of the first field named @c key as UTF-8 text.
+    QString stringValue(const char *key, const QString &defaultValue = QString()) const;
+
+    /// Encoded value of the first field named @c key.
+    /** The result refers to the decoder's data without copying it and is
+        valid as long as the decoder exists. */
+    QByteArray rawValue(const char *key) const;
+
+    /// Decoded values of all fields named @c key, in order of appearance.
+    QList<QByteArray> values(const char *key) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /// Decodes '+' and percent escapes.
+    /** Invalid escapes are kept as they are. The result never refers to
+        @c data, so it may outlive it. */
+    static QByteArray decode(const QByteArray &data);
+
+private:
+    static QByteArray decode(const char *data, int length);
+    int find(const char *key, int from, int *valueStart, int *valueEnd) const;
+    QByteArray view(int start, int end) const;
+
+    QByteArray m_data;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_HANDLER
+#define Q_HTTP_HANDLER
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+#include "qhttpresponse.h"
+
+#include <cstddef>
+
+/// Direct callback interface for handling requests without signals.
+/** A handler installed with QHttpServer::setHandler() is called straight from
+    the HTTP parser callbacks, in place of the QHttpServer::newRequest(),
+    QHttpServer::requestFinished(), QHttpRequest::data() and QHttpRequest::end()
+    signals, which are then not emitted. This avoids the meta-object dispatch
+    of those signals for every request.
+
+    The handler is shared by all connections and is called from the threads
+    serving them, so its implementation must be thread-safe. It is not owned by
+    the server and must outlive it.
+
+    The memory management rules of \ref memorymanagement are unchanged: the
+    response deletes itself after QHttpResponse::end(), the request must be
+    deleted by the handler unless object pooling is enabled.
+    QHttpRequest::storeBody() works as with signals. */
+class QHTTPSERVER_API QHttpHandler
+{
+public:
+    virtual ~QHttpHandler() {}
+
+    /// Called when the headers of a new request have been received.
+    /** Equivalent of QHttpServer::newRequest().
+        @param request New incoming request.
+        @param response Response object to the request. */
+    virtual void onRequest(QHttpRequest *request, QHttpResponse *response) = 0;
+
+    /// Called instead of onRequest() when the client expects 100 Continue.
+    /** The default implementation accepts every request: it sends the
+        interim response and calls onRequest(). Override it to reject uploads
+        before their body is transmitted by responding with a final status.
+        @sa QHttpServer::checkContinue() */
+    virtual void onCheckContinue(QHttpRequest *request, QHttpResponse *response)
+    {
+        response->writeContinue();
+        onRequest(request, response);
+    }
+
+    /// Called for each block of request body data.
+    /** Equivalent of QHttpRequest::data(). @c data points into the receive
+        buffer and is only valid during the call.
+        @param request Request the data belongs to.
+        @param data Body data.
+        @param length Number of bytes at @c data. */
+    virtual void onBody(QHttpRequest *request, const char *data, size_t length)
+    {
+        Q_UNUSED(request);
+        Q_UNUSED(data);
+        Q_UNUSED(length);
+    }
+
+    /// Called once the request has ended.
+    /** Equivalent of QHttpRequest::end() followed by
+        QHttpServer::requestFinished(). Also called when the connection
+        closes before the request was received completely, in which case
+        QHttpRequest::successful() returns false.
+        @param request Request that has ended.
+        @param response Response object to the request. */
+    virtual void onEnd(QHttpRequest *request, QHttpResponse *response)
+    {
+        Q_UNUSED(request);
+        Q_UNUSED(response);
+    }
+};
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttpmultipartparser.h"
+
+#include <QStringList>
+
+#include <cstring>
+
+#include "qhttprequest.h"
+
+// Part headers are buffered until complete, so cap them like http_parser does
+static const int MaxPartHeaderSize = 8 * 1024;
+
+QHttpMultipartParser::QHttpMultipartParser(const QByteArray &boundary, QObject *parent)
+    : QObject(parent)
+{
+    init(boundary);
+}
+
+QHttpMultipartParser::QHttpMultipartParser(QHttpRequest *request, QObject *parent)
+    : QObject(parent)
+{
+    init(boundaryFromContentType(request->header("content-type")));
+
+    connect(request, SIGNAL(data(const QByteArray &)), this, SLOT(feed(const QByteArray &)));
+    connect(request, SIGNAL(end()), this, SLOT(finish()));
+}
+
+void QHttpMultipartParser::init(const QByteArray &boundary)
+{
+    m_state = Preamble;
+    m_delimiter = "\r\n--" + boundary;
+
+    // Horspool bad character table: distance from the last occurrence of a
+    // byte to the end of the delimiter.
+    const int length = m_delimiter.size();
+    for (int i = 0; i < 256; ++i)
+        m_skip[i] = length;
+    for (int i = 0; i < length - 1; ++i)
+        m_skip[static_cast<uchar>(m_delimiter[i])] = length - 1 - i;
+
+    // The first boundary may start the body without a preceding line break,
+    // so pretend one was received. Reserving keeps the tail's storage
+    // across resize(0).
+    m_tail.reserve(2 * length);
+    m_tail.append("\r\n");
+
+    if (boundary.isEmpty())
+        m_state = Failed;
+}
+
+bool QHttpMultipartParser::isValid() const
+{
+    return m_delimiter.size() > 4;
+}
+
+QByteArray QHttpMultipartParser::boundaryFromContentType(const QString &contentType)
+{
+    const QStringList parameters = contentType.split(QLatin1Char(';'));
+    if (!parameters.first().trimmed().startsWith(QLatin1String("multipart/"), Qt::CaseInsensitive))
+        return QByteArray();
+
+    for (int i = 1; i < parameters.size(); ++i) {
+        const QString parameter = parameters.at(i).trimmed();
+        if (!parameter.startsWith(QLatin1String("boundary="), Qt::CaseInsensitive))
+            continue;
+
+        QString boundary = parameter.mid(9);
+        if (boundary.size() >= 2 && boundary.startsWith(QLatin1Char('"'))
+            && boundary.endsWith(QLatin1Char('"')))
+            boundary = boundary.mid(1, boundary.size() - 2);
+        return boundary.toLatin1();
+    }
+    return QByteArray();
+}
+
+void QHttpMultipartParser::feed(const QByteArray &data)
+{
+    feed(data.constData(), data.size());
+}
+
+void QHttpMultipartParser::finish()
+{
+    if (!isValid())
+        fail(QLatin1String("Missing multipart boundary"));
+    else if (m_state != Done && m_state != Failed)
+        fail(QLatin1String("Unexpected end of multipart body"));
+}
+
+void QHttpMultipartParser::feed(const char *data, int length)
+{
+    while (length > 0) {
+        int consumed;
+        switch (m_state) {
+        case Preamble:
+        case Body:
+            consumed = parseDelimited(data, length);
+            break;
+        case AfterBoundary:
+            consumed = parseAfterBoundary(data, length);
+            break;
+        case Headers:
+            consumed = parseHeaders(data, length);
+            break;
+        default:
+            // The epilogue after the closing boundary is ignored
+            return;
+        }
+        data += consumed;
+        length -= consumed;
+    }
+}
+
+int QHttpMultipartParser::parseDelimited(const char *data, int length)
+{
+    const int delimiterLength = m_delimiter.size();
+
+    if (!m_tail.isEmpty()) {
+        // The previous chunk ended with a possible delimiter prefix. Search
+        // it together with enough new bytes to complete any delimiter that
+        // starts inside it.
+        const int tailLength = m_tail.size();
+        const int count = qMin(length, delimiterLength - 1);
+        m_tail.append(data, count);
+
+        const int index = search(m_tail.constData(), m_tail.size());
+        if (index >= 0) {
+            emitData(m_tail.constData(), index);
+            m_tail.resize(0);
+            if (m_state == Body)
+                Q_EMIT partEnd();
+            m_state = AfterBoundary;
+            return index + delimiterLength - tailLength;
+        }
+
+        if (count < delimiterLength - 1) {
+            // Not enough data yet to rule out a delimiter, keep the last
+            // bytes and wait for the next chunk.
+            const int keep = qMin(m_tail.size(), delimiterLength - 1);
+            emitData(m_tail.constData(), m_tail.size() - keep);
+            m_tail.remove(0, m_tail.size() - keep);
+            return count;
+        }
+
+        // No delimiter starts in the old tail, the new bytes are searched
+        // below as part of the chunk.
+        emitData(m_tail.constData(), tailLength);
+        m_tail.resize(0);
+    }
+
+    const int index = search(data, length);
+    if (index >= 0) {
+        emitData(data, index);
+        if (m_state == Body)
+            Q_EMIT partEnd();
+        m_state = AfterBoundary;
+        return index + delimiterLength;
+    }
+
+    const int keep = qMin(length, delimiterLength - 1);
+    emitData(data, length - keep);
+    m_tail.append(data + length - keep, keep);
+    return length;
+}
+
+int QHttpMultipartParser::parseAfterBoundary(const char *data, int length)
+{
+    // A boundary is followed either by "--" closing the body or by optional
+    // whitespace and a line break starting the next part.
+    for (int i = 0; i < length; ++i) {
+        m_line.append(data[i]);
+
+        if (m_line == "--") {
+            m_line.resize(0);
+            m_state = Done;
+            Q_EMIT finished();
+            return length;
+        }
+
+        if (m_line.endsWith("\r\n")) {
+            if (!m_line.left(m_line.size() - 2).trimmed().isEmpty()) {
+                fail(QLatin1String("Invalid data after multipart boundary"));
+                return length;
+            }
+            m_line.resize(0);
+            m_state = Headers;
+            return i + 1;
+        }
+
+        if (m_line.size() > 2 && !m_line.startsWith(' ') && !m_line.startsWith('\t')) {
+            fail(QLatin1String("Invalid data after multipart boundary"));
+            return length;
+        }
+        if (m_line.size() > 256) {
+            fail(QLatin1String("Invalid data after multipart boundary"));
+            return length;
+        }
+    }
+    return length;
+}
+
+int QHttpMultipartParser::parseHeaders(const char *data, int length)
+{
+    const int oldLength = m_header.size();
+    const int count = qMin(length, MaxPartHeaderSize - oldLength);
+    m_header.append(data, count);
+
+    int end;
+    int markerLength;
+    if (m_header.startsWith("\r\n")) {
+        // A part without headers
+        end = 0;
+        markerLength = 2;
+    } else {
+        end = m_header.indexOf("\r\n\r\n", qMax(0, oldLength - 3));
+        markerLength = 4;
+    }
+
+    if (end < 0) {
+        if (m_header.size() >= MaxPartHeaderSize) {
+            fail(QLatin1String("Multipart part headers too large"));
+            return length;
+        }
+        return count;
+    }
+
+    HeaderHash headers;
+    QString lastName;
+    const QList<QByteArray> lines = m_header.left(end).split('\n');
+    for (int i = 0; i < lines.size(); ++i) {
+        QByteArray line = lines.at(i);
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (line.isEmpty())
+            continue;
+
+        if ((line.startsWith(' ') || line.startsWith('\t')) && !lastName.isEmpty()) {
+            // Obsolete line folding
+            headers[lastName] += QLatin1Char(' ') + QString::fromUtf8(line.trimmed());
+            continue;
+        }
+
+        const int colon = line.indexOf(':');
+        if (colon <= 0) {
+            fail(QLatin1String("Invalid multipart part header"));
+            return length;
+        }
+
+        lastName = QString::fromLatin1(line.left(colon).trimmed()).toLower();
+        const QString value = QString::fromUtf8(line.mid(colon + 1).trimmed());
+        if (headers.contains(lastName))
+            headers[lastName] += QLatin1String(", ") + value;
+        else
+            headers.insert(lastName, value);
+    }
+
+    m_header.resize(0);
+    m_state = Body;
+    Q_EMIT partBegin(headers);
+    return end + markerLength - oldLength;
+}
+
+int QHttpMultipartParser::search(const char *data, int length) const
+{
+    const int delimiterLength = m_delimiter.size();
+    const char *delimiter = m_delimiter.constData();
+    const char last = delimiter[delimiterLength - 1];
+
+    int i = 0;
+    while (i <= length - delimiterLength) {
+        const char c = data[i + delimiterLength - 1];
+        if (c == last && memcmp(data + i, delimiter, delimiterLength - 1) == 0)
+            return i;
+        i += m_skip[static_cast<uchar>(c)];
+    }
+    return -1;
+}
+
+void QHttpMultipartParser::emitData(const char *data, int length)
+{
+    if (m_state == Body && length > 0)
+        Q_EMIT partData(QByteArray(data, length));
+}
+
+void QHttpMultipartParser::fail(const QString &message)
+{
+    m_state = Failed;
+    m_tail.resize(0);
+    m_line.resize(0);
+    m_header.resize(0);
+    Q_EMIT error(message);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_MULTIPART_PARSER
+#define Q_HTTP_MULTIPART_PARSER
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+
+#include <QObject>
+#include <QByteArray>
+
+/// Incremental parser for multipart/form-data request bodies.
+/** Body data can be fed in chunks of any size as it arrives. The parser
+    emits partBegin() with the headers of each part, partData() zero or
+    more times with its content and partEnd() when the part is complete,
+    so uploads can be streamed to disk without ever holding the full body
+    in memory. Boundaries are located with a Boyer-Moore-Horspool search
+    and at most one boundary length of data is buffered between chunks.
+
+    @code
+    void Upload::handle(QHttpRequest *request, QHttpResponse *response)
+    {
+        QHttpMultipartParser *parser = new QHttpMultipartParser(request, this);
+        connect(parser, SIGNAL(partBegin(HeaderHash)), this, SLOT(openFile(HeaderHash)));
+        connect(parser, SIGNAL(partData(QByteArray)), this, SLOT(writeFile(QByteArray)));
+        connect(parser, SIGNAL(partEnd()), this, SLOT(closeFile()));
+        ...
+    }
+    @endcode */
+class QHTTPSERVER_API QHttpMultipartParser : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Construct a parser for parts separated by @c boundary.
+    /** @param boundary The boundary parameter of the Content-Type header.
+        @param parent Parent QObject for the parser. */
+    QHttpMultipartParser(const QByteArray &boundary, QObject *parent = 0);
+
+    /// Construct a parser reading the body of @c request.
+    /** Takes the boundary from the request's Content-Type header and
+        connects to its data() and end() signals. If the request is not a
+        multipart request, isValid() returns false and error() is emitted
+        when the request ends.
+        @param request Request whose body is parsed.
+        @param parent Parent QObject for the parser. */
+    QHttpMultipartParser(QHttpRequest *request, QObject *parent = 0);
+
+    /// Whether a boundary is known, i.e. parts can be found at all.
+    bool isValid() const;
+
+    /// Extracts the boundary parameter from a Content-Type header value.
+    /** @return The boundary, or an empty array if @c contentType is not
+        multipart or has no boundary. */
+    static QByteArray boundaryFromContentType(const QString &contentType);
+
+    /// Parse the next chunk of body data from a raw buffer.
+    /** For use from QHttpHandler::onBody(), where body data is not
+        wrapped in a QByteArray. */
+    void feed(const char *data, int length);
+
+public Q_SLOTS:
+    /// Parse the next chunk of body data.
+    void feed(const QByteArray &data);
+
+    /// Signal the end of the body.
+    /** Emits error() if the closing boundary has not been seen. */
+    void finish();
+
+Q_SIGNALS:
+    /// Emitted when the headers of a new part have been parsed.
+    /** @param headers Part headers, names are <b>lowercase</b>. */
+    void partBegin(const HeaderHash &headers);
+
+    /// Emitted for each block of content of the current part.
+    void partData(const QByteArray &data);
+
+    /// Emitted when the current part is complete.
+    void partEnd();
+
+    /// Emitted after the closing boundary.
+    void finished();
+
+    /// Emitted when the body is malformed. Nothing is emitted afterwards.
+    void error(const QString &message);
+
+private:
+    enum State {
+        Preamble,
+        AfterBoundary,
+        Headers,
+        Body,
+        Done,
+        Failed
+    };
+
+    void init(const QByteArray &boundary);
+    int parseDelimited(const char *data, int length);
+    int parseAfterBoundary(const char *data, int length);
+    int parseHeaders(const char *data, int length);
+    int search(const char *data, int length) const;
+    void emitData(const char *data, int length);
+    void fail(const QString &message);
+
+    State m_state;
+    // "\r\n--" followed by the boundary
+    QByteArray m_delimiter;
+    int m_skip[256];
+    // Bytes at the end of the last chunk that may start a delimiter
+    QByteArray m_tail;
+    QByteArray m_line;
+    QByteArray m_header;
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttpoffload.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QObject>
+#include <QPointer>
+#include <QThread>
+#include <QThreadStorage>
+
+#include <deque>
+#include <thread>
+
+#include "qhttpresponse.h"
+
+/// @cond nodoc
+
+// Failed steals a worker retries before it blocks on the other queues.
+static const int MaxStealAttempts = 16;
+
+struct QHttpOffloadRoute
+{
+    QHttpOffloadRoute() : limit(-1), running(0) {}
+
+    int limit;
+    int running;
+    std::deque<QHttpOffloadJob *> waiting;
+};
+
+class QHttpOffloadSink;
+
+struct QHttpOffloadJob
+{
+    QHttpOffloadPool::Job work;
+    QHttpOffloadResult result;
+    QHttpOffloadRoute *route;
+    QHttpOffloadSink *sink;
+    QPointer<QHttpResponse> response;
+    QMetaObject::Connection done;
+    std::atomic<bool> cancelled;
+    QHttpOffloadJob *next;
+};
+
+// Receives finished jobs for the thread it lives in. Workers push onto a
+// lock-free stack; the push that finds it empty posts an event, and the
+// event handler takes the whole stack at once.
+class QHttpOffloadSink : public QObject
+{
+public:
+    QHttpOffloadSink() : m_head(0) {}
+
+    static QHttpOffloadSink *current()
+    {
+        static QThreadStorage<QHttpOffloadSink *> sinks;
+        if (!sinks.hasLocalData())
+            sinks.setLocalData(new QHttpOffloadSink);
+        return sinks.localData();
+    }
+
+    void push(QHttpOffloadJob *job)
+    {
+        QHttpOffloadJob *head = m_head.load(std::memory_order_relaxed);
+        do {
+            job->next = head;
+        } while (!m_head.compare_exchange_weak(head, job, std::memory_order_release,
+                                               std::memory_order_relaxed));
+        if (!head)
+            QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+    }
+
+protected:
+    void customEvent(QEvent *)
+    {
+        QHttpOffloadJob *job = m_head.exchange(0, std::memory_order_acquire);
+
+        // Restore submission order.
+        QHttpOffloadJob *ordered = 0;
+        while (job) {
+            QHttpOffloadJob *next = job->next;
+            job->next = ordered;
+            ordered = job;
+            job = next;
+        }
+
+        while (ordered) {
+            QHttpOffloadJob *next = ordered->next;
+            complete(ordered);
+            ordered = next;
+        }
+    }
+
+private:
+    static void complete(QHttpOffloadJob *job)
+    {
+        QObject::disconnect(job->done);
+
+        QHttpResponse *response = job->response;
+        if (response && !job->cancelled.load(std::memory_order_relaxed)) {
+            const QHttpOffloadResult &result = job->result;
+            for (HeaderHash::const_iterator it = result.headers.constBegin();
+                 it != result.headers.constEnd(); ++it)
+                response->setHeader(it.key(), it.value());
+            response->writeHead(result.status);
+            response->end(result.body);
+        }
+        delete job;
+    }
+
+    std::atomic<QHttpOffloadJob *> m_head;
+};
+
+class QHttpOffloadWorker : public QThread
+{
+public:
+    QHttpOffloadWorker(QHttpOffloadPool *pool, int index) : m_pool(pool), m_index(index) {}
+
+    std::mutex mutex;
+    std::deque<QHttpOffloadJob *> queue;
+
+protected:
+    void run()
+    {
+        while (QHttpOffloadJob *job = m_pool->wait(m_index)) {
+            if (!job->cancelled.load(std::memory_order_relaxed))
+                job->result = job->work();
+            job->work = QHttpOffloadPool::Job();
+
+            // Let the next job of the route start before handing this one
+            // back, the response no longer depends on this thread.
+            m_pool->finished(job);
+            job->sink->push(job);
+        }
+    }
+
+private:
+    QHttpOffloadPool *m_pool;
+    int m_index;
+};
+
+/// @endcond
+
+QHttpOffloadPool::QHttpOffloadPool(int threads)
+    : m_next(0), m_queued(0), m_stopping(false)
+{
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount());
+
+    for (int i = 0; i < threads; ++i)
+        m_workers.append(new QHttpOffloadWorker(this, i));
+    for (int i = 0; i < threads; ++i)
+        m_workers.at(i)->start();
+}
+
+QHttpOffloadPool::~QHttpOffloadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_all();
+
+    // Workers steal from each other until the last one has stopped.
+    for (int i = 0; i < m_workers.size(); ++i)
+        m_workers.at(i)->wait();
+    qDeleteAll(m_workers);
+    qDeleteAll(m_routes);
+}
+
+int QHttpOffloadPool::threadCount() const
+{
+    return m_workers.size();
+}
+
+void QHttpOffloadPool::setRouteLimit(const QByteArray &name, int maxConcurrent)
+{
+    std::deque<QHttpOffloadJob *> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_routesMutex);
+        QHttpOffloadRoute *r = route(name);
+        r->limit = maxConcurrent;
+        while (!r->waiting.empty() && (r->limit < 0 || r->running < r->limit)) {
+            ready.push_back(r->waiting.front());
+            r->waiting.pop_front();
+            ++r->running;
+        }
+    }
+    for (size_t i = 0; i < ready.size(); ++i)
+        dispatch(ready[i]);
+}
+
+int QHttpOffloadPool::routeLimit(const QByteArray &name)
+{
+    std::lock_guard<std::mutex> lock(m_routesMutex);
+    return route(name)->limit;
+}
+
+void QHttpOffloadPool::submit(QHttpResponse *response, const QByteArray &name, const Job &job)
+{
+    QHttpOffloadJob *j = new QHttpOffloadJob;
+    j->work = job;
+    j->sink = QHttpOffloadSink::current();
+    j->response = response;
+    j->cancelled.store(false, std::memory_order_relaxed);
+    j->next = 0;
+    // done() before the result is written means the connection was closed.
+    j->done = QObject::connect(response, &QHttpResponse::done, [j]() {
+        j->cancelled.store(true, std::memory_order_relaxed);
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(m_routesMutex);
+        QHttpOffloadRoute *r = route(name);
+        j->route = r;
+        if (r->limit >= 0 && r->running >= r->limit) {
+            r->waiting.push_back(j);
+            return;
+        }
+        ++r->running;
+    }
+    dispatch(j);
+}
+
+// Called with m_routesMutex held.
+QHttpOffloadRoute *QHttpOffloadPool::route(const QByteArray &name)
+{
+    QHttpOffloadRoute *&r = m_routes[name];
+    if (!r)
+        r = new QHttpOffloadRoute;
+    return r;
+}
+
+void QHttpOffloadPool::dispatch(QHttpOffloadJob *job)
+{
+    QHttpOffloadWorker *worker = m_workers.at(m_next++ % unsigned(m_workers.size()));
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->queue.push_back(job);
+    }
+
+    // Counted under the sleep mutex so that a worker about to sleep cannot
+    // miss the wakeup.
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    ++m_queued;
+    m_wakeup.notify_one();
+}
+
+QHttpOffloadJob *QHttpOffloadPool::take(int self, bool block)
+{
+    // Own queue first, oldest job first.
+    QHttpOffloadWorker *own = m_workers.at(self);
+    {
+        std::lock_guard<std::mutex> lock(own->mutex);
+        if (!own->queue.empty()) {
+            QHttpOffloadJob *job = own->queue.front();
+            own->queue.pop_front();
+            --m_queued;
+            return job;
+        }
+    }
+
+    // Then steal the newest job of another worker, skipping busy queues
+    // unless asked to block.
+    for (int i = 1; i < m_workers.size(); ++i) {
+        QHttpOffloadWorker *victim = m_workers.at((self + i) % m_workers.size());
+        std::unique_lock<std::mutex> lock(victim->mutex, std::defer_lock);
+        if (block)
+            lock.lock();
+        else
+            lock.try_lock();
+        if (lock.owns_lock() && !victim->queue.empty()) {
+            QHttpOffloadJob *job = victim->queue.back();
+            victim->queue.pop_back();
+            --m_queued;
+            return job;
+        }
+    }
+    return 0;
+}
+
+QHttpOffloadJob *QHttpOffloadPool::wait(int self)
+{
+    int misses = 0;
+    for (;;) {
+        if (QHttpOffloadJob *job = take(self, misses >= MaxStealAttempts))
+            return job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            if (m_queued.load() == 0) {
+                if (m_stopping)
+                    return 0;
+                m_wakeup.wait(lock);
+                misses = 0;
+                continue;
+            }
+        }
+        // A job is queued but its worker held the lock. Give it the CPU
+        // rather than spin, and block on the locks once that keeps failing.
+        ++misses;
+        std::this_thread::yield();
+    }
+}
+
+void QHttpOffloadPool::finished(QHttpOffloadJob *job)
+{
+    QHttpOffloadJob *next = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_routesMutex);
+        QHttpOffloadRoute *r = job->route;
+        if (!r->waiting.empty() && (r->limit < 0 || r->running <= r->limit)) {
+            next = r->waiting.front();
+            r->waiting.pop_front();
+        } else {
+            --r->running;
+        }
+    }
+    if (next)
+        dispatch(next);
+}
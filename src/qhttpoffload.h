@@ -0,0 +1,126 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_OFFLOAD
+#define Q_HTTP_OFFLOAD
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+/// Response produced by a job running on a QHttpOffloadPool.
+struct QHTTPSERVER_API QHttpOffloadResult
+{
+    QHttpOffloadResult() : status(200) {}
+
+    /// Status code passed to QHttpResponse::writeHead().
+    int status;
+    /// Headers set on the response before it is written.
+    HeaderHash headers;
+    /// Response body, sent with QHttpResponse::end().
+    QByteArray body;
+};
+
+/// @cond nodoc
+class QHttpOffloadWorker;
+struct QHttpOffloadJob;
+struct QHttpOffloadRoute;
+/// @endcond
+
+/// Work-stealing thread pool for CPU-heavy handlers.
+/** Handlers run on the thread that owns the connection, so an expensive one
+    stalls every other connection served by that thread. Such handlers can
+    instead submit() their work to a pool: the job runs on one of the pool's
+    threads and its QHttpOffloadResult is handed back to the thread that
+    submitted it through a lock-free queue, where it is written to the
+    response. The connection's thread stays free for I/O meanwhile.
+
+    Each worker has its own queue, submitted jobs are spread over them and
+    idle workers steal from busy ones. Jobs are grouped by a route name, and
+    the number of jobs of a route running at once can be capped with
+    setRouteLimit() so that one slow endpoint cannot occupy the whole pool;
+    jobs above the cap wait in submission order.
+
+    A job must not touch the request or response: copy what it needs from the
+    request when submitting. If the connection closes before a job has
+    started, the job is skipped; if it closes while the job runs, the result
+    is dropped.
+
+    submit() must be called from a thread running an event loop, such as the
+    connection threads of QHttpServer, and the pool must be destroyed before
+    those threads finish. The destructor waits for all submitted jobs. */
+class QHTTPSERVER_API QHttpOffloadPool
+{
+public:
+    typedef std::function<QHttpOffloadResult()> Job;
+
+    /// Start a pool of @c threads threads, or QThread::idealThreadCount() if 0.
+    explicit QHttpOffloadPool(int threads = 0);
+    ~QHttpOffloadPool();
+
+    int threadCount() const;
+
+    /// Cap the number of jobs of @c route running at once.
+    /** @param route Route name given to submit().
+        @param maxConcurrent Limit, or -1 (the default) for no limit. */
+    void setRouteLimit(const QByteArray &route, int maxConcurrent);
+    int routeLimit(const QByteArray &route);
+
+    /// Run @c job on the pool and answer @c response with its result.
+    /** Must be called from the thread owning the response.
+        @param response Response to write the result to.
+        @param route Route the job counts against, see setRouteLimit().
+        @param job Function computing the response. */
+    void submit(QHttpResponse *response, const QByteArray &route, const Job &job);
+
+private:
+    friend class QHttpOffloadWorker;
+
+    Q_DISABLE_COPY(QHttpOffloadPool)
+
+    QHttpOffloadRoute *route(const QByteArray &name);
+    void dispatch(QHttpOffloadJob *job);
+    QHttpOffloadJob *take(int self, bool block);
+    QHttpOffloadJob *wait(int self);
+    void finished(QHttpOffloadJob *job);
+
+    QVector<QHttpOffloadWorker *> m_workers;
+    std::atomic<unsigned> m_next;
+    std::atomic<int> m_queued;
+
+    std::mutex m_routesMutex;
+    QHash<QByteArray, QHttpOffloadRoute *> m_routes;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeup;
+    bool m_stopping;
+};
+
+#endif
@@ -22,10 +22,16 @@
 
 #include "qhttprequest.h"
 
+#include <QBuffer>
+#include <QDebug>
+#include <QTemporaryFile>
+
 #include "qhttpconnection.h"
 
 QHttpRequest::QHttpRequest(QHttpConnection *connection, QObject *parent)
-    : QObject(parent), m_connection(connection), m_url("http://localhost/"), m_success(false)
+    : QObject(parent), m_connection(connection), m_url("http://localhost/"),
+      m_storeBody(false), m_bodyMemoryLimit(-1), m_bodyFile(0), m_bodyBuffer(0), m_success(false),
+      m_retainCount(0), m_detached(false), m_handlerData(0)
 {
 }
 
@@ -53,6 +59,11 @@ const QUrl &QHttpRequest::url() const
     return m_url;
 }
 
+const QByteArray &QHttpRequest::rawQuery() const
+{
+    return m_rawQuery;
+}
+
 const QString QHttpRequest::path() const
 {
     return m_url.path();
@@ -68,6 +79,12 @@ QHttpRequest::HttpMethod QHttpRequest::method() const
     return m_method;
 }
 
+bool QHttpRequest::expectsContinue() const
+{
+    return m_version == "1.1" &&
+           m_headers.value("expect").compare("100-continue", Qt::CaseInsensitive) == 0;
+}
+
 const QString &QHttpRequest::remoteAddress() const
 {
     return m_remoteAddress;
@@ -78,10 +95,32 @@ quint16 QHttpRequest::remotePort() const
     return m_remotePort;
 }
 
-void QHttpRequest::storeBody()
+void QHttpRequest::storeBody(qint64 memoryLimit)
 {
-    connect(this, SIGNAL(data(const QByteArray &)), this, SLOT(appendBody(const QByteArray &)),
-            Qt::UniqueConnection);
+    // The connection appends body data directly, see appendBody().
+    m_storeBody = true;
+    m_bodyMemoryLimit = memoryLimit;
+}
+
+QIODevice *QHttpRequest::bodyDevice()
+{
+    if (m_bodyFile) {
+        m_bodyFile->flush();
+        m_bodyFile->seek(0);
+        return m_bodyFile;
+    }
+
+    if (!m_bodyBuffer)
+        m_bodyBuffer = new QBuffer(&m_body, this);
+    if (!m_bodyBuffer->isOpen())
+        m_bodyBuffer->open(QIODevice::ReadOnly);
+    m_bodyBuffer->seek(0);
+    return m_bodyBuffer;
+}
+
+qint64 QHttpRequest::bodySize() const
+{
+    return m_bodyFile ? m_bodyFile->size() : m_body.size();
 }
 
 QString QHttpRequest::MethodToString(HttpMethod method)
@@ -90,7 +129,72 @@ QString QHttpRequest::MethodToString(HttpMethod method)
     return staticMetaObject.enumerator(index).valueToKey(method);
 }
 
-void QHttpRequest::appendBody(const QByteArray &body)
+void QHttpRequest::retain()
+{
+    ++m_retainCount;
+}
+
+void QHttpRequest::release()
+{
+    Q_ASSERT(m_retainCount > 0);
+    if (--m_retainCount == 0 && m_detached)
+        deleteLater();
+}
+
+void QHttpRequest::reset()
+{
+    // Drop the receivers of the previous request.
+    disconnect(this, SIGNAL(data(const QByteArray &)), 0, 0);
+    disconnect(this, SIGNAL(end()), 0, 0);
+
+    m_headers.clear();
+    m_url.clear();
+    m_rawQuery.clear();
+    m_version.clear();
+    m_remoteAddress.clear();
+    m_remotePort = 0;
+    m_body.clear();
+    m_storeBody = false;
+    m_bodyMemoryLimit = -1;
+    delete m_bodyFile;
+    m_bodyFile = 0;
+    if (m_bodyBuffer)
+        m_bodyBuffer->close();
+    m_success = false;
+    m_handlerData = 0;
+}
+
+void QHttpRequest::dispose()
+{
+    if (m_retainCount)
+        m_detached = true;
+    else
+        deleteLater();
+}
+
+void QHttpRequest::appendBody(const char *data, qint64 length)
+{
+    if (!m_bodyFile && m_bodyMemoryLimit >= 0 && m_body.size() + length > m_bodyMemoryLimit) {
+        m_bodyFile = new QTemporaryFile(this);
+        if (m_bodyFile->open()) {
+            m_bodyFile->write(m_body);
+            m_body.clear();
+        } else {
+            qWarning() << "QHttpRequest: Cannot create temporary file for body, keeping it in memory";
+            delete m_bodyFile;
+            m_bodyFile = 0;
+            m_bodyMemoryLimit = -1;
+        }
+    }
+
+    if (m_bodyFile)
+        m_bodyFile->write(data, length);
+    else
+        m_body.append(data, length);
+}
+
+bool QHttpRequest::hasDataReceivers() const
 {
-    m_body.append(body);
+    static const QMetaMethod dataSignal = QMetaMethod::fromSignal(&QHttpRequest::data);
+    return isSignalConnected(dataSignal);
 }
@@ -31,6 +31,10 @@
 #include <QMetaType>
 #include <QUrl>
 
+class QBuffer;
+class QIODevice;
+class QTemporaryFile;
+
 /// The QHttpRequest class represents the header and body data sent by the client.
 /** The requests header data is available immediately. Body data is streamed as
     it comes in via the data() signal. As a consequence the application's request
@@ -55,6 +59,7 @@ class QHTTPSERVER_API QHttpRequest : public QObject
 
     /// @cond nodoc
     friend class QHttpConnection;
+    friend class QHttpResponse;
     /// @endcond
 
 public:
@@ -112,6 +117,12 @@ public:
         @sa path() */
     const QUrl &url() const;
 
+    /// The query string of the URL as sent by the client.
+    /** Still percent-encoded and without the leading '?'. Decode it with
+        QHttpFormDecoder to avoid the parsing done by QUrlQuery.
+        @sa url() */
+    const QByteArray &rawQuery() const;
+
     /// The path portion of the query URL.
     /** @sa url() */
     const QString path() const;
@@ -134,6 +145,11 @@ public:
         @return Value of the header or empty string if not found. */
     QString header(const QString &field);
 
+    /// Whether the client sent <tt>Expect: 100-continue</tt>.
+    /** Such clients wait for an interim 100 Continue response before they
+        send the body. @sa QHttpServer::checkContinue() */
+    bool expectsContinue() const;
+
     /// IP Address of the client in dotted decimal format.
     const QString &remoteAddress() const;
 
@@ -141,12 +157,24 @@ public:
     quint16 remotePort() const;
 
     /// Request body data, empty for non POST/PUT requests.
-    /** @sa storeBody() */
+    /** Empty as well when the body has been spilled to a temporary file,
+        use bodyDevice() to read bodies of any size.
+        @sa storeBody() */
     const QByteArray &body() const
     {
         return m_body;
     }
 
+    /// The stored request body as a device positioned at its start.
+    /** Reads from memory or, if it grew beyond the limit given to
+        storeBody(), from a temporary file. The device is owned by the
+        request and the file is removed when the request is deleted.
+        @sa storeBody() */
+    QIODevice *bodyDevice();
+
+    /// Size of the stored request body in bytes.
+    qint64 bodySize() const;
+
     /// If this request was successfully received.
     /** Set before end() has been emitted, stating whether
         the message was properly received. This is false
@@ -160,12 +188,48 @@ public:
     /** If you call this when the request is received via QHttpServer::newRequest()
         the request will take care of storing the body data for you.
         Once the end() signal is emitted you can access the body data with
-        the body() function.
+        the body() or bodyDevice() functions.
+
+        The body is kept in memory until it exceeds @c memoryLimit bytes, at
+        which point it is moved to a QTemporaryFile and further data is
+        appended there. The total size can be capped for all requests with
+        QHttpServer::setMaxBodySize().
 
         If you wish to handle incoming data yourself don't call this function
         and see the data() signal.
-        @sa data() body() */
-    void storeBody();
+        @param memoryLimit Bytes to keep in memory, -1 for no limit.
+        @sa data() body() bodyDevice() */
+    void storeBody(qint64 memoryLimit = -1);
+
+    /// Keep this request alive beyond the end of its exchange.
+    /** With object pooling (QHttpServer::setObjectPooling()) the connection
+        reuses the request for the next request on the same connection once
+        this one has been received and its response has ended. Call retain()
+        to hold on to it longer and balance it with release().
+        Without pooling the application deletes requests itself and these
+        calls have no effect.
+        @sa release() */
+    void retain();
+
+    /// Drop a reference taken with retain().
+    /** The request is deleted (with deleteLater()) by the last release()
+        if the server is already done with it. */
+    void release();
+
+    /// Per-request pointer owned by the QHttpHandler serving the request.
+    /** Lets a handler find its own state from the request in onBody() and
+        onEnd() without a lookup table. The server does not interpret it; it
+        is cleared when a pooled request is reused. @sa QHttpCoroutineHandler */
+    void *handlerData() const
+    {
+        return m_handlerData;
+    }
+
+    /// Set the pointer returned by handlerData().
+    void setHandlerData(void *data)
+    {
+        m_handlerData = data;
+    }
 
 Q_SIGNALS:
     /// Emitted when new body data has been received.
@@ -178,9 +242,6 @@ Q_SIGNALS:
     /** @note The no more data() signals will be emitted after this. */
     void end();
 
-private Q_SLOTS:
-    void appendBody(const QByteArray &body);
-
 private:
     QHttpRequest(QHttpConnection *connection, QObject *parent = 0);
 
@@ -192,15 +253,28 @@ private:
     void setHeaders(const HeaderHash headers) { m_headers = headers; }
     void setSuccessful(bool success) { m_success = success; }
 
+    void reset();
+    void dispose();
+    void appendBody(const char *data, qint64 length);
+    bool hasDataReceivers() const;
+
     QHttpConnection *m_connection;
     HeaderHash m_headers;
     HttpMethod m_method;
     QUrl m_url;
+    QByteArray m_rawQuery;
     QString m_version;
     QString m_remoteAddress;
     quint16 m_remotePort;
     QByteArray m_body;
+    bool m_storeBody;
+    qint64 m_bodyMemoryLimit;
+    QTemporaryFile *m_bodyFile;
+    QBuffer *m_bodyBuffer;
     bool m_success;
+    int m_retainCount;
+    bool m_detached;
+    void *m_handlerData;
 };
 
 #endif
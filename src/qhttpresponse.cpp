@@ -27,6 +27,7 @@
 
 #include "qhttpserver.h"
 #include "qhttpconnection.h"
+#include "qhttprequest.h"
 
 template <typename N>
 inline N min_inl(N a, N b) {
@@ -37,6 +38,7 @@ QHttpResponse::QHttpResponse(QHttpConnection *connection)
     // TODO: parent child relation
     : QObject(0),
       m_connection(connection),
+      m_request(0),
       m_headerWritten(false),
       m_sentConnectionHeader(false),
       m_sentContentLengthHeader(false),
@@ -45,9 +47,16 @@ QHttpResponse::QHttpResponse(QHttpConnection *connection)
       m_keepAlive(true),
       m_last(false),
       m_useChunkedEncoding(false),
-      m_finished(false)
+      m_finished(false),
+      m_expectContinue(false),
+      m_continueSent(false),
+      m_highWatermark(64 * 1024),
+      m_lowWatermark(16 * 1024),
+      m_retainCount(0),
+      m_detached(false)
 {
    connect(m_connection, SIGNAL(allBytesWritten()), this, SIGNAL(allBytesWritten()));
+   connect(m_connection, SIGNAL(writable()), this, SLOT(connectionWritable()));
 }
 
 QHttpResponse::~QHttpResponse()
@@ -138,9 +147,15 @@ void QHttpResponse::writeHead(int status)
         return;
     }
 
+    // The client may still be about to send the body we never asked for.
+    if (m_expectContinue && !m_continueSent)
+        m_keepAlive = false;
+
     m_connection->write(
         QString("HTTP/1.1 %1 %2\r\n").arg(status).arg(STATUS_CODES[status]).toLatin1());
     writeHeaders();
+    if (m_expectContinue && !m_continueSent)
+        m_last = true;
     m_connection->write("\r\n");
 
     m_headerWritten = true;
@@ -151,11 +166,24 @@ void QHttpResponse::writeHead(StatusCode statusCode)
     writeHead(static_cast<int>(statusCode));
 }
 
-void QHttpResponse::write(const QByteArray &data, int offset, int len)
+void QHttpResponse::writeContinue()
+{
+    if (m_finished || m_headerWritten) {
+        qWarning() << "QHttpResponse::writeContinue() Must be called before writeHead().";
+        return;
+    }
+    if (m_continueSent)
+        return;
+
+    m_connection->write("HTTP/1.1 100 Continue\r\n\r\n");
+    m_continueSent = true;
+}
+
+qint64 QHttpResponse::write(const QByteArray &data, int offset, int len)
 {
     if (m_finished) {
         qWarning() << "QHttpResponse::write() Cannot write body after response has finished.";
-        return;
+        return -1;
     }
 
     QString sr = m_connection->specRequest();
@@ -166,18 +194,23 @@ void QHttpResponse::write(const QByteArray &data, int offset, int len)
     } else {
         if (!m_headerWritten) {
             qWarning() << "QHttpResponse::write() You must call writeHead() before writing body data.";
-            return;
+            return -1;
         }
     }
 
     m_connection->write(data, offset, len);
+
+    qint64 buffered = m_connection->bufferedBytes();
+    if (buffered >= m_highWatermark)
+        waitForDrain();
+    return buffered;
 }
 
-void QHttpResponse::write(const char* data, int offset, int len)
+qint64 QHttpResponse::write(const char* data, int offset, int len)
 {
     if (m_finished) {
         qWarning() << "QHttpResponse::write() Cannot write body after response has finished.";
-        return;
+        return -1;
     }
 
     QString sr = m_connection->specRequest();
@@ -188,11 +221,45 @@ void QHttpResponse::write(const char* data, int offset, int len)
     } else {
         if (!m_headerWritten) {
             qWarning() << "QHttpResponse::write() You must call writeHead() before writing body data.";
-            return;
+            return -1;
         }
     }
 
     m_connection->write(data, offset, len);
+
+    qint64 buffered = m_connection->bufferedBytes();
+    if (buffered >= m_highWatermark)
+        waitForDrain();
+    return buffered;
+}
+
+qint64 QHttpResponse::bufferedBytes() const
+{
+    return m_connection->bufferedBytes();
+}
+
+void QHttpResponse::setWatermarks(qint64 high, qint64 low)
+{
+    m_highWatermark = high;
+    m_lowWatermark = qMin(low, high);
+    if (!m_finished && m_connection->bufferedBytes() >= m_highWatermark)
+        waitForDrain();
+}
+
+bool QHttpResponse::isWritable() const
+{
+    return m_connection->bufferedBytes() < m_highWatermark;
+}
+
+void QHttpResponse::waitForDrain()
+{
+    m_connection->waitForDrain(m_lowWatermark);
+}
+
+void QHttpResponse::connectionWritable()
+{
+    if (!m_finished)
+        Q_EMIT writable();
 }
 
 void QHttpResponse::flush()
@@ -225,16 +292,75 @@ void QHttpResponse::end(const QByteArray &data, bool last)
 
     Q_EMIT done();
 
-    qDebug() << "QHttpResponse::end   deleteLater : #" <<  (void*)m_connection->thread();
-    /// @todo End connection and delete ourselves. Is this a still valid note?
-    deleteLater();
+    // Closes the connection if this was the last response and deletes or
+    // recycles this object.
+    m_connection->responseDone(this);
+}
+
+QWebSocket *QHttpResponse::upgradeToWebSocket(QHttpRequest *request, const QStringList &protocols)
+{
+    if (m_finished || m_headerWritten) {
+        qWarning() << "QHttpResponse::upgradeToWebSocket() Must be called before writeHead().";
+        return 0;
+    }
+    return m_connection->upgradeToWebSocket(request, this, protocols);
+}
+
+void QHttpResponse::retain()
+{
+    ++m_retainCount;
+}
+
+void QHttpResponse::release()
+{
+    Q_ASSERT(m_retainCount > 0);
+    if (--m_retainCount == 0 && m_detached)
+        deleteLater();
+}
+
+void QHttpResponse::reset()
+{
+    // Drop the receivers of the previous response.
+    disconnect(this, SIGNAL(done()), 0, 0);
+    disconnect(this, SIGNAL(allBytesWritten()), 0, 0);
+    disconnect(this, SIGNAL(writable()), 0, 0);
+
+    m_request = 0;
+    m_headers.clear();
+    m_headerWritten = false;
+    m_sentConnectionHeader = false;
+    m_sentContentLengthHeader = false;
+    m_sentTransferEncodingHeader = false;
+    m_sentDate = false;
+    m_keepAlive = true;
+    m_last = false;
+    m_useChunkedEncoding = false;
+    m_finished = false;
+    m_expectContinue = false;
+    m_continueSent = false;
+    m_highWatermark = 64 * 1024;
+    m_lowWatermark = 16 * 1024;
+}
+
+void QHttpResponse::dispose()
+{
+    if (m_retainCount)
+        m_detached = true;
+    else
+        deleteLater();
 }
 
 void QHttpResponse::connectionClosed()
 {
     qDebug() << "QHttpResponse::connectionClosed   deleteLater : #" <<  (void*)m_connection->thread();
 
+    bool wasFinished = m_finished;
     m_finished = true;
     Q_EMIT done();
-    deleteLater();
+
+    // A pooled request still waiting for this response has no owner left.
+    if (m_request && !wasFinished)
+        m_request->dispose();
+    m_request = 0;
+    dispose();
 }
@@ -27,6 +27,7 @@
 #include "qhttpserverfwd.h"
 
 #include <QObject>
+#include <QStringList>
 
 /// The QHttpResponse class handles sending data back to the client as a response to a request.
 /** The steps to respond correctly are
@@ -109,10 +110,26 @@ public Q_SLOTS:
     /** @overload */
     void writeHead(StatusCode statusCode);
 
+    /// Sends the interim <tt>100 Continue</tt> response.
+    /** Tells a client that sent <tt>Expect: 100-continue</tt> to go ahead
+        with the request body. Must be called before writeHead(). If the
+        response is ended without it, the client may or may not send the
+        body, so the connection is closed afterwards.
+        @sa QHttpServer::checkContinue() */
+    void writeContinue();
+
     /// Writes a block of @c data to the client.
-    /** @note writeHead() must be called before this function. */
-    void write(const QByteArray &data, int offset=0, int len=-1);
-    void write(const char * data, int offset, int len);
+    /** The data is queued in the connection's write buffer and this never
+        blocks. Producers of large bodies should stop writing once the
+        returned value reaches the high watermark, i.e. isWritable() returns
+        false, and resume on writable().
+        @note writeHead() must be called before this function.
+        @return Bytes buffered for the connection after this write, or -1 if
+        nothing was written. Returned since 0.2.0, which breaks binary
+        compatibility with 0.1.
+        @sa setWatermarks() */
+    qint64 write(const QByteArray &data, int offset=0, int len=-1);
+    qint64 write(const char * data, int offset, int len);
 
     /// Flushes the written data to the client.
     /** @note writeHead() must be called before this function. */
@@ -130,10 +147,30 @@ public Q_SLOTS:
         this is the last response.
 
         This will emit done() and queue this object
-        for deletion. For details see \ref memorymanagement.
+        for deletion, or return it to the connection's pool
+        when object pooling is enabled. For details see
+        \ref memorymanagement.
         @param data Optional data to be written before finishing. */
     void end(const QByteArray &data = "", bool last = false);
 
+    /// Accepts a WebSocket handshake and switches the connection to WebSockets.
+    /** Writes the <tt>101 Switching Protocols</tt> response and hands the
+        socket to a new QWebSocket, which lives on the thread serving the
+        connection and belongs to the caller. Any data the client sent after
+        the request is passed on to it. The response is finished afterwards
+        as if end() had been called.
+
+        Nothing is written and 0 is returned if @c request is not a valid
+        WebSocket handshake, if writeHead() has been called, if responses to
+        earlier pipelined requests have not ended yet, or with a native I/O
+        backend (QHttpServer::setIoBackend()). The response can still be used
+        to reject the request then, and the connection is closed after it.
+        @param request The request this is the response to.
+        @param protocols Subprotocols to choose from, in order of preference.
+        @return The WebSocket, or 0 if the connection was not upgraded. */
+    QWebSocket *upgradeToWebSocket(QHttpRequest *request,
+                                   const QStringList &protocols = QStringList());
+
     inline QHttpConnection const * connection() const {
         return m_connection;
     }
@@ -141,6 +178,35 @@ public Q_SLOTS:
         return m_connection;
     }
 
+    /// Bytes written to the connection that the socket has not sent yet.
+    qint64 bufferedBytes() const;
+
+    /// Sets the write buffer limits used by isWritable() and writable().
+    /** Once @c high or more bytes are buffered the response is no longer
+        writable, and writable() is emitted as soon as the buffer has drained
+        to @c low bytes or less. The defaults are 64 KiB and 16 KiB.
+        @param high High watermark in bytes.
+        @param low Low watermark in bytes, at most @c high. */
+    void setWatermarks(qint64 high, qint64 low);
+
+    /// Whether less than the high watermark is buffered.
+    /** If not, the write() or setWatermarks() that found the buffer full
+        has already arranged for writable() to be emitted once it has
+        drained.
+        @sa setWatermarks() */
+    bool isWritable() const;
+
+    /// Keep this response alive after it has ended.
+    /** Prevents end() from deleting the response or returning it to the
+        connection's pool. Balance it with release().
+        @sa QHttpRequest::retain() */
+    void retain();
+
+    /// Drop a reference taken with retain().
+    /** The response is deleted (with deleteLater()) by the last release()
+        if it has already ended. */
+    void release();
+
 Q_SIGNALS:
     /// Emitted when all the data has been sent
     /** This signal indicates that the underlaying socket has transmitted all
@@ -149,10 +215,18 @@ Q_SIGNALS:
         receiving this signal. */
     void allBytesWritten();
 
+    /// Emitted when the write buffer has drained to the low watermark.
+    /** Only emitted after write() or setWatermarks() found the buffer at or
+        above the high watermark. The buffer belongs to the connection, so
+        all unfinished responses of a connection are notified.
+        @sa setWatermarks() */
+    void writable();
+
     /// Emitted when the response is finished.
     /** You should <b>not</b> interact with this object
         after done() has been emitted as the object
-        has already been scheduled for deletion. */
+        has already been scheduled for deletion or, with
+        object pooling, will be reused for the next request. */
     void done();
 
 private:
@@ -161,7 +235,13 @@ private:
     void writeHeaders();
     void writeHeader(const char *field, const QString &value);
 
+    void reset();
+    void dispose();
+    void waitForDrain();
+
     QHttpConnection *m_connection;
+    // The request answered by this response, only tracked with pooling
+    QHttpRequest *m_request;
 
     HeaderHash m_headers;
 
@@ -174,9 +254,16 @@ private:
     bool m_last;
     bool m_useChunkedEncoding;
     bool m_finished;
+    bool m_expectContinue;
+    bool m_continueSent;
+    qint64 m_highWatermark;
+    qint64 m_lowWatermark;
+    int m_retainCount;
+    bool m_detached;
 
 private Q_SLOTS:
     void connectionClosed();
+    void connectionWritable();
 };
 
 #endif
@@ -27,14 +27,29 @@
 #include <QVariant>
 #include <QDebug>
 #include <QEventLoop>
+#include <QMetaMethod>
 
 #include "qhttpconnection.h"
+#include "qhttpepoll.h"
+#include "qhttpuring.h"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
 
 template <typename N>
 inline N max_inl(N n1, N n2) {
     return (n1 < n2) ? n2 : n1;
 }
 
+static void closeNativeSocket(qintptr socketDescriptor) {
+#ifdef Q_OS_UNIX
+    ::close(socketDescriptor);
+#else
+    Q_UNUSED(socketDescriptor);
+#endif
+}
+
 
 
 /// Construct a new multithreaded TCP Server.
@@ -42,7 +57,8 @@ inline N max_inl(N n1, N n2) {
 QMtTcpServer::QMtTcpServer(QObject *parent, int maxThreads, int maxConnsPerThread, int maxPendingConnections) :
     QTcpServer(parent),
     m_maxThreads(maxThreads), m_maxConnsPerThread(maxConnsPerThread),
-    m_prefThreads(max_inl(1,maxThreads/maxConnsPerThread))
+    m_prefThreads(max_inl(1,maxThreads/maxConnsPerThread)),
+    m_nativeSockets(false)
 {
 
     setMaxPendingConnections(maxPendingConnections);
@@ -57,45 +73,68 @@ void QMtTcpServer::incomingConnection(qintptr socketDescriptor) {
     // trivial
     //ASSERT_THREADS_MATCH(QThread::currentThread(), thread());
 
+    if (m_nativeSockets) {
+        int sz = pendingSockets.size();
+        if (maxPendingConnections()<=sz) {
+            qWarning()<<"Too many pending connections (#"<<sz<<"/"<<maxPendingConnections()<<") : "<<socketDescriptor;
+            acceptError(QAbstractSocket::ConnectionRefusedError);
+            closeNativeSocket(socketDescriptor);
+            return;
+        }
+
+        auto thread = acquireThread(socketDescriptor);
+        if (!thread) {
+            closeNativeSocket(socketDescriptor);
+            return;
+        }
+        pendingSockets.push_back(new PendingSocket(thread, socketDescriptor));
+        return;
+    }
+
     auto socket = createClientSocketPeer(socketDescriptor);
 
     if (socket) {
+        auto thread = acquireThread(socketDescriptor);
+        if (!thread) {
+            socket->abort();
+            return;
+        }
+        thread->add(socket);
+        socket->setParent(0);
+        socket->moveToThread(thread);
+        pendingSockets.push_back(new PendingSocket(thread,socket));
+    }
+}
 
+QTcpClientPeerThread * QMtTcpServer::acquireThread(qintptr socketDescriptor) {
 
-        int a = activeThreads.size();
-
-        if (a <= m_prefThreads) {
+    int a = activeThreads.size();
 
+    if (a <= m_prefThreads) {
 
-        } else {
 
-            for (auto thread : activeThreads) {
-                if (thread->add(socket)) {
-                    socket->setParent(0);
-                    socket->moveToThread(thread);
-                    pendingSockets.push_back(new PendingSocket(thread, socket));
-                    return;
-                }
-            }
+    } else {
 
-            if (m_maxThreads <= a) {
-                qWarning()<<"Too many active threads, all are full (#"<<a<<"/"<<m_maxThreads<<") : "<<socketDescriptor;
-                acceptError(QAbstractSocket::ConnectionRefusedError);
-                socket->abort();
-                return;
+        for (auto thread : activeThreads) {
+            if (thread->reserve()) {
+                return thread;
             }
-
         }
 
-        auto thread = new QTcpClientPeerThread(this, m_maxConnsPerThread);
-        thread->add(socket);
-        socket->setParent(0);
-        socket->moveToThread(thread);
-        activeThreads.push_back(thread);
-        pendingSockets.push_back(new PendingSocket(thread,socket));
+        if (m_maxThreads <= a) {
+            qWarning()<<"Too many active threads, all are full (#"<<a<<"/"<<m_maxThreads<<") : "<<socketDescriptor;
+            acceptError(QAbstractSocket::ConnectionRefusedError);
+            return 0;
+        }
 
-        thread->start();
     }
+
+    auto thread = new QTcpClientPeerThread(this, m_maxConnsPerThread);
+    thread->reserve();
+    activeThreads.push_back(thread);
+
+    thread->start();
+    return thread;
 }
 
 QTcpSocketL * QMtTcpServer::createClientSocketPeer(qintptr socketDescriptor) {
@@ -136,7 +175,7 @@ bool QMtTcpServer::hasPendingConnections() {
 QTcpSocket * QMtTcpServer::nextPendingConnection() {
     ASSERT_THREADS_MATCH(QThread::currentThread(), thread());
 
-    if (pendingSockets.size()) {
+    if (pendingSockets.size() && pendingSockets.first()->socket) {
         auto e1 = pendingSockets.first();
         pendingSockets.pop_front();
         auto r = e1->socket;
@@ -147,13 +186,30 @@ QTcpSocket * QMtTcpServer::nextPendingConnection() {
     }
 }
 
+qintptr QMtTcpServer::nextPendingDescriptor(QTcpClientPeerThread **thread) {
+    ASSERT_THREADS_MATCH(QThread::currentThread(), this->thread());
+
+    if (pendingSockets.size() && !pendingSockets.first()->socket) {
+        auto e1 = pendingSockets.first();
+        pendingSockets.pop_front();
+        auto r = e1->descriptor;
+        *thread = e1->thread;
+        delete e1;
+        return r;
+    } else {
+        return -1;
+    }
+}
+
 
 
 QHash<int, QString> STATUS_CODES;
 
 QHttpServer::QHttpServer(QObject *parent, bool startInNewThread, int maxThreads, int maxConnsPerThread, int maxPendingConnections) :
     QObject(parent), m_serverThread(0), m_tcpServer(0), m_maxThreads(maxThreads), m_maxConnsPerThread(maxConnsPerThread),
-    m_maxPendingConnections(maxPendingConnections)
+    m_maxPendingConnections(maxPendingConnections), m_ioBackend(QtBackend), m_objectPooling(false), m_handler(0),
+    m_idleTimeout(0), m_headerTimeout(0), m_minimumBodyRate(0),
+    m_maxBodySize(-1)
 {
     if (startInNewThread) {
         if (parent) {
@@ -261,6 +317,101 @@ void QHttpServer::close()
         m_tcpServer->close();
 }
 
+void QHttpServer::setIoBackend(IoBackend backend)
+{
+    if (m_tcpServer) {
+        qWarning() << "QHttpServer: I/O backend must be set before listen()";
+        return;
+    }
+    if (!isIoBackendSupported(backend)) {
+        qWarning() << "QHttpServer: I/O backend not supported on this system, keeping the current one :" << backend;
+        return;
+    }
+    m_ioBackend = backend;
+}
+
+QHttpServer::IoBackend QHttpServer::ioBackend() const
+{
+    return m_ioBackend;
+}
+
+bool QHttpServer::isIoBackendSupported(IoBackend backend)
+{
+    switch (backend) {
+    case QtBackend:
+        return true;
+    case EpollBackend:
+#ifdef Q_OS_LINUX
+        return true;
+#else
+        return false;
+#endif
+    case IoUringBackend:
+        return QHttpUringLoop::isSupported();
+    }
+    return false;
+}
+
+void QHttpServer::setObjectPooling(bool enable)
+{
+    m_objectPooling = enable;
+}
+
+bool QHttpServer::objectPooling() const
+{
+    return m_objectPooling;
+}
+
+void QHttpServer::setHandler(QHttpHandler *handler)
+{
+    m_handler = handler;
+}
+
+QHttpHandler *QHttpServer::handler() const
+{
+    return m_handler;
+}
+
+void QHttpServer::setIdleTimeout(int msec)
+{
+    m_idleTimeout = msec;
+}
+
+int QHttpServer::idleTimeout() const
+{
+    return m_idleTimeout;
+}
+
+void QHttpServer::setHeaderTimeout(int msec)
+{
+    m_headerTimeout = msec;
+}
+
+int QHttpServer::headerTimeout() const
+{
+    return m_headerTimeout;
+}
+
+void QHttpServer::setMinimumBodyRate(int bytesPerSecond)
+{
+    m_minimumBodyRate = bytesPerSecond;
+}
+
+int QHttpServer::minimumBodyRate() const
+{
+    return m_minimumBodyRate;
+}
+
+void QHttpServer::setMaxBodySize(qint64 bytes)
+{
+    m_maxBodySize = bytes;
+}
+
+qint64 QHttpServer::maxBodySize() const
+{
+    return m_maxBodySize;
+}
+
 void QHttpServer::_newConnection()
 {
     Q_ASSERT(m_tcpServer);
@@ -272,15 +423,44 @@ void QHttpServer::_newConnection()
 
     qDebug() << "QHttpServer . _newConnection";
 
-    while (m_tcpServer->hasPendingConnections()) {
-        QHttpConnection *connection =
-            new QHttpConnection(this, m_tcpServer->nextPendingConnection());
-        connect(connection, SIGNAL(newRequest(QHttpRequest *, QHttpResponse *)), this,
-                SIGNAL(newRequest(QHttpRequest *, QHttpResponse *)), Qt::DirectConnection);
-        connect(connection, SIGNAL(requestFinished(QHttpRequest *, QHttpResponse *)), this,
-                SIGNAL(requestFinished(QHttpRequest *, QHttpResponse *)), Qt::DirectConnection);
-        emit newConnection(connection);
+    if (m_ioBackend != QtBackend) {
+        QTcpClientPeerThread *thread;
+        qintptr descriptor;
+        while ((descriptor = m_tcpServer->nextPendingDescriptor(&thread)) >= 0)
+            addConnection(new QHttpConnection(this, createTransport(descriptor, thread), thread));
+        return;
     }
+
+    while (m_tcpServer->hasPendingConnections())
+        addConnection(new QHttpConnection(this, m_tcpServer->nextPendingConnection()));
+}
+
+QHttpTransport *QHttpServer::createTransport(qintptr descriptor, QTcpClientPeerThread *thread)
+{
+    switch (m_ioBackend) {
+#ifdef Q_OS_LINUX
+    case EpollBackend:
+        return new QHttpEpollTransport(descriptor, thread);
+#endif
+    case IoUringBackend:
+        return new QHttpUringTransport(descriptor, thread);
+    default:
+        Q_UNREACHABLE();
+        return 0;
+    }
+}
+
+void QHttpServer::addConnection(QHttpConnection *connection)
+{
+    connect(connection, SIGNAL(newRequest(QHttpRequest *, QHttpResponse *)), this,
+            SIGNAL(newRequest(QHttpRequest *, QHttpResponse *)), Qt::DirectConnection);
+    connect(connection, SIGNAL(requestFinished(QHttpRequest *, QHttpResponse *)), this,
+            SIGNAL(requestFinished(QHttpRequest *, QHttpResponse *)), Qt::DirectConnection);
+    // Connections only emit checkContinue() if someone listens.
+    if (isSignalConnected(QMetaMethod::fromSignal(&QHttpServer::checkContinue)))
+        connect(connection, SIGNAL(checkContinue(QHttpRequest *, QHttpResponse *)), this,
+                SIGNAL(checkContinue(QHttpRequest *, QHttpResponse *)), Qt::DirectConnection);
+    emit newConnection(connection);
 }
 
 void QHttpServer::slot_listen(QString const & _address, quint16 port) {
@@ -295,6 +475,7 @@ void QHttpServer::slot_listen(QString const & _address, quint16 port) {
     //ASSERT_THREADS_MATCH(QThread::currentThread(), thread());
 
     m_tcpServer = new QMtTcpServer(this, m_maxThreads, m_maxConnsPerThread, m_maxPendingConnections);
+    m_tcpServer->setNativeSockets(m_ioBackend != QtBackend);
 
 
     bool couldBindToPort = m_tcpServer->listen(address, port);
@@ -24,7 +24,7 @@
 #define Q_HTTP_SERVER
 
 #define QHTTPSERVER_VERSION_MAJOR 0
-#define QHTTPSERVER_VERSION_MINOR 1
+#define QHTTPSERVER_VERSION_MINOR 2
 #define QHTTPSERVER_VERSION_PATCH 0
 
 #include <QObject>
@@ -47,11 +47,17 @@ extern QHash<int, QString> STATUS_CODES;
 
 class QTcpClientPeerThread;
 class QTcpSocketL;
+class QHttpTransport;
 
 struct PendingSocket {
     QTcpClientPeerThread * thread;
     QTcpSocketL * socket;
-    PendingSocket(QTcpClientPeerThread * thread, QTcpSocketL * socket) : thread(thread), socket(socket) {
+    // Raw descriptor when native sockets are used, socket is 0 then
+    qintptr descriptor;
+    PendingSocket(QTcpClientPeerThread * thread, QTcpSocketL * socket) : thread(thread), socket(socket), descriptor(-1) {
+
+    }
+    PendingSocket(QTcpClientPeerThread * thread, qintptr descriptor) : thread(thread), socket(0), descriptor(descriptor) {
 
     }
 };
@@ -66,6 +72,7 @@ class QHTTPSERVER_API QMtTcpServer : public QTcpServer
     int m_maxThreads;
     int m_maxConnsPerThread;
     int m_prefThreads;
+    bool m_nativeSockets;
 
 public:
     /// Construct a new multithreaded TCP Server.
@@ -76,12 +83,21 @@ public:
 
     QTcpSocket * nextPendingConnection();
 
+    /// Hand out raw descriptors instead of sockets, for native I/O backends.
+    /** Accepted connections are then returned by nextPendingDescriptor(). */
+    void setNativeSockets(bool enable) { m_nativeSockets = enable; }
+
+    /// Next pending native connection and the thread serving it, or -1.
+    qintptr nextPendingDescriptor(QTcpClientPeerThread **thread);
+
 protected:
 
     void incomingConnection(qintptr socketDescriptor);
 
     QTcpSocketL * createClientSocketPeer(qintptr socketDescriptor);
 
+    QTcpClientPeerThread * acquireThread(qintptr socketDescriptor);
+
 };
 
 class QTcpSocketL : public QTcpSocket {
@@ -123,6 +139,19 @@ class QHTTPSERVER_API QHttpServer : public QObject
     Q_OBJECT
 
 public:
+    /// Implementations of connection I/O.
+    enum IoBackend {
+        /// QTcpSocket, available everywhere. The default.
+        QtBackend,
+        /// Raw non-blocking sockets multiplexed by one edge-triggered epoll
+        /// set per connection thread. Linux only.
+        EpollBackend,
+        /// One io_uring per connection thread with multishot receives into
+        /// provided buffers and batched submissions. Linux 6.0 or later,
+        /// detected at runtime.
+        IoUringBackend
+    };
+
     /// Construct a new HTTP Server.
     /** @param parent Parent QObject for the server. */
     QHttpServer(QObject *parent = 0, bool startInNewThread=true, int maxThreads=1, int maxConnsPerThread=10,int maxPendingConnections=30);
@@ -146,6 +175,84 @@ public:
 
     /// Stop the server and listening for new connections.
     void close();
+
+    /// Select how connections do their I/O.
+    /** Native backends read and write the socket descriptors directly
+        instead of going through QTcpSocket, saving its buffering and
+        signal emissions, while requests and responses behave the same.
+        QHttpConnection::socket() returns 0 for their connections. Must be
+        called before listen(). Unsupported backends are ignored with a
+        warning.
+        @param backend Backend for the connections, QtBackend by default.
+        @sa isIoBackendSupported() */
+    void setIoBackend(IoBackend backend);
+    IoBackend ioBackend() const;
+
+    /// Whether @c backend can be used on this system.
+    static bool isIoBackendSupported(IoBackend backend);
+
+    /// Recycle request and response objects across keep-alive requests.
+    /** When enabled, every connection keeps one spare QHttpRequest and
+        QHttpResponse and resets them for the next request on the same
+        connection instead of allocating new objects. The server then owns
+        both objects, see \ref memorymanagement for the retain()/release()
+        contract. Only affects connections accepted after the call.
+        Disabled by default.
+        @param enable Whether to pool request/response objects. */
+    void setObjectPooling(bool enable);
+
+    /// Whether request and response objects are recycled.
+    /** @sa setObjectPooling() */
+    bool objectPooling() const;
+
+    /// Serve requests through @c handler instead of signals.
+    /** When a handler is set, connections call it directly from the parser
+        and do not emit newRequest(), requestFinished() or the request's
+        data() and end() signals. Pass 0 to go back to signals. Only affects
+        connections accepted after the call. The handler is not owned.
+        @param handler Handler called for every request, see QHttpHandler. */
+    void setHandler(QHttpHandler *handler);
+
+    /// The handler set with setHandler(), or 0.
+    QHttpHandler *handler() const;
+
+    /// Close keep-alive connections that stay idle for @c msec milliseconds.
+    /** A connection is idle while it is open, has no response outstanding
+        and no request is being received, including right after it was
+        accepted. Only affects connections accepted after the call.
+        @param msec Timeout in milliseconds, 0 (the default) disables it. */
+    void setIdleTimeout(int msec);
+    int idleTimeout() const;
+
+    /// Deadline for receiving the complete header section of a request.
+    /** Measured from the first byte of the request. When it passes, the
+        client gets a 408 Request Timeout response and the connection is
+        closed. This guards against clients trickling headers to hold on to
+        a connection slot. Only affects connections accepted after the call.
+        @param msec Timeout in milliseconds, 0 (the default) disables it. */
+    void setHeaderTimeout(int msec);
+    int headerTimeout() const;
+
+    /// Minimum rate at which request bodies must arrive.
+    /** Checked over windows of 5 seconds while a request body is being
+        received. Slower clients get a 408 Request Timeout response, if the
+        response has not been started yet, and the connection is closed.
+        Only affects connections accepted after the call.
+        @param bytesPerSecond Minimum rate, 0 (the default) disables it. */
+    void setMinimumBodyRate(int bytesPerSecond);
+    int minimumBodyRate() const;
+
+    /// Largest request body accepted, in bytes.
+    /** Requests announcing a larger Content-Length are answered with
+        413 Request Entity Too Large before newRequest() is emitted. Chunked
+        bodies are counted as they arrive and the connection is closed (with
+        a 413 response if the application has not started one) once they
+        exceed the limit. Only affects connections accepted after the call.
+        @param bytes Maximum body size, -1 (the default) for no limit.
+        @sa QHttpRequest::storeBody() */
+    void setMaxBodySize(qint64 bytes);
+    qint64 maxBodySize() const;
+
 Q_SIGNALS:
 
     void newConnection(QHttpConnection *con);
@@ -159,6 +266,19 @@ Q_SIGNALS:
 
     void requestFinished(QHttpRequest *request, QHttpResponse *response);
 
+    /// Emitted instead of newRequest() for requests with <tt>Expect: 100-continue</tt>.
+    /** The client waits for permission before sending the body. The slot
+        either calls QHttpResponse::writeContinue() and then handles the
+        request exactly like in newRequest(), or rejects it right away with
+        a final response, e.g. 413 or 417, without the body ever being sent.
+        The connection is closed after a rejection.
+
+        If nothing is connected to this signal (before listen() is called),
+        100 Continue is sent automatically and newRequest() is emitted.
+        @param request New incoming request.
+        @param response Response object to the request. */
+    void checkContinue(QHttpRequest *request, QHttpResponse *response);
+
     void sign_listen(QString const & address, quint16 port);
 
 private Q_SLOTS:
@@ -168,11 +288,21 @@ private Q_SLOTS:
 
 
 private:
+    QHttpTransport *createTransport(qintptr descriptor, QTcpClientPeerThread *thread);
+    void addConnection(QHttpConnection *connection);
+
     QHttpServerThread *m_serverThread;
     QMtTcpServer *m_tcpServer;
     int m_maxThreads;
     int m_maxConnsPerThread;
     int m_maxPendingConnections;
+    IoBackend m_ioBackend;
+    bool m_objectPooling;
+    QHttpHandler *m_handler;
+    int m_idleTimeout;
+    int m_headerTimeout;
+    int m_minimumBodyRate;
+    qint64 m_maxBodySize;
 };
 
 
@@ -198,19 +328,33 @@ Q_OBJECT
 public:
     QTcpClientPeerThread(QMtTcpServer *parent, int max) : parent(parent), max(max), connections(0) {
     }
-    inline bool add(QTcpSocketL * socket) {
+    inline bool reserve() {
         // trivial
         // ASSERT_THREADS_MATCH(QThread::currentThread(), parent->thread());
 
         if (connections < max) {
             ++connections;
-            qDebug() << "QTcpClientPeerThread . add  connections:"<<connections<<" < max:"<<max<<"... : " << s(*socket);
-            connect(socket, &QTcpSocketL::aboutToClose2, this, &QTcpClientPeerThread::closed1);
+            qDebug() << "QTcpClientPeerThread . reserve  connections:"<<connections<<" < max:"<<max;
             return true;
         } else {
             return false;
         }
     }
+    inline void add(QTcpSocketL * socket) {
+        connect(socket, &QTcpSocketL::aboutToClose2, this, &QTcpClientPeerThread::closed1);
+    }
+public slots:
+
+    /// Frees the slot of a native connection.
+    inline void release() {
+
+        // trivial
+        // ASSERT_THREADS_MATCH(QThread::currentThread(), parent->thread());
+
+        --connections;
+        qDebug() << "QTcpClientPeerThread . release  connections:"<<connections<<" < max:"<<max;
+    }
+
 private slots:
 
     inline void closed1(QTcpSocketL * socket) {
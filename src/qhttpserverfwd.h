@@ -36,11 +36,19 @@ class QHttpServer;
 class QHttpConnection;
 class QHttpRequest;
 class QHttpResponse;
+class QHttpHandler;
+class QHttpFormDecoder;
+class QHttpMultipartParser;
+class QHttpOffloadPool;
+struct QHttpOffloadResult;
 
 // Qt
 class QTcpServer;
 class QTcpSocket;
 
+// WebSockets
+class QWebSocket;
+
 // http_parser
 struct http_parser_settings;
 struct http_parser;
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttptimerwheel.h"
+
+#include <QThreadStorage>
+
+/// @cond nodoc
+
+QHttpTimer::QHttpTimer()
+    : m_next(0),
+      m_pprev(0),
+      m_expiry(0),
+      m_wheel(0)
+{
+}
+
+QHttpTimer::~QHttpTimer()
+{
+    stop();
+}
+
+void QHttpTimer::start(int msec)
+{
+    QHttpTimerWheel::instance()->add(this, msec);
+}
+
+void QHttpTimer::stop()
+{
+    if (m_wheel)
+        m_wheel->remove(this);
+}
+
+static QThreadStorage<QHttpTimerWheel *> wheels;
+
+QHttpTimerWheel *QHttpTimerWheel::instance()
+{
+    if (!wheels.hasLocalData())
+        wheels.setLocalData(new QHttpTimerWheel());
+    return wheels.localData();
+}
+
+QHttpTimerWheel::QHttpTimerWheel()
+    : QObject(0),
+      m_now(0),
+      m_count(0)
+{
+    for (int level = 0; level < Levels; ++level)
+        for (int slot = 0; slot < Slots; ++slot)
+            m_slots[level][slot] = 0;
+
+    m_clock.start();
+    m_timer.setInterval(TickMsec);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+QHttpTimerWheel::~QHttpTimerWheel()
+{
+    // Timers that outlive their thread's wheel simply become inactive.
+    for (int level = 0; level < Levels; ++level) {
+        for (int slot = 0; slot < Slots; ++slot) {
+            for (QHttpTimer *timer = m_slots[level][slot]; timer; ) {
+                QHttpTimer *next = timer->m_next;
+                timer->m_next = 0;
+                timer->m_pprev = 0;
+                timer->m_wheel = 0;
+                timer = next;
+            }
+        }
+    }
+}
+
+void QHttpTimerWheel::add(QHttpTimer *timer, int msec)
+{
+    if (timer->m_wheel)
+        timer->m_wheel->remove(timer);
+
+    if (!m_count) {
+        // Nothing was scheduled, so the wheel may have been stopped for a
+        // while. Catch up without walking the skipped ticks.
+        m_now = m_clock.elapsed() / TickMsec;
+        m_timer.start();
+    }
+
+    // Round up from the real clock, m_now may be lagging behind by a tick.
+    quint64 expiry = (quint64(m_clock.elapsed()) + qMax(msec, 0) + TickMsec - 1) / TickMsec;
+    timer->m_expiry = qMax(expiry, m_now + 1);
+    timer->m_wheel = this;
+    ++m_count;
+    insert(timer);
+}
+
+void QHttpTimerWheel::remove(QHttpTimer *timer)
+{
+    Q_ASSERT(timer->m_wheel == this);
+
+    unlink(timer);
+    timer->m_wheel = 0;
+    --m_count;
+}
+
+void QHttpTimerWheel::insert(QHttpTimer *timer)
+{
+    Q_ASSERT(timer->m_expiry >= m_now);
+
+    quint64 delta = timer->m_expiry - m_now;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (quint64(1) << (LevelBits * (level + 1))))
+        ++level;
+
+    if (level == Levels - 1) {
+        quint64 range = quint64(1) << (LevelBits * Levels);
+        if (delta >= range)
+            timer->m_expiry = m_now + range - 1;
+    }
+
+    int slot = (timer->m_expiry >> (LevelBits * level)) & (Slots - 1);
+    link(&m_slots[level][slot], timer);
+}
+
+void QHttpTimerWheel::tick()
+{
+    quint64 target = m_clock.elapsed() / TickMsec;
+    while (m_count && m_now < target)
+        advance();
+
+    if (!m_count) {
+        m_now = target;
+        m_timer.stop();
+    }
+}
+
+void QHttpTimerWheel::advance()
+{
+    ++m_now;
+
+    // Move the timers of the next higher level slot down whenever a level
+    // wraps around.
+    for (int level = 1; level < Levels; ++level) {
+        if (m_now & ((quint64(1) << (LevelBits * level)) - 1))
+            break;
+        cascade(level);
+    }
+
+    QHttpTimer *expired = m_slots[0][m_now & (Slots - 1)];
+    m_slots[0][m_now & (Slots - 1)] = 0;
+    if (expired)
+        expired->m_pprev = &expired;
+
+    // A timeout() may stop or restart any timer, including the ones still in
+    // the expired list, so unlink each timer before calling it.
+    while (expired) {
+        QHttpTimer *timer = expired;
+        unlink(timer);
+        timer->m_wheel = 0;
+        --m_count;
+        timer->timeout();
+    }
+}
+
+void QHttpTimerWheel::cascade(int level)
+{
+    int slot = (m_now >> (LevelBits * level)) & (Slots - 1);
+    QHttpTimer *timer = m_slots[level][slot];
+    m_slots[level][slot] = 0;
+
+    while (timer) {
+        QHttpTimer *next = timer->m_next;
+        insert(timer);
+        timer = next;
+    }
+}
+
+void QHttpTimerWheel::link(QHttpTimer **head, QHttpTimer *timer)
+{
+    timer->m_next = *head;
+    if (*head)
+        (*head)->m_pprev = &timer->m_next;
+    *head = timer;
+    timer->m_pprev = head;
+}
+
+void QHttpTimerWheel::unlink(QHttpTimer *timer)
+{
+    *timer->m_pprev = timer->m_next;
+    if (timer->m_next)
+        timer->m_next->m_pprev = timer->m_pprev;
+    timer->m_next = 0;
+    timer->m_pprev = 0;
+}
+
+/// @endcond
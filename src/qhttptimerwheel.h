@@ -0,0 +1,117 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_TIMER_WHEEL
+#define Q_HTTP_TIMER_WHEEL
+
+#include "qhttpserverapi.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QHttpTimerWheel;
+
+/// A timer scheduled on the QHttpTimerWheel of the thread calling start().
+/** Timers are intrusive list entries: starting, restarting and stopping one
+    is O(1) and allocates nothing. Subclasses implement timeout(), which is
+    called from the event loop of the thread the timer was started in. A timer
+    must be started, stopped and destroyed in that same thread. */
+class QHTTPSERVER_API QHttpTimer
+{
+public:
+    QHttpTimer();
+    virtual ~QHttpTimer();
+
+    /// (Re)start the timer to fire once after @c msec milliseconds.
+    void start(int msec);
+
+    /// Stop the timer. Does nothing if it is not active.
+    void stop();
+
+    bool isActive() const { return m_wheel != 0; }
+
+protected:
+    virtual void timeout() = 0;
+
+private:
+    friend class QHttpTimerWheel;
+
+    Q_DISABLE_COPY(QHttpTimer)
+
+    QHttpTimer *m_next;
+    QHttpTimer **m_pprev;
+    quint64 m_expiry;
+    QHttpTimerWheel *m_wheel;
+};
+
+/// @cond nodoc
+
+/// Per-thread hierarchical timer wheel.
+/** Four levels of 64 slots with a 100 ms tick cover timeouts up to about 19
+    days. A single QTimer per thread drives the wheel, and only while timers
+    are active, so the cost of the wheel does not depend on the number of
+    connections. Timers further away than the wheel's range are clamped to
+    it. */
+class QHTTPSERVER_API QHttpTimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum {
+        TickMsec = 100,
+        LevelBits = 6,
+        Levels = 4,
+        Slots = 1 << LevelBits
+    };
+
+    /// The wheel of the current thread, created on first use.
+    static QHttpTimerWheel *instance();
+
+    virtual ~QHttpTimerWheel();
+
+    void add(QHttpTimer *timer, int msec);
+    void remove(QHttpTimer *timer);
+
+private Q_SLOTS:
+    void tick();
+
+private:
+    QHttpTimerWheel();
+
+    void insert(QHttpTimer *timer);
+    void advance();
+    void cascade(int level);
+
+    static void link(QHttpTimer **head, QHttpTimer *timer);
+    static void unlink(QHttpTimer *timer);
+
+    QHttpTimer *m_slots[Levels][Slots];
+    quint64 m_now;
+    int m_count;
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+};
+
+/// @endcond
+
+#endif
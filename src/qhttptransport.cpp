@@ -0,0 +1,105 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttptransport.h"
+
+#include "qhttpconnection.h"
+#include "qhttpserver.h"
+
+#ifdef Q_OS_UNIX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+/// @cond nodoc
+
+QHttpTransport::QHttpTransport(qintptr descriptor, QTcpClientPeerThread *peerThread)
+    : m_descriptor(descriptor),
+      m_connection(0),
+      m_peerPort(0),
+      m_peerThread(peerThread)
+{
+}
+
+QHttpTransport::~QHttpTransport()
+{
+}
+
+QString QHttpTransport::description() const
+{
+    QString s;
+    if (m_descriptor >= 0) {
+        s = "fd " + QString::number(m_descriptor) + ":" + m_peerAddress.toString() + ":" +
+            QString::number(m_peerPort);
+    } else {
+        s = "<socket closed>";
+    }
+
+    s += ":cur#" + QString::number((std::ptrdiff_t)QThread::currentThread(), 16);
+    return s;
+}
+
+void QHttpTransport::received(const char *data, qint64 length)
+{
+    if (m_connection)
+        m_connection->received(data, length);
+}
+
+void QHttpTransport::written(qint64 count)
+{
+    if (m_connection)
+        m_connection->updateWriteCount(count);
+}
+
+void QHttpTransport::disconnected()
+{
+    if (m_connection)
+        m_connection->socketDisconnected();
+}
+
+void QHttpTransport::releaseDescriptor()
+{
+    if (!m_peerThread)
+        return;
+
+    // The peer thread object lives in the server thread.
+    QMetaObject::invokeMethod(m_peerThread, "release", Qt::QueuedConnection);
+    m_peerThread = 0;
+}
+
+void QHttpTransport::readPeerAddress()
+{
+#ifdef Q_OS_UNIX
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getpeername(m_descriptor, reinterpret_cast<struct sockaddr *>(&address), &length) != 0)
+        return;
+
+    m_peerAddress.setAddress(reinterpret_cast<struct sockaddr *>(&address));
+    if (address.ss_family == AF_INET6)
+        m_peerPort = ntohs(reinterpret_cast<struct sockaddr_in6 *>(&address)->sin6_port);
+    else
+        m_peerPort = ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
+#endif
+}
+
+/// @endcond
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_TRANSPORT
+#define Q_HTTP_TRANSPORT
+
+#include "qhttpserverapi.h"
+#include "qhttpserverfwd.h"
+
+#include <QHostAddress>
+
+/// @cond nodoc
+
+class QTcpClientPeerThread;
+
+/// Native socket I/O used by a QHttpConnection in place of a QTcpSocket.
+/** Implemented by the backends selected with QHttpServer::setIoBackend().
+    A transport owns its socket descriptor. It is created in the server
+    thread and start() is called from the thread the connection has moved
+    to, after which it is only used from that thread.
+
+    Like QTcpSocket, write() only buffers data. The backend sends it from
+    its event loop and reports the bytes sent to the connection afterwards,
+    never from within write(). */
+class QHTTPSERVER_API QHttpTransport
+{
+public:
+    QHttpTransport(qintptr descriptor, QTcpClientPeerThread *peerThread);
+    virtual ~QHttpTransport();
+
+    void setConnection(QHttpConnection *connection) { m_connection = connection; }
+
+    /// Start reading, in the connection's thread.
+    virtual void start() = 0;
+    /// Queue data to be sent.
+    virtual void write(const char *data, qint64 length) = 0;
+    /// Send queued data now, as far as the socket accepts it.
+    virtual void flush() = 0;
+    /// Close the socket once all queued data has been sent.
+    virtual void disconnectFromHost() = 0;
+
+    const QHostAddress &peerAddress() const { return m_peerAddress; }
+    quint16 peerPort() const { return m_peerPort; }
+    QString description() const;
+
+protected:
+    // Calls into the connection
+    void received(const char *data, qint64 length);
+    void written(qint64 count);
+    void disconnected();
+
+    // Gives the connection slot back to the peer thread, once.
+    void releaseDescriptor();
+    // Fills m_peerAddress and m_peerPort from the descriptor.
+    void readPeerAddress();
+
+    qintptr m_descriptor;
+    QHttpConnection *m_connection;
+    QHostAddress m_peerAddress;
+    quint16 m_peerPort;
+
+private:
+    Q_DISABLE_COPY(QHttpTransport)
+
+    QTcpClientPeerThread *m_peerThread;
+};
+
+/// @endcond
+
+#endif
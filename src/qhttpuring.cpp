@@ -0,0 +1,693 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qhttpuring.h"
+
+#if defined(Q_OS_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+/// @cond nodoc
+
+// Multishot recv is the newest feature used, its headers have the rest.
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <QThreadStorage>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct QHttpUringSocket
+{
+    // 0 once the transport is gone
+    QHttpUringTransport *transport;
+    int descriptor;
+    // Submissions whose last completion has not arrived yet
+    int pending;
+    bool receiving;
+    // Owned by the kernel while a send is in flight
+    QByteArray sending;
+    int sendPosition;
+};
+
+// Operation of a submission, stored in the low bits of its user_data
+enum {
+    ReceiveOperation = 1,
+    SendOperation = 2,
+    OperationMask = 7
+};
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, 0, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+struct QHttpUringLoop::Ring
+{
+    int fd;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqFlags;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    // Tail of the entries filled in but not published yet
+    unsigned sqLocalTail;
+    unsigned toSubmit;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    struct io_uring_buf_ring *buffers;
+    size_t buffersSize;
+    unsigned short bufferTail;
+
+    Ring();
+    ~Ring();
+    bool setup(unsigned entries);
+    bool registerBuffers(unsigned count);
+};
+
+QHttpUringLoop::Ring::Ring()
+    : fd(-1), sqes(0), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+      sqesSize(0), buffers(0), buffersSize(0), bufferTail(0)
+{
+}
+
+QHttpUringLoop::Ring::~Ring()
+{
+    if (buffers)
+        munmap(buffers, buffersSize);
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool QHttpUringLoop::Ring::setup(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = ioUringSetup(entries, &params);
+    if (fd < 0)
+        return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                  IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *entriesMap = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_SQES);
+    if (entriesMap == MAP_FAILED)
+        return false;
+    sqes = static_cast<struct io_uring_sqe *>(entriesMap);
+
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqFlags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+    toSubmit = 0;
+
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool QHttpUringLoop::Ring::registerBuffers(unsigned count)
+{
+    buffersSize = count * sizeof(struct io_uring_buf);
+    void *map = mmap(0, buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return false;
+    buffers = static_cast<struct io_uring_buf_ring *>(map);
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<quint64>(buffers);
+    registration.ring_entries = count;
+    registration.bgid = 0;
+    return ioUringRegister(fd, IORING_REGISTER_PBUF_RING, &registration, 1) == 0;
+}
+
+bool QHttpUringLoop::probe()
+{
+    QHttpUringLoop::Ring ring;
+    if (!ring.setup(8)) {
+        qDebug() << "QHttpUringLoop: io_uring not available:" << strerror(errno);
+        return false;
+    }
+
+    const int opCount = 256;
+    QByteArray memory(sizeof(struct io_uring_probe) + opCount * sizeof(struct io_uring_probe_op), 0);
+    struct io_uring_probe *ops = reinterpret_cast<struct io_uring_probe *>(memory.data());
+    if (ioUringRegister(ring.fd, IORING_REGISTER_PROBE, ops, opCount) < 0)
+        return false;
+    if (ops->last_op < IORING_OP_SEND || ops->last_op < IORING_OP_RECV)
+        return false;
+    if (!(ops->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) ||
+        !(ops->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED))
+        return false;
+
+    // Provided buffer rings appeared in Linux 5.19
+    if (!ring.registerBuffers(1)) {
+        qDebug() << "QHttpUringLoop: provided buffer rings not available:" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool QHttpUringLoop::isSupported()
+{
+    static const bool supported = probe();
+    return supported;
+}
+
+static QThreadStorage<QHttpUringLoop *> loops;
+
+QHttpUringLoop *QHttpUringLoop::instance()
+{
+    if (!loops.hasLocalData()) {
+        QHttpUringLoop *loop = new QHttpUringLoop();
+        if (!loop->setup()) {
+            qCritical() << "QHttpUringLoop: cannot set up io_uring:" << strerror(errno);
+            delete loop;
+            loop = 0;
+        }
+        loops.setLocalData(loop);
+    }
+    return loops.localData();
+}
+
+QHttpUringLoop::QHttpUringLoop()
+    : m_ring(new Ring()),
+      m_eventFd(-1),
+      m_dispatching(false),
+      m_wakeUpPending(false),
+      m_multishot(true),
+      m_notifier(0),
+      m_scheduled(0),
+      m_buffers(0)
+{
+}
+
+QHttpUringLoop::~QHttpUringLoop()
+{
+    // Closing the ring drops requests still in flight.
+    delete m_notifier;
+    delete m_ring;
+    if (m_eventFd >= 0)
+        ::close(m_eventFd);
+    delete[] m_buffers;
+}
+
+bool QHttpUringLoop::setup()
+{
+    if (!m_ring->setup(RingEntries))
+        return false;
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0 || ioUringRegister(m_ring->fd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0)
+        return false;
+
+    if (!m_ring->registerBuffers(BufferCount))
+        return false;
+    m_buffers = new char[BufferCount * BufferSize];
+    for (int id = 0; id < BufferCount; ++id)
+        recycleBuffer(id);
+
+    m_notifier = new QSocketNotifier(m_eventFd, QSocketNotifier::Read);
+    QObject::connect(m_notifier, &QSocketNotifier::activated, [this]() { activated(); });
+    return true;
+}
+
+void QHttpUringLoop::recycleBuffer(int id)
+{
+    // Not buffers->bufs, its flexible array is misplaced when compiled as C++.
+    struct io_uring_buf *buffers = reinterpret_cast<struct io_uring_buf *>(m_ring->buffers);
+    struct io_uring_buf *buffer = &buffers[m_ring->bufferTail & (BufferCount - 1)];
+    buffer->addr = reinterpret_cast<quint64>(m_buffers + id * BufferSize);
+    buffer->len = BufferSize;
+    buffer->bid = id;
+    ++m_ring->bufferTail;
+    __atomic_store_n(&m_ring->buffers->tail, m_ring->bufferTail, __ATOMIC_RELEASE);
+}
+
+void *QHttpUringLoop::nextSubmission()
+{
+    Ring *ring = m_ring;
+    if (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries) {
+        submit();
+        if (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >= ring->sqEntries)
+            return 0;
+    }
+
+    const unsigned index = ring->sqLocalTail & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ++ring->sqLocalTail;
+    ++ring->toSubmit;
+    return sqe;
+}
+
+bool QHttpUringLoop::submit()
+{
+    Ring *ring = m_ring;
+    if (!ring->toSubmit)
+        return false;
+
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    int submitted = ioUringEnter(ring->fd, ring->toSubmit, 0, 0);
+    if (submitted <= 0) {
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            qWarning() << "QHttpUringLoop: submission failed:" << strerror(errno);
+        return false;
+    }
+    ring->toSubmit -= qMin<unsigned>(submitted, ring->toSubmit);
+    return true;
+}
+
+void QHttpUringLoop::receive(QHttpUringSocket *socket)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(nextSubmission());
+    if (!sqe) {
+        qWarning() << "QHttpUringLoop: submission queue full";
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket->descriptor;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = m_multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = reinterpret_cast<quint64>(socket) | ReceiveOperation;
+    socket->receiving = true;
+    ++socket->pending;
+
+    if (!m_dispatching)
+        submit();
+}
+
+void QHttpUringLoop::send(QHttpUringSocket *socket)
+{
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(nextSubmission());
+    if (!sqe) {
+        qWarning() << "QHttpUringLoop: submission queue full";
+        return;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socket->descriptor;
+    sqe->addr = reinterpret_cast<quint64>(socket->sending.constData() + socket->sendPosition);
+    sqe->len = socket->sending.size() - socket->sendPosition;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<quint64>(socket) | SendOperation;
+    ++socket->pending;
+
+    if (!m_dispatching)
+        submit();
+}
+
+void QHttpUringLoop::schedule(QHttpUringTransport *transport)
+{
+    if (transport->m_scheduled)
+        return;
+
+    transport->m_scheduled = true;
+    transport->m_nextScheduled = m_scheduled;
+    m_scheduled = transport;
+    if (!m_dispatching)
+        wakeUp();
+}
+
+void QHttpUringLoop::unschedule(QHttpUringTransport *transport)
+{
+    if (!transport->m_scheduled)
+        return;
+
+    QHttpUringTransport **next = &m_scheduled;
+    while (*next != transport)
+        next = &(*next)->m_nextScheduled;
+    *next = transport->m_nextScheduled;
+    transport->m_scheduled = false;
+}
+
+void QHttpUringLoop::flushScheduled()
+{
+    // Flushing may schedule transports again, they are picked up here too.
+    while (m_scheduled) {
+        QHttpUringTransport *transport = m_scheduled;
+        m_scheduled = transport->m_nextScheduled;
+        transport->m_scheduled = false;
+        transport->flush();
+    }
+}
+
+void QHttpUringLoop::wakeUp()
+{
+    if (m_wakeUpPending)
+        return;
+
+    m_wakeUpPending = true;
+    const quint64 one = 1;
+    if (::write(m_eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        qWarning() << "QHttpUringLoop: cannot wake up:" << strerror(errno);
+}
+
+void QHttpUringLoop::activated()
+{
+    // Handlers running a nested event loop must not reenter the dispatch,
+    // a provided buffer is still being parsed.
+    m_notifier->setEnabled(false);
+    m_dispatching = true;
+
+    quint64 value;
+    if (::read(m_eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        qWarning() << "QHttpUringLoop: cannot read eventfd:" << strerror(errno);
+    m_wakeUpPending = false;
+
+    Ring *ring = m_ring;
+    for (;;) {
+        if (__atomic_load_n(ring->sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+            ioUringEnter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+
+        unsigned head = *ring->cqHead;
+        const unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            flushScheduled();
+            // Submitting may complete requests inline, reap them too.
+            if (submit())
+                continue;
+            // EAGAIN or EBUSY left entries unsubmitted. Retry once the
+            // completions that arrived meanwhile are reaped, or else from
+            // the event loop, nothing else would wake us up for them.
+            if (ring->toSubmit && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+                if (*ring->cqHead != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+                    continue;
+                wakeUp();
+            }
+            break;
+        }
+
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+            const quint64 data = cqe->user_data;
+            const int result = cqe->res;
+            const quint32 flags = cqe->flags;
+            // Release the entry first, handlers may submit and reap again.
+            __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+            complete(data, result, flags);
+        }
+    }
+
+    m_dispatching = false;
+    m_notifier->setEnabled(true);
+}
+
+void QHttpUringLoop::complete(quint64 data, int result, quint32 flags)
+{
+    QHttpUringSocket *socket = reinterpret_cast<QHttpUringSocket *>(data & ~quint64(OperationMask));
+
+    switch (data & OperationMask) {
+    case ReceiveOperation: {
+        const bool more = flags & IORING_CQE_F_MORE;
+        if (!more) {
+            socket->receiving = false;
+            --socket->pending;
+        }
+
+        bool rearm = false;
+        if (result > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            const int id = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (socket->transport)
+                socket->transport->receivedData(m_buffers + id * BufferSize, result);
+            recycleBuffer(id);
+            rearm = true;
+        } else if (result == -ENOBUFS) {
+            // All buffers were in use, they have been recycled by now.
+            rearm = true;
+        } else if (result == -EINVAL && m_multishot) {
+            qDebug() << "QHttpUringLoop: no multishot recv, falling back to single shot";
+            m_multishot = false;
+            rearm = true;
+        } else if (socket->transport) {
+            // End of stream or error
+            socket->transport->close(true);
+        }
+
+        if (rearm && !more && socket->transport && socket->descriptor >= 0)
+            receive(socket);
+        break;
+    }
+    case SendOperation:
+        --socket->pending;
+        if (socket->transport)
+            socket->transport->sent(result);
+        break;
+    }
+
+    if (!socket->transport && !socket->pending)
+        delete socket;
+}
+
+QHttpUringTransport::QHttpUringTransport(qintptr descriptor, QTcpClientPeerThread *peerThread)
+    : QHttpTransport(descriptor, peerThread),
+      m_loop(0),
+      m_socket(new QHttpUringSocket()),
+      m_nextScheduled(0),
+      m_scheduled(false),
+      m_closing(false)
+{
+    m_socket->transport = this;
+    m_socket->descriptor = descriptor;
+    m_socket->pending = 0;
+    m_socket->receiving = false;
+    m_socket->sendPosition = 0;
+
+    readPeerAddress();
+}
+
+QHttpUringTransport::~QHttpUringTransport()
+{
+    close(false);
+
+    m_socket->transport = 0;
+    if (!m_socket->pending)
+        delete m_socket;
+}
+
+void QHttpUringTransport::start()
+{
+    m_loop = QHttpUringLoop::instance();
+    if (!m_loop) {
+        close(true);
+        return;
+    }
+    m_loop->receive(m_socket);
+}
+
+void QHttpUringTransport::write(const char *data, qint64 length)
+{
+    if (m_descriptor < 0 || m_closing || !m_loop)
+        return;
+
+    m_output.append(data, length);
+    m_loop->schedule(this);
+}
+
+void QHttpUringTransport::flush()
+{
+    if (m_descriptor < 0 || !m_loop)
+        return;
+
+    // One send in flight at a time, data written meanwhile goes out next.
+    if (m_socket->sending.isEmpty() && !m_output.isEmpty()) {
+        m_socket->sending.swap(m_output);
+        m_socket->sendPosition = 0;
+        m_loop->send(m_socket);
+    }
+
+    if (m_closing && m_socket->sending.isEmpty() && m_output.isEmpty())
+        close(true);
+}
+
+void QHttpUringTransport::disconnectFromHost()
+{
+    if (m_descriptor < 0 || m_closing)
+        return;
+
+    m_closing = true;
+    if (m_loop)
+        m_loop->schedule(this);
+    else
+        close(true);
+}
+
+void QHttpUringTransport::receivedData(const char *data, int length)
+{
+    if (m_descriptor >= 0)
+        received(data, length);
+}
+
+void QHttpUringTransport::sent(int result)
+{
+    if (m_descriptor < 0) {
+        m_socket->sending.clear();
+        return;
+    }
+    if (result < 0) {
+        close(true);
+        return;
+    }
+
+    m_socket->sendPosition += result;
+    if (m_socket->sendPosition < m_socket->sending.size()) {
+        m_loop->send(m_socket);
+    } else {
+        m_socket->sending.resize(0);
+        m_socket->sendPosition = 0;
+        if (!m_output.isEmpty() || m_closing)
+            m_loop->schedule(this);
+    }
+
+    if (result > 0)
+        written(result);
+}
+
+void QHttpUringTransport::close(bool notify)
+{
+    if (m_descriptor < 0)
+        return;
+
+    if (m_loop)
+        m_loop->unschedule(this);
+
+    // Shutting down completes the pending recv and any send, the socket
+    // state is freed with the last completion.
+    ::shutdown(m_descriptor, SHUT_RDWR);
+    ::close(m_descriptor);
+    m_descriptor = -1;
+    m_socket->descriptor = -1;
+    m_output.clear();
+    if (!m_socket->pending)
+        m_socket->sending.clear();
+    releaseDescriptor();
+
+    if (notify)
+        disconnected();
+}
+
+#else
+
+bool QHttpUringLoop::isSupported()
+{
+    return false;
+}
+
+QHttpUringTransport::QHttpUringTransport(qintptr descriptor, QTcpClientPeerThread *peerThread)
+    : QHttpTransport(descriptor, peerThread),
+      m_loop(0),
+      m_socket(0),
+      m_nextScheduled(0),
+      m_scheduled(false),
+      m_closing(false)
+{
+}
+
+QHttpUringTransport::~QHttpUringTransport()
+{
+}
+
+void QHttpUringTransport::start()
+{
+}
+
+void QHttpUringTransport::write(const char *, qint64)
+{
+}
+
+void QHttpUringTransport::flush()
+{
+}
+
+void QHttpUringTransport::disconnectFromHost()
+{
+}
+
+#endif
+
+/// @endcond
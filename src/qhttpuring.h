@@ -0,0 +1,131 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef Q_HTTP_URING
+#define Q_HTTP_URING
+
+#include "qhttpserverapi.h"
+#include "qhttptransport.h"
+
+#include <QByteArray>
+
+class QSocketNotifier;
+
+/// @cond nodoc
+
+class QHttpUringTransport;
+struct QHttpUringSocket;
+
+/// Per-thread io_uring instance for QHttpUringTransport sockets.
+/** Receives use multishot recv with buffers picked by the kernel from a
+    provided buffer ring, so one submission keeps a socket readable for
+    its whole life and no receive buffer is reserved per connection.
+    Submissions made while handling completions are batched into a single
+    io_uring_enter(). Completions are signalled through an eventfd watched by
+    one QSocketNotifier, so the thread keeps running its Qt event loop.
+
+    The ring is driven through the raw system calls; no liburing is needed. */
+class QHTTPSERVER_API QHttpUringLoop
+{
+public:
+    enum {
+        RingEntries = 1024,
+        BufferCount = 256,
+        BufferSize = 16 * 1024
+    };
+
+    /// Whether the running kernel supports everything the backend uses.
+    /** Checked once by setting up a probe ring. */
+    static bool isSupported();
+
+    /// The loop of the calling thread, created on first use, or 0 if the
+    /// ring cannot be set up.
+    static QHttpUringLoop *instance();
+
+    ~QHttpUringLoop();
+
+    void receive(QHttpUringSocket *socket);
+    void send(QHttpUringSocket *socket);
+
+    /// Flush @c transport after the current batch of completions.
+    void schedule(QHttpUringTransport *transport);
+    void unschedule(QHttpUringTransport *transport);
+
+private:
+    struct Ring;
+
+    QHttpUringLoop();
+    Q_DISABLE_COPY(QHttpUringLoop)
+
+    static bool probe();
+    bool setup();
+    void *nextSubmission();
+    bool submit();
+    void activated();
+    void flushScheduled();
+    void complete(quint64 data, int result, quint32 flags);
+    void recycleBuffer(int id);
+    void wakeUp();
+
+    Ring *m_ring;
+    int m_eventFd;
+    bool m_dispatching;
+    bool m_wakeUpPending;
+    // Falls back to one recv per completion on kernels without multishot
+    bool m_multishot;
+    QSocketNotifier *m_notifier;
+    QHttpUringTransport *m_scheduled;
+    char *m_buffers;
+};
+
+/// Socket whose I/O is done by the thread's QHttpUringLoop.
+class QHTTPSERVER_API QHttpUringTransport : public QHttpTransport
+{
+public:
+    QHttpUringTransport(qintptr descriptor, QTcpClientPeerThread *peerThread);
+    ~QHttpUringTransport();
+
+    void start();
+    void write(const char *data, qint64 length);
+    void flush();
+    void disconnectFromHost();
+
+private:
+    friend class QHttpUringLoop;
+
+    void receivedData(const char *data, int length);
+    void sent(int result);
+    void close(bool notify);
+
+    QHttpUringLoop *m_loop;
+    // Outlives the transport until the kernel is done with it
+    QHttpUringSocket *m_socket;
+    QByteArray m_output;
+    // Next transport to flush, see QHttpUringLoop::schedule()
+    QHttpUringTransport *m_nextScheduled;
+    bool m_scheduled;
+    bool m_closing;
+};
+
+/// @endcond
+
+#endif
@@ -5,7 +5,8 @@ TEMPLATE = lib
 
 TARGET = qhttpserver
 
-!win32:VERSION = 0.1.0
+# 0.2.0: QHttpResponse::write() returns the buffered byte count
+!win32:VERSION = 0.2.0
 
 QT += network
 QT -= gui
@@ -20,9 +21,12 @@ DEFINES += QHTTPSERVER_EXPORT
 
 INCLUDEPATH += $$QHTTPSERVER_BASE/http-parser
 
-PRIVATE_HEADERS += $$QHTTPSERVER_BASE/http-parser/http_parser.h qhttpconnection.h
+# zlib, for the permessage-deflate WebSocket extension
+LIBS += -lz
 
-PUBLIC_HEADERS += qhttpserver.h qhttprequest.h qhttpresponse.h qhttpserverapi.h qhttpserverfwd.h
+PRIVATE_HEADERS += $$QHTTPSERVER_BASE/http-parser/http_parser.h qhttpconnection.h qhttptransport.h qhttpepoll.h qhttpuring.h
+
+PUBLIC_HEADERS += qhttpserver.h qhttprequest.h qhttpresponse.h qhttphandler.h qhttpformdecoder.h qhttpmultipartparser.h qhttpoffload.h qhttpcoroutine.h qhttptimerwheel.h qhttpserverapi.h qhttpserverfwd.h
 
 HEADERS = $$PRIVATE_HEADERS $$PUBLIC_HEADERS \
     safequeue.h \
@@ -34,9 +38,15 @@ HEADERS = $$PRIVATE_HEADERS $$PUBLIC_HEADERS \
     websockets/qwebsocketcorsauthenticator.h \
     websockets/qwebsocketcorsauthenticator_p.h \
     websockets/qwebsocketdataprocessor_p.h \
+    websockets/qwebsocketdeflate_p.h \
     websockets/qwebsocketframe_p.h \
+    websockets/qwebsockethandshakeparser_p.h \
     websockets/qwebsockethandshakerequest_p.h \
     websockets/qwebsockethandshakeresponse_p.h \
+    websockets/qwebsockethub.h \
+    websockets/qwebsockethub_p.h \
+    websockets/qwebsocketpreparedmessage.h \
+    websockets/qwebsocketpreparedmessage_p.h \
     websockets/qwebsocketprotocol.h \
     websockets/qwebsocketprotocol_p.h \
     websockets/qwebsockets_global.h \
@@ -50,9 +60,13 @@ SOURCES = *.cpp $$QHTTPSERVER_BASE/http-parser/http_parser.c \
     websockets/qwebsocket_p.cpp \
     websockets/qwebsocketcorsauthenticator.cpp \
     websockets/qwebsocketdataprocessor.cpp \
+    websockets/qwebsocketdeflate.cpp \
     websockets/qwebsocketframe.cpp \
+    websockets/qwebsockethandshakeparser.cpp \
     websockets/qwebsockethandshakerequest.cpp \
     websockets/qwebsockethandshakeresponse.cpp \
+    websockets/qwebsockethub.cpp \
+    websockets/qwebsocketpreparedmessage.cpp \
     websockets/qwebsocketprotocol.cpp \
     websockets/qwebsocketserver.cpp \
     websockets/qwebsocketserver_p.cpp
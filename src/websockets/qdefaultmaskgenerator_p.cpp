@@ -42,8 +42,13 @@
     malicious scripts to attack bad behaving proxies.
     For more information about the importance of good masking,
     see \l {http://w2spconf.com/2011/papers/websocket.pdf}.
-    The default mask generator uses the cryptographically insecure qrand() function.
-    The best measure against attacks mentioned in the document above,
+    The default mask generator takes its masks from a ChaCha20 keystream kept
+    per thread. The stream is keyed from the operating system's random source
+    (getrandom() on Linux), produces a batch of blocks at a time and starts
+    every batch with the key of the next one, so masks are cheap to produce
+    and neither earlier nor later masks can be derived from the ones on the
+    wire. The key is mixed with fresh system randomness now and then.
+    Still, the best measure against attacks mentioned in the document above,
     is to use QWebSocket over a secure connection (\e wss://).
     In general, always be careful to not have 3rd party script access to
     a QWebSocket in your application.
@@ -52,11 +57,220 @@
 */
 
 #include "qdefaultmaskgenerator_p.h"
-#include <QDateTime>
-#include <limits>
+#include <QtCore/QDateTime>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QtEndian>
+
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#include <QtCore/QRandomGenerator>
+#endif
 
 QT_BEGIN_NAMESPACE
 
+namespace {
+
+/*
+    Fills \a data with \a size bytes from the system's random source.
+    Returns false when there is none.
+ */
+bool systemRandom(uchar *data, size_t size)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_getrandom)
+    while (size) {
+        const long n = syscall(SYS_getrandom, data, size, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;  //kernels before 3.17 still have /dev/urandom
+        }
+        data += n;
+        size -= size_t(n);
+    }
+    if (!size)
+        return true;
+#endif
+#if defined(Q_OS_BSD4)
+    arc4random_buf(data, size);
+    return true;
+#elif defined(Q_OS_UNIX)
+    const int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    while (size) {
+        const ssize_t n = ::read(fd, data, size);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        data += n;
+        size -= size_t(n);
+    }
+    ::close(fd);
+    return !size;
+#elif QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    QRandomGenerator::system()->fillRange(reinterpret_cast<quint32 *>(data),
+                                          qsizetype(size / sizeof(quint32)));
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+inline quint32 rotate(quint32 value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+#define QUARTERROUND(a, b, c, d) \
+    x[a] += x[b]; x[d] = rotate(x[d] ^ x[a], 16); \
+    x[c] += x[d]; x[b] = rotate(x[b] ^ x[c], 12); \
+    x[a] += x[b]; x[d] = rotate(x[d] ^ x[a], 8); \
+    x[c] += x[d]; x[b] = rotate(x[b] ^ x[c], 7);
+
+/*
+    Writes the 64 byte ChaCha20 block \a counter of \a key (RFC 7539, with an
+    all zero nonce) to \a out.
+ */
+void chachaBlock(const quint32 *key, quint32 counter, uchar *out)
+{
+    const quint32 input[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, 0, 0, 0
+    };
+    quint32 x[16];
+    memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        QUARTERROUND(0, 4, 8, 12)
+        QUARTERROUND(1, 5, 9, 13)
+        QUARTERROUND(2, 6, 10, 14)
+        QUARTERROUND(3, 7, 11, 15)
+        QUARTERROUND(0, 5, 10, 15)
+        QUARTERROUND(1, 6, 11, 12)
+        QUARTERROUND(2, 7, 8, 13)
+        QUARTERROUND(3, 4, 9, 14)
+    }
+    for (int i = 0; i < 16; ++i)
+        qToLittleEndian<quint32>(x[i] + input[i], out + i * 4);
+}
+
+#undef QUARTERROUND
+
+/*
+    The random stream of one thread. Output handed out is wiped from the
+    buffer, and the key is replaced by every batch.
+ */
+class RandomStream
+{
+public:
+    RandomStream() :
+        m_available(0),
+        m_batches(0),
+        m_isSeeded(false)
+    {
+        memset(m_key, 0, sizeof(m_key));
+        reseed();
+    }
+
+    ~RandomStream()
+    {
+        memset(m_key, 0, sizeof(m_key));
+        memset(m_buffer, 0, sizeof(m_buffer));
+    }
+
+    bool isSeeded() const
+    {
+        return m_isSeeded;
+    }
+
+    void read(uchar *data, size_t size)
+    {
+        while (size) {
+            if (!m_available)
+                refill();
+            const size_t n = qMin(size, size_t(m_available));
+            uchar *pOutput = m_buffer + sizeof(m_buffer) - m_available;
+            memcpy(data, pOutput, n);
+            memset(pOutput, 0, n);
+            m_available -= int(n);
+            data += n;
+            size -= n;
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(RandomStream)
+
+    enum
+    {
+        BlockSize = 64,
+        BlockCount = 8,                 //one batch yields 120 masks
+        ReseedInterval = 1024           //batches
+    };
+
+    void reseed()
+    {
+        quint32 entropy[8];
+        m_isSeeded = systemRandom(reinterpret_cast<uchar *>(entropy), sizeof(entropy));
+        if (!m_isSeeded) {
+            //no better source: at least tell threads and runs apart
+            const quint64 now = quint64(QDateTime::currentMSecsSinceEpoch());
+            const quint64 self = quint64(quintptr(this));
+            entropy[0] = quint32(now);
+            entropy[1] = quint32(now >> 32);
+            entropy[2] = quint32(self);
+            entropy[3] = quint32(self >> 32);
+            entropy[4] = entropy[5] = entropy[6] = entropy[7] = 0;
+        }
+        for (int i = 0; i < 8; ++i)
+            m_key[i] ^= entropy[i];
+        memset(entropy, 0, sizeof(entropy));
+        m_batches = 0;
+    }
+
+    void refill()
+    {
+        if (++m_batches > ReseedInterval)
+            reseed();
+        for (int i = 0; i < BlockCount; ++i)
+            chachaBlock(m_key, quint32(i), m_buffer + i * BlockSize);
+        //the first 32 bytes become the next key and are never handed out
+        for (int i = 0; i < 8; ++i)
+            m_key[i] = qFromLittleEndian<quint32>(m_buffer + i * 4);
+        memset(m_buffer, 0, sizeof(m_key));
+        m_available = int(sizeof(m_buffer) - sizeof(m_key));
+    }
+
+    quint32 m_key[8];
+    uchar m_buffer[BlockSize * BlockCount];
+    int m_available;    //unread bytes at the end of m_buffer
+    int m_batches;
+    bool m_isSeeded;
+};
+
+RandomStream *randomStream()
+{
+    static QThreadStorage<RandomStream *> streams;
+    if (!streams.hasLocalData())
+        streams.setLocalData(new RandomStream);
+    return streams.localData();
+}
+
+}
+
 /*!
     Constructs a new QDefaultMaskGenerator with the given \a parent.
 
@@ -77,25 +291,42 @@ QDefaultMaskGenerator::~QDefaultMaskGenerator()
 }
 
 /*!
-    Seeds the QDefaultMaskGenerator using qsrand().
-    When seed() is not called, no seed is used at all.
+    Makes sure the random stream of the calling thread is set up.
+    Returns false if the system offers no random source; the stream then
+    only depends on the time and is predictable.
 
     \internal
 */
 bool QDefaultMaskGenerator::seed() Q_DECL_NOEXCEPT
 {
-    qsrand(static_cast<uint>(QDateTime::currentMSecsSinceEpoch()));
-    return true;
+    return randomStream()->isSeeded();
 }
 
 /*!
-    Generates a new random mask using the insecure qrand() method.
+    Returns a new random mask from the random stream of the calling thread.
+    The mask is never 0, as that would send the frame unmasked.
 
     \internal
 */
 quint32 QDefaultMaskGenerator::nextMask() Q_DECL_NOEXCEPT
 {
-    return quint32((double(qrand()) / RAND_MAX) * std::numeric_limits<quint32>::max());
+    RandomStream *pStream = randomStream();
+    quint32 mask = 0;
+    while (!mask)
+        pStream->read(reinterpret_cast<uchar *>(&mask), sizeof(mask));
+    return mask;
+}
+
+/*!
+    Fills \a data with \a size random bytes from the random stream of the
+    calling thread.
+
+    \internal
+*/
+void QDefaultMaskGenerator::generate(char *data, int size) Q_DECL_NOEXCEPT
+{
+    if (size > 0)
+        randomStream()->read(reinterpret_cast<uchar *>(data), size_t(size));
 }
 
 QT_END_NAMESPACE
@@ -60,6 +60,8 @@ public:
 
     bool seed() Q_DECL_NOEXCEPT Q_DECL_OVERRIDE;
     quint32 nextMask() Q_DECL_NOEXCEPT Q_DECL_OVERRIDE;
+
+    static void generate(char *data, int size) Q_DECL_NOEXCEPT;
 };
 
 QT_END_NAMESPACE
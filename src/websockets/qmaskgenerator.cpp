@@ -44,7 +44,8 @@
     malicious scripts from attacking badly behaving proxies.
     For more information about the importance of good masking,
     see \l {http://w2spconf.com/2011/papers/websocket.pdf}.
-    By default QWebSocket uses the cryptographically insecure qrand() function.
+    By default QWebSocket uses a ChaCha20 keystream per thread, keyed from the operating
+    system's random source.
     The best measure against attacks mentioned in the document above,
     is to use QWebSocket over a secure connection (\e wss://).
     In general, always be careful to not have 3rd party script access to
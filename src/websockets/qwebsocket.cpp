@@ -57,8 +57,8 @@
     In that case, non-secure WebSocket connections fail. The best way to mitigate against
     this problem is to use WebSocket over a secure connection.
 
-    \warning To generate masks, this implementation of WebSockets uses the cryptographically
-    insecure qrand() function.
+    \note To generate masks, this implementation of WebSockets uses a ChaCha20 keystream per
+    thread, keyed from the operating system's random source.
     For more information about the importance of good masking,
     see \l {http://w2spconf.com/2011/papers/websocket.pdf}.
     The best measure against attacks mentioned in the document above,
@@ -369,6 +369,21 @@ qint64 QWebSocket::sendBinaryMessage(const QByteArray &data)
     return d->sendBinaryMessage(data);
 }
 
+/*!
+    \brief Sends the prepared \a message over the socket and returns the
+    number of payload bytes actually sent.
+
+    The frames of a server socket are built once per message and shared with
+    every other socket the message is sent to.
+
+    \sa QWebSocketPreparedMessage::broadcast(), sendTextMessage(), sendBinaryMessage()
+ */
+qint64 QWebSocket::sendPreparedMessage(const QWebSocketPreparedMessage &message)
+{
+    Q_D(QWebSocket);
+    return d->sendPreparedMessage(message);
+}
+
 /*!
     \brief Gracefully closes the socket with the given \a closeCode and \a reason.
 
@@ -658,6 +673,17 @@ qint64 QWebSocket::readBufferSize() const
     return d->readBufferSize();
 }
 
+/*!
+    Returns the number of bytes that are waiting to be written to the network.
+
+    \sa bytesWritten(), flush()
+ */
+qint64 QWebSocket::bytesToWrite() const
+{
+    Q_D(const QWebSocket);
+    return d->bytesToWrite();
+}
+
 /*!
     Continues data transfer on the socket. This method should only be used after the socket
     has been set to pause upon notifications and a notification has been received.
@@ -45,6 +45,7 @@
 #endif
 #include "QtWebSockets/qwebsockets_global.h"
 #include "QtWebSockets/qwebsocketprotocol.h"
+#include "QtWebSockets/qwebsocketpreparedmessage.h"
 
 QT_BEGIN_NAMESPACE
 
@@ -83,6 +84,7 @@ public:
     const QMaskGenerator *maskGenerator() const;
     qint64 readBufferSize() const;
     void setReadBufferSize(qint64 size);
+    qint64 bytesToWrite() const;
 
     void resume();
     void setPauseMode(QAbstractSocket::PauseModes pauseMode);
@@ -98,6 +100,7 @@ public:
 
     qint64 sendTextMessage(const QString &message);
     qint64 sendBinaryMessage(const QByteArray &data);
+    Q_INVOKABLE qint64 sendPreparedMessage(const QWebSocketPreparedMessage &message);
 
 #ifndef QT_NO_SSL
     void ignoreSslErrors(const QList<QSslError> &errors);
@@ -33,6 +33,7 @@
 
 #include "qwebsocket.h"
 #include "qwebsocket_p.h"
+#include "qwebsocketpreparedmessage_p.h"
 #include "qwebsocketprotocol_p.h"
 #include "qwebsockethandshakerequest_p.h"
 #include "qwebsockethandshakeresponse_p.h"
@@ -59,10 +60,15 @@
 #include <QtCore/QDebug>
 
 #include <limits>
+#include <string.h>
 
 QT_BEGIN_NAMESPACE
 
 const quint64 FRAME_SIZE_IN_BYTES = 512 * 512 * 2;	//maximum size of a frame when sending a message
+const int MAX_HEADER_SIZE_IN_BYTES = 14;	//2 bytes, 8 bytes extended length, 4 bytes mask
+const int GATHER_SIZE_IN_BYTES = 4096;	//frames up to this size are sent with one write
+const int MIN_DEFLATE_SIZE_IN_BYTES = 128;	//smaller messages are not compressed
+const int MAX_DEFLATE_BUFFER_IN_BYTES = 64 * 1024;	//larger buffers are not kept between messages
 
 QWebSocketConfiguration::QWebSocketConfiguration() :
 #ifndef QT_NO_SSL
@@ -103,10 +109,12 @@ QWebSocketPrivate::QWebSocketPrivate(const QString &origin, QWebSocketProtocol::
     m_closeReason(),
     m_pingTimer(),
     m_dataProcessor(),
+    m_pDeflate(),
+    m_deflateBuffer(),
     m_configuration(),
     m_pMaskGenerator(&m_defaultMaskGenerator),
     m_defaultMaskGenerator(),
-    m_handshakeState(NothingDoneState)
+    m_handshakeParser(QWebSocketHandshakeParser::Response)
 {
 }
 
@@ -136,10 +144,12 @@ QWebSocketPrivate::QWebSocketPrivate(QTcpSocket *pTcpSocket, QWebSocketProtocol:
     m_closeReason(),
     m_pingTimer(),
     m_dataProcessor(),
+    m_pDeflate(),
+    m_deflateBuffer(),
     m_configuration(),
     m_pMaskGenerator(&m_defaultMaskGenerator),
     m_defaultMaskGenerator(),
-    m_handshakeState(NothingDoneState)
+    m_handshakeParser(QWebSocketHandshakeParser::Response)
 {
 }
 
@@ -163,6 +173,7 @@ void QWebSocketPrivate::init()
 */
 QWebSocketPrivate::~QWebSocketPrivate()
 {
+    m_dataProcessor.setDeflate(Q_NULLPTR);
 }
 
 /*!
@@ -237,6 +248,37 @@ qint64 QWebSocketPrivate::sendBinaryMessage(const QByteArray &data)
     return doWriteFrames(data, true);
 }
 
+/*!
+    \internal
+ */
+qint64 QWebSocketPrivate::sendPreparedMessage(const QWebSocketPreparedMessage &message)
+{
+    if (Q_UNLIKELY(!m_pSocket) || (state() != QAbstractSocket::ConnectedState)
+            || message.isNull())
+        return 0;
+    QWebSocketPreparedMessagePrivate *pMessage = message.d.data();
+
+    //a client masks every frame with a new key, and a compressor with context
+    //takeover depends on this connection's history; only the payload is shared then
+    const bool isCompressed = m_pDeflate
+            && (pMessage->payload.size() >= MIN_DEFLATE_SIZE_IN_BYTES);
+    if (m_mustMask || (isCompressed && m_pDeflate->hasDeflateContextTakeover()))
+        return doWriteFrames(pMessage->payload, pMessage->isBinary);
+
+    //written as the shared QByteArray, which QIODevice can append to its
+    //write buffer without copying
+    const QByteArray frames = preparedFrames(pMessage,
+                                             isCompressed ? m_pDeflate->deflateWindowBits() : 0);
+    if (Q_UNLIKELY(m_pSocket->write(frames) != frames.size())) {
+        Q_Q(QWebSocket);
+        setErrorString(QWebSocket::tr("Error writing bytes to socket: %1.")
+                       .arg(m_pSocket->errorString()));
+        Q_EMIT q->error(QAbstractSocket::NetworkError);
+        return 0;
+    }
+    return pMessage->payload.size();
+}
+
 #ifndef QT_NO_SSL
 /*!
     \internal
@@ -284,11 +326,18 @@ void QWebSocketPrivate::ignoreSslErrors()
 QWebSocket *QWebSocketPrivate::upgradeFrom(QTcpSocket *pTcpSocket,
                                            const QWebSocketHandshakeRequest &request,
                                            const QWebSocketHandshakeResponse &response,
-                                           QObject *parent)
+                                           QObject *parent,
+                                           const QSharedPointer<QWebSocketDeflateBudget> &deflateBudget,
+                                           qint64 deflateReserved)
 {
     QWebSocket *pWebSocket = new QWebSocket(pTcpSocket, response.acceptedVersion(), parent);
     if (Q_LIKELY(pWebSocket)) {
         pWebSocket->d_func()->setExtension(response.acceptedExtension());
+        QWebSocketDeflateOptions deflateOptions;
+        if (QWebSocketDeflateOptions::parse(response.acceptedExtension(), &deflateOptions))
+            pWebSocket->d_func()->enableDeflate(deflateOptions, deflateBudget, deflateReserved);
+        else if (deflateBudget && deflateReserved)
+            deflateBudget->release(deflateReserved);
         pWebSocket->d_func()->setOrigin(request.origin());
         pWebSocket->d_func()->setRequestUrl(request.requestUrl());
         pWebSocket->d_func()->setProtocol(response.acceptedProtocol());
@@ -316,15 +365,7 @@ void QWebSocketPrivate::close(QWebSocketProtocol::CloseCode closeCode, QString r
         payload.append(static_cast<const char *>(static_cast<const void *>(&code)), 2);
         if (!reason.isEmpty())
             payload.append(reason.toUtf8());
-        quint32 maskingKey = 0;
-        if (m_mustMask) {
-            maskingKey = generateMaskingKey();
-            QWebSocketProtocol::mask(payload.data(), payload.size(), maskingKey);
-        }
-        QByteArray frame = getFrameHeader(QWebSocketProtocol::OpCodeClose,
-                                          payload.size(), maskingKey, true);
-        frame.append(payload);
-        m_pSocket->write(frame);
+        sendFrame(QWebSocketProtocol::OpCodeClose, payload.constData(), payload.size(), true);
         m_pSocket->flush();
 
         m_isClosingHandshakeSent = true;
@@ -448,18 +489,10 @@ void QWebSocketPrivate::open(const QUrl &url, bool mask)
  */
 void QWebSocketPrivate::ping(const QByteArray &payload)
 {
-    QByteArray payloadTruncated = payload.left(125);
     m_pingTimer.restart();
-    quint32 maskingKey = 0;
-    if (m_mustMask)
-        maskingKey = generateMaskingKey();
-    QByteArray pingFrame = getFrameHeader(QWebSocketProtocol::OpCodePing, payloadTruncated.size(),
-                                          maskingKey, true);
-    if (m_mustMask)
-        QWebSocketProtocol::mask(&payloadTruncated, maskingKey);
-    pingFrame.append(payloadTruncated);
-    qint64 ret = writeFrame(pingFrame);
-    Q_UNUSED(ret);
+    if (Q_LIKELY(m_pSocket))
+        sendFrame(QWebSocketProtocol::OpCodePing, payload.constData(), qMin(payload.size(), 125),
+                  true);
 }
 
 /*!
@@ -519,6 +552,20 @@ void QWebSocketPrivate::setExtension(const QString &extension)
         m_extension = extension;
 }
 
+/*!
+  \internal
+  Enables the permessage-deflate extension negotiated by a server with
+  \a options. The \a reserved bytes of \a budget are released when the
+  socket is destroyed.
+ */
+void QWebSocketPrivate::enableDeflate(const QWebSocketDeflateOptions &options,
+                                      const QSharedPointer<QWebSocketDeflateBudget> &budget,
+                                      qint64 reserved)
+{
+    m_pDeflate.reset(new QWebSocketDeflate(options, true, budget, reserved));
+    m_dataProcessor.setDeflate(m_pDeflate.data());
+}
+
 /*!
   \internal
  */
@@ -674,49 +721,82 @@ QString QWebSocketPrivate::closeReason() const
 
 /*!
  * \internal
+ * Writes the header of a frame to \a header, which must have room for
+ * MAX_HEADER_SIZE_IN_BYTES bytes, and returns its size.
  */
-QByteArray QWebSocketPrivate::getFrameHeader(QWebSocketProtocol::OpCode opCode,
-                                             quint64 payloadLength, quint32 maskingKey,
-                                             bool lastFrame)
-{
-    QByteArray header;
-    quint8 byte = 0x00;
-    bool ok = payloadLength <= 0x7FFFFFFFFFFFFFFFULL;
-
-    if (Q_LIKELY(ok)) {
-        //FIN, RSV1-3, opcode (RSV-1, RSV-2 and RSV-3 are zero)
-        byte = static_cast<quint8>((opCode & 0x0F) | (lastFrame ? 0x80 : 0x00));
-        header.append(static_cast<char>(byte));
-
-        byte = 0x00;
-        if (maskingKey != 0)
-            byte |= 0x80;
-        if (payloadLength <= 125) {
-            byte |= static_cast<quint8>(payloadLength);
-            header.append(static_cast<char>(byte));
-        } else if (payloadLength <= 0xFFFFU) {
-            byte |= 126;
-            header.append(static_cast<char>(byte));
-            quint16 swapped = qToBigEndian<quint16>(static_cast<quint16>(payloadLength));
-            header.append(static_cast<const char *>(static_cast<const void *>(&swapped)), 2);
-        } else if (payloadLength <= 0x7FFFFFFFFFFFFFFFULL) {
-            byte |= 127;
-            header.append(static_cast<char>(byte));
-            quint64 swapped = qToBigEndian<quint64>(payloadLength);
-            header.append(static_cast<const char *>(static_cast<const void *>(&swapped)), 8);
-        }
+int QWebSocketPrivate::writeFrameHeader(char *header, QWebSocketProtocol::OpCode opCode,
+                                        quint64 payloadLength, quint32 maskingKey,
+                                        bool lastFrame, bool compressed)
+{
+    Q_ASSERT(payloadLength <= 0x7FFFFFFFFFFFFFFFULL);
+    uchar *out = reinterpret_cast<uchar *>(header);
+
+    //FIN, RSV1-3, opcode (RSV-1 marks a compressed message, RSV-2 and RSV-3 are zero)
+    *out++ = static_cast<uchar>((opCode & 0x0F) | (lastFrame ? 0x80 : 0x00)
+                                | (compressed ? 0x40 : 0x00));
+
+    const uchar maskBit = (maskingKey != 0) ? 0x80 : 0x00;
+    if (payloadLength <= 125) {
+        *out++ = maskBit | static_cast<uchar>(payloadLength);
+    } else if (payloadLength <= 0xFFFFU) {
+        *out++ = maskBit | 126;
+        qToBigEndian<quint16>(static_cast<quint16>(payloadLength), out);
+        out += 2;
+    } else {
+        *out++ = maskBit | 127;
+        qToBigEndian<quint64>(payloadLength, out);
+        out += 8;
+    }
+
+    if (maskingKey != 0) {
+        qToBigEndian<quint32>(maskingKey, out);
+        out += 4;
+    }
+    return int(reinterpret_cast<char *>(out) - header);
+}
+
+/*!
+ * \internal
+ * Sends one frame carrying the \a size bytes at \a payload, masking it if
+ * required. QTcpSocket has no vectored write, so frames up to
+ * GATHER_SIZE_IN_BYTES are assembled on the stack and handed to the socket
+ * with a single write(). Larger ones are written as header and payload into
+ * the socket's buffer, from which they are sent together. The payload is
+ * only copied when it has to be masked.
+ * \a compressed sets RSV1 on the first frame of a compressed message.
+ * Returns the number of payload bytes written, or -1 on error.
+ */
+qint64 QWebSocketPrivate::sendFrame(QWebSocketProtocol::OpCode opCode, const char *payload,
+                                    quint64 size, bool lastFrame, bool compressed)
+{
+    Q_ASSERT(m_pSocket);
+    const quint32 maskingKey = m_mustMask ? generateMaskingKey() : 0;
+
+    char frame[MAX_HEADER_SIZE_IN_BYTES + GATHER_SIZE_IN_BYTES];
+    const int headerSize = writeFrameHeader(frame, opCode, size, maskingKey, lastFrame,
+                                            compressed);
 
-        if (maskingKey != 0) {
-            const quint32 mask = qToBigEndian<quint32>(maskingKey);
-            header.append(static_cast<const char *>(static_cast<const void *>(&mask)),
-                          sizeof(quint32));
+    if (size <= quint64(GATHER_SIZE_IN_BYTES)) {
+        if (size) {
+            memcpy(frame + headerSize, payload, size);
+            if (maskingKey)
+                QWebSocketProtocol::mask(frame + headerSize, size, maskingKey);
         }
-    } else {
-        setErrorString(QStringLiteral("WebSocket::getHeader: payload too big!"));
-        Q_EMIT q_ptr->error(QAbstractSocket::DatagramTooLargeError);
+        const qint64 frameSize = headerSize + qint64(size);
+        return m_pSocket->write(frame, frameSize) == frameSize ? qint64(size) : -1;
     }
 
-    return header;
+    if (m_pSocket->write(frame, headerSize) != headerSize)
+        return -1;
+    qint64 written;
+    if (maskingKey) {
+        QByteArray masked(payload, int(size));
+        QWebSocketProtocol::mask(masked.data(), size, maskingKey);
+        written = m_pSocket->write(masked);
+    } else {
+        written = m_pSocket->write(payload, qint64(size));
+    }
+    return written == qint64(size) ? written : -1;
 }
 
 /*!
@@ -732,11 +812,15 @@ qint64 QWebSocketPrivate::doWriteFrames(const QByteArray &data, bool isBinary)
     const QWebSocketProtocol::OpCode firstOpCode = isBinary ?
                 QWebSocketProtocol::OpCodeBinary : QWebSocketProtocol::OpCodeText;
 
-    int numFrames = data.size() / FRAME_SIZE_IN_BYTES;
-    QByteArray tmpData(data);
-    tmpData.detach();
-    char *payload = tmpData.data();
-    quint64 sizeLeft = quint64(data.size()) % FRAME_SIZE_IN_BYTES;
+    //with permessage-deflate the message is compressed as a whole and then fragmented;
+    //small messages are not worth it and are sent as they are
+    const bool compressed = m_pDeflate && (data.size() >= MIN_DEFLATE_SIZE_IN_BYTES)
+            && m_pDeflate->compress(data.constData(), data.size(), &m_deflateBuffer);
+    const QByteArray &message = compressed ? m_deflateBuffer : data;
+
+    int numFrames = message.size() / FRAME_SIZE_IN_BYTES;
+    const char *payload = message.constData();
+    quint64 sizeLeft = quint64(message.size()) % FRAME_SIZE_IN_BYTES;
     if (Q_LIKELY(sizeLeft))
         ++numFrames;
 
@@ -745,14 +829,9 @@ qint64 QWebSocketPrivate::doWriteFrames(const QByteArray &data, bool isBinary)
     if (Q_UNLIKELY(numFrames == 0))
         numFrames = 1;
     quint64 currentPosition = 0;
-    qint64 bytesWritten = 0;
-    quint64 bytesLeft = data.size();
+    quint64 bytesLeft = message.size();
 
     for (int i = 0; i < numFrames; ++i) {
-        quint32 maskingKey = 0;
-        if (m_mustMask)
-            maskingKey = generateMaskingKey();
-
         const bool isLastFrame = (i == (numFrames - 1));
         const bool isFirstFrame = (i == 0);
 
@@ -760,154 +839,130 @@ qint64 QWebSocketPrivate::doWriteFrames(const QByteArray &data, bool isBinary)
         const QWebSocketProtocol::OpCode opcode = isFirstFrame ? firstOpCode
                                                                : QWebSocketProtocol::OpCodeContinue;
 
-        //write header
-        bytesWritten += m_pSocket->write(getFrameHeader(opcode, size, maskingKey, isLastFrame));
-
-        //write payload
-        if (Q_LIKELY(size > 0)) {
-            char *currentData = payload + currentPosition;
-            if (m_mustMask)
-                QWebSocketProtocol::mask(currentData, size, maskingKey);
-            qint64 written = m_pSocket->write(currentData, static_cast<qint64>(size));
-            if (Q_LIKELY(written > 0)) {
-                bytesWritten += written;
-                payloadWritten += written;
-            } else {
-                m_pSocket->flush();
-                setErrorString(QWebSocket::tr("Error writing bytes to socket: %1.")
-                               .arg(m_pSocket->errorString()));
-                Q_EMIT q->error(QAbstractSocket::NetworkError);
-                break;
-            }
+        const qint64 written = sendFrame(opcode, payload + currentPosition, size, isLastFrame,
+                                         compressed && isFirstFrame);
+        if (Q_LIKELY(written >= 0)) {
+            payloadWritten += written;
+        } else {
+            m_pSocket->flush();
+            setErrorString(QWebSocket::tr("Error writing bytes to socket: %1.")
+                           .arg(m_pSocket->errorString()));
+            Q_EMIT q->error(QAbstractSocket::NetworkError);
+            break;
         }
         currentPosition += size;
         bytesLeft -= size;
     }
-    if (Q_UNLIKELY(payloadWritten != data.size())) {
+    if (Q_UNLIKELY(payloadWritten != message.size())) {
         setErrorString(QWebSocket::tr("Bytes written %1 != %2.")
-                       .arg(payloadWritten).arg(data.size()));
+                       .arg(payloadWritten).arg(message.size()));
         Q_EMIT q->error(QAbstractSocket::NetworkError);
+        return payloadWritten;
     }
-    return payloadWritten;
+    if (compressed && m_deflateBuffer.capacity() > MAX_DEFLATE_BUFFER_IN_BYTES)
+        m_deflateBuffer = QByteArray();
+    //report the size of the message as given, not of what went over the wire
+    return data.size();
 }
 
 /*!
-    \internal
- */
-quint32 QWebSocketPrivate::generateMaskingKey() const
-{
-    return m_pMaskGenerator->nextMask();
-}
-
-/*!
-    \internal
+ * \internal
+ * Returns the unmasked frames of the message \a data, fragmented like
+ * doWriteFrames() does. \a compressed sets RSV1 on the first frame.
  */
-QByteArray QWebSocketPrivate::generateKey() const
+QByteArray QWebSocketPrivate::encodeFrames(const QByteArray &data, bool isBinary,
+                                           bool compressed)
 {
-    QByteArray key;
+    const quint64 size = quint64(data.size());
+    const int numFrames = qMax(1, int((size + FRAME_SIZE_IN_BYTES - 1) / FRAME_SIZE_IN_BYTES));
+    QByteArray frames;
+    frames.reserve(data.size() + numFrames * MAX_HEADER_SIZE_IN_BYTES);
 
-    for (int i = 0; i < 4; ++i) {
-        const quint32 tmp = m_pMaskGenerator->nextMask();
-        key.append(static_cast<const char *>(static_cast<const void *>(&tmp)), sizeof(quint32));
+    quint64 position = 0;
+    for (int i = 0; i < numFrames; ++i) {
+        const bool isFirstFrame = (i == 0);
+        const quint64 frameSize = qMin(size - position, FRAME_SIZE_IN_BYTES);
+        const QWebSocketProtocol::OpCode opCode = !isFirstFrame
+                ? QWebSocketProtocol::OpCodeContinue
+                : (isBinary ? QWebSocketProtocol::OpCodeBinary : QWebSocketProtocol::OpCodeText);
+
+        char header[MAX_HEADER_SIZE_IN_BYTES];
+        const int headerSize = writeFrameHeader(header, opCode, frameSize, 0,
+                                                i == (numFrames - 1), compressed && isFirstFrame);
+        frames.append(header, headerSize);
+        frames.append(data.constData() + position, int(frameSize));
+        position += frameSize;
     }
-
-    return key.toBase64();
+    return frames;
 }
 
-
 /*!
-    \internal
+ * \internal
+ * Returns the server frames of the prepared message \a pMessage, compressed
+ * with a window of \a deflateWindowBits and no context takeover, or not
+ * compressed if \a deflateWindowBits is 0. They are built by the first
+ * caller and cached in the message.
  */
-QString QWebSocketPrivate::calculateAcceptKey(const QByteArray &key) const
-{
-    const QByteArray tmpKey = key + QByteArrayLiteral("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
-    const QByteArray hash = QCryptographicHash::hash(tmpKey, QCryptographicHash::Sha1).toBase64();
-    return QString::fromLatin1(hash);
+QByteArray QWebSocketPrivate::preparedFrames(QWebSocketPreparedMessagePrivate *pMessage,
+                                             int deflateWindowBits)
+{
+    Q_ASSERT(pMessage);
+    QMutexLocker locker(&pMessage->mutex);
+    QHash<int, QByteArray>::const_iterator it = pMessage->frames.constFind(deflateWindowBits);
+    if (it != pMessage->frames.constEnd())
+        return it.value();
+
+    QByteArray frames;
+    bool isEncoded = false;
+    if (deflateWindowBits > 0) {
+        QWebSocketDeflateOptions options;
+        options.serverNoContextTakeover = true;
+        options.serverMaxWindowBits = deflateWindowBits;
+        QWebSocketDeflate deflate(options, true);
+        QByteArray compressed;
+        if (deflate.compress(pMessage->payload.constData(), pMessage->payload.size(),
+                             &compressed)) {
+            frames = encodeFrames(compressed, pMessage->isBinary, true);
+            isEncoded = true;
+        }
+    }
+    if (!isEncoded)
+        frames = encodeFrames(pMessage->payload, pMessage->isBinary, false);
+    pMessage->frames.insert(deflateWindowBits, frames);
+    return frames;
 }
 
 /*!
     \internal
  */
-qint64 QWebSocketPrivate::writeFrames(const QList<QByteArray> &frames)
+quint32 QWebSocketPrivate::generateMaskingKey() const
 {
-    qint64 written = 0;
-    if (Q_LIKELY(m_pSocket)) {
-        QList<QByteArray>::const_iterator it;
-        for (it = frames.cbegin(); it < frames.cend(); ++it)
-            written += writeFrame(*it);
-    }
-    return written;
+    return m_pMaskGenerator->nextMask();
 }
 
 /*!
     \internal
  */
-qint64 QWebSocketPrivate::writeFrame(const QByteArray &frame)
+QByteArray QWebSocketPrivate::generateKey() const
 {
-    qint64 written = 0;
-    if (Q_LIKELY(m_pSocket))
-        written = m_pSocket->write(frame);
-    return written;
+    //taken from the default stream even with a custom mask generator,
+    //the key has to be unpredictable as well
+    char key[16];
+    QDefaultMaskGenerator::generate(key, sizeof(key));
+    return QByteArray::fromRawData(key, sizeof(key)).toBase64();
 }
 
+
 /*!
     \internal
  */
-QString readLine(QTcpSocket *pSocket)
+QString QWebSocketPrivate::calculateAcceptKey(const QByteArray &key) const
 {
-    Q_ASSERT(pSocket);
-    QString line;
-    char c;
-    while (pSocket->getChar(&c)) {
-        if (c == char('\r')) {
-            pSocket->getChar(&c);
-            break;
-        } else {
-            line.append(QChar::fromLatin1(c));
-        }
-    }
-    return line;
-}
-
-// this function is a copy of QHttpNetworkReplyPrivate::parseStatus
-static bool parseStatusLine(const QByteArray &status, int *majorVersion, int *minorVersion,
-                            int *statusCode, QString *reasonPhrase)
-{
-    // from RFC 2616:
-    //        Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF
-    //        HTTP-Version   = "HTTP" "/" 1*DIGIT "." 1*DIGIT
-    // that makes: 'HTTP/n.n xxx Message'
-    // byte count:  0123456789012
-
-    static const int minLength = 11;
-    static const int dotPos = 6;
-    static const int spacePos = 8;
-    static const char httpMagic[] = "HTTP/";
-
-    if (status.length() < minLength
-        || !status.startsWith(httpMagic)
-        || status.at(dotPos) != '.'
-        || status.at(spacePos) != ' ') {
-        // I don't know how to parse this status line
-        return false;
-    }
-
-    // optimize for the valid case: defer checking until the end
-    *majorVersion = status.at(dotPos - 1) - '0';
-    *minorVersion = status.at(dotPos + 1) - '0';
-
-    int i = spacePos;
-    int j = status.indexOf(' ', i + 1); // j == -1 || at(j) == ' ' so j+1 == 0 && j+1 <= length()
-    const QByteArray code = status.mid(i + 1, j - i - 1);
-
-    bool ok;
-    *statusCode = code.toInt(&ok);
-    *reasonPhrase = QString::fromLatin1(status.constData() + j + 1);
-
-    return ok && uint(*majorVersion) <= 9 && uint(* minorVersion) <= 9;
+    const QByteArray tmpKey = key + QByteArrayLiteral("258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+    const QByteArray hash = QCryptographicHash::hash(tmpKey, QCryptographicHash::Sha1).toBase64();
+    return QString::fromLatin1(hash);
 }
 
-
 //called on the client for a server handshake response
 /*!
     \internal
@@ -918,65 +973,46 @@ void QWebSocketPrivate::processHandshake(QTcpSocket *pSocket)
     if (Q_UNLIKELY(!pSocket))
         return;
     // Reset handshake on a new connection.
-    if (m_handshakeState == AllDoneState)
-        m_handshakeState = NothingDoneState;
+    if (m_handshakeParser.status() != QWebSocketHandshakeParser::Incomplete)
+        m_handshakeParser.reset();
 
-    QString errorDescription;
+    //only what belongs to the handshake is read, frames may follow right away
+    const QByteArray data = pSocket->peek(pSocket->bytesAvailable());
+    pSocket->read(m_handshakeParser.parse(data.constData(), data.size()));
 
-    switch (m_handshakeState) {
-    case NothingDoneState:
-        m_headers.clear();
-        m_handshakeState = ReadingStatusState;
-        // no break
-    case ReadingStatusState:
-        if (!pSocket->canReadLine())
-            return;
-        m_statusLine = pSocket->readLine();
-        if (Q_UNLIKELY(!parseStatusLine(m_statusLine, &m_httpMajorVersion, &m_httpMinorVersion, &m_httpStatusCode, &m_httpStatusMessage))) {
-            errorDescription = QWebSocket::tr("Invalid statusline in response: %1.").arg(QString::fromLatin1(m_statusLine));
-            break;
-        }
-        m_handshakeState = ReadingHeaderState;
-        // no break
-    case ReadingHeaderState:
-        while (pSocket->canReadLine()) {
-            QString headerLine = readLine(pSocket);
-            const QStringList headerField = headerLine.split(QStringLiteral(": "),
-                                                             QString::SkipEmptyParts);
-            if (headerField.size() == 2) {
-                m_headers.insertMulti(headerField[0].toLower(), headerField[1]);
-            }
-            if (headerField.isEmpty()) {
-                m_handshakeState = ParsingHeaderState;
-                break;
-            }
-        }
+    QString errorDescription;
+    bool ok = false;
 
-        if (m_handshakeState != ParsingHeaderState) {
-            if (pSocket->atEnd()) {
-                errorDescription = QWebSocket::tr("QWebSocketPrivate::processHandshake: Connection closed while reading header.");
-                break;
-            }
+    switch (m_handshakeParser.status()) {
+    case QWebSocketHandshakeParser::Incomplete:
+        if (pSocket->state() != QAbstractSocket::UnconnectedState)
             return;
-        }
-        // no break
-    case ParsingHeaderState: {
-        const QString acceptKey = m_headers.value(QStringLiteral("sec-websocket-accept"), QString());
-        const QString upgrade = m_headers.value(QStringLiteral("upgrade"), QString());
-        const QString connection = m_headers.value(QStringLiteral("connection"), QString());
+        errorDescription = QWebSocket::tr("QWebSocketPrivate::processHandshake: Connection closed while reading header.");
+        break;
+    case QWebSocketHandshakeParser::Invalid:
+        errorDescription = QWebSocket::tr("QWebSocketPrivate::processHandshake: Invalid handshake response: %1.")
+                .arg(m_handshakeParser.errorString());
+        break;
+    case QWebSocketHandshakeParser::Complete: {
+        const QHash<QString, QString> headers = m_handshakeParser.headers();
+        const int httpStatusCode = m_handshakeParser.statusCode();
+        const int httpMajorVersion = m_handshakeParser.httpMajorVersion();
+        const int httpMinorVersion = m_handshakeParser.httpMinorVersion();
+        const QString acceptKey = headers.value(QStringLiteral("sec-websocket-accept"), QString());
+        const QString upgrade = headers.value(QStringLiteral("upgrade"), QString());
+        const QString connection = headers.value(QStringLiteral("connection"), QString());
 //        unused for the moment
-//        const QString extensions = m_headers.value(QStringLiteral("sec-websocket-extensions"),
+//        const QString extensions = headers.value(QStringLiteral("sec-websocket-extensions"),
 //                                                 QString());
-//        const QString protocol = m_headers.value(QStringLiteral("sec-websocket-protocol"),
+//        const QString protocol = headers.value(QStringLiteral("sec-websocket-protocol"),
 //                                               QString());
-        const QString version = m_headers.value(QStringLiteral("sec-websocket-version"), QString());
+        const QString version = headers.value(QStringLiteral("sec-websocket-version"), QString());
 
-        bool ok = false;
-        if (Q_LIKELY(m_httpStatusCode == 101)) {
+        if (Q_LIKELY(httpStatusCode == 101)) {
             //HTTP/x.y 101 Switching Protocols
             //TODO: do not check the httpStatusText right now
             ok = !(acceptKey.isEmpty() ||
-                   (m_httpMajorVersion < 1 || m_httpMinorVersion < 1) ||
+                   (httpMajorVersion < 1 || httpMinorVersion < 1) ||
                    (upgrade.toLower() != QStringLiteral("websocket")) ||
                    (connection.toLower() != QStringLiteral("upgrade")));
             if (ok) {
@@ -989,9 +1025,11 @@ void QWebSocketPrivate::processHandshake(QTcpSocket *pSocket)
             } else {
                 errorDescription =
                     QWebSocket::tr("QWebSocketPrivate::processHandshake: Invalid statusline in response: %1.")
-                        .arg(QString::fromLatin1(m_statusLine));
+                        .arg(QStringLiteral("HTTP/%1.%2 %3 %4").arg(httpMajorVersion)
+                             .arg(httpMinorVersion).arg(httpStatusCode)
+                             .arg(m_handshakeParser.statusMessage()));
             }
-        } else if (m_httpStatusCode == 400) {
+        } else if (httpStatusCode == 400) {
             //HTTP/1.1 400 Bad Request
             if (!version.isEmpty()) {
                 const QStringList versions = version.split(QStringLiteral(", "),
@@ -1014,26 +1052,21 @@ void QWebSocketPrivate::processHandshake(QTcpSocket *pSocket)
         } else {
             errorDescription =
                     QWebSocket::tr("QWebSocketPrivate::processHandshake: Unhandled http status code: %1 (%2).")
-                        .arg(m_httpStatusCode).arg(m_httpStatusMessage);
+                        .arg(httpStatusCode).arg(m_handshakeParser.statusMessage());
         }
-        if (ok)
-            m_handshakeState = AllDoneState;
         break;
     }
-    case AllDoneState:
-        Q_UNREACHABLE();
-        break;
     }
 
-    if (m_handshakeState == AllDoneState) {
+    if (ok) {
         // handshake succeeded
         setSocketState(QAbstractSocket::ConnectedState);
         Q_EMIT q->connected();
     } else {
-        // handshake failed
-        m_handshakeState = AllDoneState;
+        // handshake failed; drop the rest, it is not made of frames
         setErrorString(errorDescription);
         Q_EMIT q->error(QAbstractSocket::ConnectionRefusedError);
+        pSocket->abort();
     }
 }
 
@@ -1109,10 +1142,14 @@ void QWebSocketPrivate::processData()
 {
     Q_ASSERT(m_pSocket);
     while (m_pSocket->bytesAvailable()) {
-        if (state() == QAbstractSocket::ConnectingState)
+        if (state() == QAbstractSocket::ConnectingState) {
             processHandshake(m_pSocket);
-        else
+        } else {
+            // Consumes everything available, unless it stops at an error or
+            // is already running further up the stack.
             m_dataProcessor.process(m_pSocket);
+            break;
+        }
     }
 }
 
@@ -1122,16 +1159,7 @@ void QWebSocketPrivate::processData()
 void QWebSocketPrivate::processPing(const QByteArray &data)
 {
     Q_ASSERT(m_pSocket);
-    quint32 maskingKey = 0;
-    if (m_mustMask)
-        maskingKey = generateMaskingKey();
-    m_pSocket->write(getFrameHeader(QWebSocketProtocol::OpCodePong, data.size(), maskingKey, true));
-    if (data.size() > 0) {
-        QByteArray maskedData = data;
-        if (m_mustMask)
-            QWebSocketProtocol::mask(&maskedData, maskingKey);
-        m_pSocket->write(maskedData);
-    }
+    sendFrame(QWebSocketProtocol::OpCodePong, data.constData(), data.size(), true);
 }
 
 /*!
@@ -1346,6 +1374,14 @@ qint64 QWebSocketPrivate::readBufferSize() const
     return m_readBufferSize;
 }
 
+/*!
+    \internal
+ */
+qint64 QWebSocketPrivate::bytesToWrite() const
+{
+    return m_pSocket ? m_pSocket->bytesToWrite() : 0;
+}
+
 /*!
     \internal
  */
@@ -60,12 +60,18 @@
 
 #include "qwebsocketprotocol.h"
 #include "qwebsocketdataprocessor_p.h"
+#include "qwebsocketdeflate_p.h"
+#include "qwebsockethandshakeparser_p.h"
+#include "qwebsocketpreparedmessage.h"
 #include "qdefaultmaskgenerator_p.h"
 
+class QHttpConnection;
+
 QT_BEGIN_NAMESPACE
 
 class QWebSocketHandshakeRequest;
 class QWebSocketHandshakeResponse;
+class QWebSocketPreparedMessagePrivate;
 class QTcpSocket;
 class QWebSocket;
 class QMaskGenerator;
@@ -119,6 +125,7 @@ public:
     void setMaskGenerator(const QMaskGenerator *maskGenerator);
     const QMaskGenerator *maskGenerator() const;
     qint64 readBufferSize() const;
+    qint64 bytesToWrite() const;
     void resume();
     void setPauseMode(QAbstractSocket::PauseModes pauseMode);
     void setReadBufferSize(qint64 size);
@@ -135,6 +142,7 @@ public:
 
     qint64 sendTextMessage(const QString &message);
     qint64 sendBinaryMessage(const QByteArray &data);
+    qint64 sendPreparedMessage(const QWebSocketPreparedMessage &message);
 
 #ifndef QT_NO_SSL
     void ignoreSslErrors(const QList<QSslError> &errors);
@@ -159,6 +167,8 @@ private:
     void setOrigin(const QString &origin);
     void setProtocol(const QString &protocol);
     void setExtension(const QString &extension);
+    void enableDeflate(const QWebSocketDeflateOptions &options,
+                       const QSharedPointer<QWebSocketDeflateBudget> &budget, qint64 reserved);
     void enableMasking(bool enable);
     void setSocketState(QAbstractSocket::SocketState state);
     void setErrorString(const QString &errorString);
@@ -173,12 +183,16 @@ private:
     void processStateChanged(QAbstractSocket::SocketState socketState);
 
     qint64 doWriteFrames(const QByteArray &data, bool isBinary) Q_REQUIRED_RESULT;
+    static QByteArray encodeFrames(const QByteArray &data, bool isBinary, bool compressed);
+    static QByteArray preparedFrames(QWebSocketPreparedMessagePrivate *pMessage,
+                                     int deflateWindowBits);
 
     void makeConnections(const QTcpSocket *pTcpSocket);
     void releaseConnections(const QTcpSocket *pTcpSocket);
 
-    QByteArray getFrameHeader(QWebSocketProtocol::OpCode opCode, quint64 payloadLength,
-                              quint32 maskingKey, bool lastFrame);
+    static int writeFrameHeader(char *header, QWebSocketProtocol::OpCode opCode,
+                                quint64 payloadLength, quint32 maskingKey, bool lastFrame,
+                                bool compressed = false);
     QString calculateAcceptKey(const QByteArray &key) const;
     QString createHandShakeRequest(QString resourceName,
                                    QString host,
@@ -190,12 +204,15 @@ private:
     static QWebSocket *upgradeFrom(QTcpSocket *tcpSocket,
                                    const QWebSocketHandshakeRequest &request,
                                    const QWebSocketHandshakeResponse &response,
-                                   QObject *parent = Q_NULLPTR) Q_REQUIRED_RESULT;
+                                   QObject *parent = Q_NULLPTR,
+                                   const QSharedPointer<QWebSocketDeflateBudget> &deflateBudget =
+                                       QSharedPointer<QWebSocketDeflateBudget>(),
+                                   qint64 deflateReserved = 0) Q_REQUIRED_RESULT;
 
     quint32 generateMaskingKey() const;
     QByteArray generateKey() const;
-    qint64 writeFrames(const QList<QByteArray> &frames) Q_REQUIRED_RESULT;
-    qint64 writeFrame(const QByteArray &frame) Q_REQUIRED_RESULT;
+    qint64 sendFrame(QWebSocketProtocol::OpCode opCode, const char *payload, quint64 size,
+                     bool lastFrame, bool compressed = false);
 
     QTcpSocket *m_pSocket;
     QString m_errorString;
@@ -222,25 +239,17 @@ private:
     QTime m_pingTimer;
 
     QWebSocketDataProcessor m_dataProcessor;
+    QScopedPointer<QWebSocketDeflate> m_pDeflate;
+    QByteArray m_deflateBuffer;
     QWebSocketConfiguration m_configuration;
 
     QMaskGenerator *m_pMaskGenerator;
     QDefaultMaskGenerator m_defaultMaskGenerator;
 
-    enum HandshakeState {
-        NothingDoneState,
-        ReadingStatusState,
-        ReadingHeaderState,
-        ParsingHeaderState,
-        AllDoneState
-    } m_handshakeState;
-    QByteArray m_statusLine;
-    int m_httpStatusCode;
-    int m_httpMajorVersion, m_httpMinorVersion;
-    QString m_httpStatusMessage;
-    QMap<QString, QString> m_headers;
+    QWebSocketHandshakeParser m_handshakeParser;
 
     friend class QWebSocketServerPrivate;
+    friend class ::QHttpConnection;
 };
 
 QT_END_NAMESPACE
@@ -34,8 +34,9 @@
     \class QWebSocketDataProcessor
     The class QWebSocketDataProcessor is responsible for reading, validating and
     interpreting data from a WebSocket.
-    It reads data from a QIODevice, validates it against RFC 6455, and parses it into
-    frames (data, control).
+    It reads data from a QIODevice into a receive buffer, validates it against RFC 6455,
+    and parses it into frames (data, control). All frames in the buffer are decoded in
+    one go; a frame cut off at its end is continued by the next call to process().
     It emits signals that correspond to the type of the frame: textFrameReceived(),
     binaryFrameReceived(), textMessageReceived(), binaryMessageReceived(), pingReceived(),
     pongReceived() and closeReceived().
@@ -49,6 +50,7 @@
     \internal
 */
 #include "qwebsocketdataprocessor_p.h"
+#include "qwebsocketdeflate_p.h"
 #include "qwebsocketprotocol.h"
 #include "qwebsocketprotocol_p.h"
 #include "qwebsocketframe_p.h"
@@ -57,11 +59,34 @@
 #include <QtCore/QTextCodec>
 #include <QtCore/QTextDecoder>
 #include <QtCore/QDebug>
+#include <QtCore/QThreadStorage>
 
 #include <limits.h>
 
 QT_BEGIN_NAMESPACE
 
+namespace {
+
+// Receive buffer shared by the processors of a thread. Payloads are only
+// referenced in place while their frame is being dispatched.
+struct ReceiveBuffer
+{
+    ReceiveBuffer() : data(64 * 1024, Qt::Uninitialized), inUse(false) {}
+
+    QByteArray data;
+    bool inUse;
+};
+
+ReceiveBuffer *receiveBuffer()
+{
+    static QThreadStorage<ReceiveBuffer *> buffers;
+    if (!buffers.hasLocalData())
+        buffers.setLocalData(new ReceiveBuffer);
+    return buffers.localData();
+}
+
+}
+
 /*!
     \internal
  */
@@ -78,7 +103,12 @@ QWebSocketDataProcessor::QWebSocketDataProcessor(QObject *parent) :
     m_textMessage(),
     m_payloadLength(0),
     m_pConverterState(Q_NULLPTR),
-    m_pTextCodec(QTextCodec::codecForName("UTF-8"))
+    m_pTextCodec(QTextCodec::codecForName("UTF-8")),
+    m_frame(),
+    m_isProcessing(false),
+    m_pDeflate(Q_NULLPTR),
+    m_isCompressed(false),
+    m_inflated()
 {
     clear();
 }
@@ -111,85 +141,186 @@ quint64 QWebSocketDataProcessor::maxFrameSize()
     return MAX_FRAME_SIZE_IN_BYTES;
 }
 
+/*!
+    Sets the permessage-deflate codec negotiated for the connection; frames
+    with RSV1 set are rejected when \a pDeflate is null.
+    The processor does not take ownership of \a pDeflate.
+
+    \internal
+ */
+void QWebSocketDataProcessor::setDeflate(QWebSocketDeflate *pDeflate)
+{
+    m_pDeflate = pDeflate;
+}
+
 /*!
     \internal
  */
 void QWebSocketDataProcessor::process(QIODevice *pIoDevice)
 {
-    bool isDone = false;
+    // A slot running a nested event loop must not get this connection's
+    // data parsed out of order.
+    if (m_isProcessing)
+        return;
+    m_isProcessing = true;
 
-    while (!isDone) {
-        QWebSocketFrame frame = QWebSocketFrame::readFrame(pIoDevice);
-        if (Q_LIKELY(frame.isValid())) {
-            if (frame.isControlFrame()) {
-                isDone = processControlFrame(frame);
-            } else {
-                //we have a dataframe; opcode can be OC_CONTINUE, OC_TEXT or OC_BINARY
-                if (Q_UNLIKELY(!m_isFragmented && frame.isContinuationFrame())) {
-                    clear();
-                    Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
-                                            tr("Received Continuation frame, while there is " \
-                                               "nothing to continue."));
-                    return;
-                }
-                if (Q_UNLIKELY(m_isFragmented && frame.isDataFrame() &&
-                               !frame.isContinuationFrame())) {
-                    clear();
-                    Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
-                                            tr("All data frames after the initial data frame " \
-                                               "must have opcode 0 (continuation)."));
-                    return;
-                }
-                if (!frame.isContinuationFrame()) {
-                    m_opCode = frame.opCode();
-                    m_isFragmented = !frame.isFinalFrame();
-                }
-                quint64 messageLength = (quint64)(m_opCode == QWebSocketProtocol::OpCodeText)
-                        ? m_textMessage.length()
-                        : m_binaryMessage.length();
-                if (Q_UNLIKELY((messageLength + quint64(frame.payload().length())) >
-                               MAX_MESSAGE_SIZE_IN_BYTES)) {
-                    clear();
-                    Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeTooMuchData,
-                                            tr("Received message is too big."));
-                    return;
-                }
+    // Another processor of this thread may be in a nested event loop too.
+    ReceiveBuffer *shared = receiveBuffer();
+    QByteArray local;
+    QByteArray *buffer = &local;
+    if (Q_LIKELY(!shared->inUse)) {
+        shared->inUse = true;
+        buffer = &shared->data;
+    } else {
+        local.resize(shared->data.size());
+    }
 
-                if (m_opCode == QWebSocketProtocol::OpCodeText) {
-                    QString frameTxt = m_pTextCodec->toUnicode(frame.payload().constData(),
-                                                               frame.payload().size(),
-                                                               m_pConverterState);
-                    bool failed = (m_pConverterState->invalidChars != 0)
-                            || (frame.isFinalFrame() && (m_pConverterState->remainingChars != 0));
-                    if (Q_UNLIKELY(failed)) {
-                        clear();
-                        Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeWrongDatatype,
-                                                tr("Invalid UTF-8 code encountered."));
-                        return;
-                    } else {
-                        m_textMessage.append(frameTxt);
-                        Q_EMIT textFrameReceived(frameTxt, frame.isFinalFrame());
-                    }
-                } else {
-                    m_binaryMessage.append(frame.payload());
-                    Q_EMIT binaryFrameReceived(frame.payload(), frame.isFinalFrame());
-                }
+    while (pIoDevice->bytesAvailable() > 0) {
+        const qint64 bytesRead = pIoDevice->read(buffer->data(), buffer->size());
+        if (bytesRead <= 0 || !processBuffer(buffer->data(), int(bytesRead)))
+            break;
+    }
 
-                if (frame.isFinalFrame()) {
-                    if (m_opCode == QWebSocketProtocol::OpCodeText)
-                        Q_EMIT textMessageReceived(m_textMessage);
-                    else
-                        Q_EMIT binaryMessageReceived(m_binaryMessage);
-                    clear();
-                    isDone = true;
-                }
-            }
-        } else {
-            Q_EMIT errorEncountered(frame.closeCode(), frame.closeReason());
+    if (buffer == &shared->data)
+        shared->inUse = false;
+    m_isProcessing = false;
+}
+
+/*!
+    Parses and dispatches all frames in the \a size bytes at \a data.
+    Returns false if an error was encountered.
+
+    \internal
+ */
+bool QWebSocketDataProcessor::processBuffer(char *data, int size)
+{
+    while (size > 0) {
+        const int used = m_frame.feed(data, size);
+        data += used;
+        size -= used;
+        if (!m_frame.isComplete())
+            break;
+
+        // Dispatch a frame of its own, the slots may call clear().
+        QWebSocketFrame frame;
+        frame.swap(m_frame);
+        if (!processFrame(frame))
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Dispatches a complete \a frame. Returns false if an error was encountered.
+
+    \internal
+ */
+bool QWebSocketDataProcessor::processFrame(const QWebSocketFrame &frame)
+{
+    if (Q_UNLIKELY(!frame.isValid())) {
+        Q_EMIT errorEncountered(frame.closeCode(), frame.closeReason());
+        clear();
+        return false;
+    }
+
+    if (frame.isControlFrame())
+        return processControlFrame(frame);
+
+    //we have a dataframe; opcode can be OC_CONTINUE, OC_TEXT or OC_BINARY
+    if (Q_UNLIKELY(!m_isFragmented && frame.isContinuationFrame())) {
+        clear();
+        Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
+                                tr("Received Continuation frame, while there is " \
+                                   "nothing to continue."));
+        return false;
+    }
+    if (Q_UNLIKELY(m_isFragmented && frame.isDataFrame() &&
+                   !frame.isContinuationFrame())) {
+        clear();
+        Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
+                                tr("All data frames after the initial data frame " \
+                                   "must have opcode 0 (continuation)."));
+        return false;
+    }
+    //RSV1 marks the first frame of a compressed message (RFC 7692)
+    if (Q_UNLIKELY(frame.rsv1() && (!m_pDeflate || frame.isContinuationFrame()))) {
+        clear();
+        Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
+                                tr("Rsv field is non-zero"));
+        return false;
+    }
+    if (!frame.isContinuationFrame()) {
+        m_opCode = frame.opCode();
+        m_isFragmented = !frame.isFinalFrame();
+        m_isCompressed = frame.rsv1();
+    }
+    quint64 messageLength = (quint64)(m_opCode == QWebSocketProtocol::OpCodeText)
+            ? m_textMessage.length()
+            : m_binaryMessage.length();
+    if (Q_UNLIKELY((messageLength + quint64(frame.payloadSize())) >
+                   MAX_MESSAGE_SIZE_IN_BYTES)) {
+        clear();
+        Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeTooMuchData,
+                                tr("Received message is too big."));
+        return false;
+    }
+
+    const char *payloadData = frame.payloadData();
+    int payloadSize = frame.payloadSize();
+    if (m_isCompressed) {
+        const quint64 maxInflatedSize = qMin(MAX_MESSAGE_SIZE_IN_BYTES,
+                                             quint64(m_pDeflate->maxInflatedSize()));
+        m_inflated.resize(0);
+        const QWebSocketDeflate::DecompressResult result =
+                messageLength > maxInflatedSize
+                ? QWebSocketDeflate::TooMuchData
+                : m_pDeflate->decompress(payloadData, payloadSize, frame.isFinalFrame(),
+                                         &m_inflated, maxInflatedSize - messageLength);
+        if (Q_UNLIKELY(result == QWebSocketDeflate::TooMuchData)) {
+            clear();
+            Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeTooMuchData,
+                                    tr("Received message is too big."));
+            return false;
+        }
+        if (Q_UNLIKELY(result != QWebSocketDeflate::Decompressed)) {
             clear();
-            isDone = true;
+            Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
+                                    tr("Received message could not be decompressed."));
+            return false;
         }
+        payloadData = m_inflated.constData();
+        payloadSize = m_inflated.size();
     }
+
+    if (m_opCode == QWebSocketProtocol::OpCodeText) {
+        // Decoded straight from the receive buffer, without copying the payload.
+        QString frameTxt = m_pTextCodec->toUnicode(payloadData, payloadSize,
+                                                   m_pConverterState);
+        bool failed = (m_pConverterState->invalidChars != 0)
+                || (frame.isFinalFrame() && (m_pConverterState->remainingChars != 0));
+        if (Q_UNLIKELY(failed)) {
+            clear();
+            Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeWrongDatatype,
+                                    tr("Invalid UTF-8 code encountered."));
+            return false;
+        } else {
+            m_textMessage.append(frameTxt);
+            Q_EMIT textFrameReceived(frameTxt, frame.isFinalFrame());
+        }
+    } else {
+        const QByteArray payload = m_isCompressed ? m_inflated : frame.payload();
+        m_binaryMessage.append(payload);
+        Q_EMIT binaryFrameReceived(payload, frame.isFinalFrame());
+    }
+
+    if (frame.isFinalFrame()) {
+        if (m_opCode == QWebSocketProtocol::OpCodeText)
+            Q_EMIT textMessageReceived(m_textMessage);
+        else
+            Q_EMIT binaryMessageReceived(m_binaryMessage);
+        clear();
+    }
+    return true;
 }
 
 /*!
@@ -206,6 +337,8 @@ void QWebSocketDataProcessor::clear()
     m_binaryMessage.clear();
     m_textMessage.clear();
     m_payloadLength = 0;
+    m_frame.clear();
+    m_isCompressed = false;
     if (m_pConverterState) {
         if ((m_pConverterState->remainingChars != 0) || (m_pConverterState->invalidChars != 0)) {
             delete m_pConverterState;
@@ -218,11 +351,14 @@ void QWebSocketDataProcessor::clear()
 }
 
 /*!
+    Dispatches a control \a frame. Returns false if no more frames are to be
+    processed, after a close frame or an error.
+
     \internal
  */
 bool QWebSocketDataProcessor::processControlFrame(const QWebSocketFrame &frame)
 {
-    bool mustStopProcessing = true; //control frames never expect additional frames to be processed
+    bool mustStopProcessing = false;
     switch (frame.opCode()) {
     case QWebSocketProtocol::OpCodePing:
         Q_EMIT pingReceived(frame.payload());
@@ -262,6 +398,8 @@ bool QWebSocketDataProcessor::processControlFrame(const QWebSocketFrame &frame)
             }
         }
         Q_EMIT closeReceived(static_cast<QWebSocketProtocol::CloseCode>(closeCode), closeReason);
+        //nothing may follow a close frame (RFC 6455, section 5.5.1)
+        mustStopProcessing = true;
         break;
     }
 
@@ -285,10 +423,10 @@ bool QWebSocketDataProcessor::processControlFrame(const QWebSocketFrame &frame)
     default:
         Q_EMIT errorEncountered(QWebSocketProtocol::CloseCodeProtocolError,
                                 tr("Invalid opcode detected: %1").arg(int(frame.opCode())));
-        //do nothing
+        mustStopProcessing = true;
         break;
     }
-    return mustStopProcessing;
+    return !mustStopProcessing;
 }
 
 QT_END_NAMESPACE
@@ -51,11 +51,12 @@
 #include <QtCore/QTextCodec>
 #include "qwebsocketprotocol.h"
 #include "qwebsocketprotocol_p.h"
+#include "qwebsocketframe_p.h"
 
 QT_BEGIN_NAMESPACE
 
 class QIODevice;
-class QWebSocketFrame;
+class QWebSocketDeflate;
 
 class Q_AUTOTEST_EXPORT QWebSocketDataProcessor : public QObject
 {
@@ -69,6 +70,8 @@ public:
     static quint64 maxMessageSize();
     static quint64 maxFrameSize();
 
+    void setDeflate(QWebSocketDeflate *pDeflate);
+
 Q_SIGNALS:
     void pingReceived(const QByteArray &data);
     void pongReceived(const QByteArray &data);
@@ -105,7 +108,14 @@ private:
     quint64 m_payloadLength;
     QTextCodec::ConverterState *m_pConverterState;
     QTextCodec *m_pTextCodec;
+    QWebSocketFrame m_frame;
+    bool m_isProcessing;
+    QWebSocketDeflate *m_pDeflate;
+    bool m_isCompressed;
+    QByteArray m_inflated;
 
+    bool processBuffer(char *data, int size);
+    bool processFrame(const QWebSocketFrame &frame);
     bool processControlFrame(const QWebSocketFrame &frame);
 };
 
@@ -0,0 +1,511 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*!
+    \class QWebSocketDeflate
+    The class QWebSocketDeflate implements the permessage-deflate extension (RFC 7692).
+
+    A message is compressed as a whole with a raw deflate stream, flushed with
+    Z_SYNC_FLUSH, and sent without the trailing 0x00 0x00 0xff 0xff of the
+    flush block. The receiver appends these four bytes again after the last
+    frame of a compressed message.
+
+    \note The zlib streams are only allocated when the first message is compressed
+    or decompressed; a connection that never exchanges data messages costs nothing.
+
+    \sa QWebSocketDeflateOptions, QWebSocketDeflateBudget
+    \internal
+*/
+
+#include "qwebsocketdeflate_p.h"
+
+#include <QtCore/QStringList>
+
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+
+QT_BEGIN_NAMESPACE
+
+const QString QWebSocketDeflateOptions::extensionName = QStringLiteral("permessage-deflate");
+
+//zlib does not support raw deflate streams with a window of 8 bits
+const int MIN_DEFLATE_WINDOW_BITS = 9;
+const int MIN_WINDOW_BITS = 8;
+const int MAX_WINDOW_BITS = 15;
+const int DEFLATE_MEM_LEVEL = 8;
+const int MIN_OUTPUT_SIZE = 256;
+const qint64 DEFAULT_MAX_INFLATED_SIZE = 64 * 1024 * 1024;
+const char FLUSH_TRAILER[] = { '\x00', '\x00', '\xff', '\xff' };
+
+/*!
+    \internal
+ */
+struct QWebSocketDeflateStream
+{
+    z_stream stream;
+};
+
+/*!
+    \internal
+ */
+QWebSocketDeflateOptions::QWebSocketDeflateOptions() :
+    serverNoContextTakeover(false),
+    clientNoContextTakeover(false),
+    serverMaxWindowBits(MAX_WINDOW_BITS),
+    clientMaxWindowBits(MAX_WINDOW_BITS)
+{
+}
+
+/*!
+    \internal
+ */
+static bool parseWindowBits(const QString &value, int *windowBits)
+{
+    QString bits = value;
+    if (bits.length() >= 2 && bits.startsWith(QLatin1Char('"')) && bits.endsWith(QLatin1Char('"')))
+        bits = bits.mid(1, bits.length() - 2);
+    //RFC 7692 section 7.1.2: 1*DIGIT without leading zeroes
+    if (bits.isEmpty() || bits.length() > 2 || bits.at(0) == QLatin1Char('0'))
+        return false;
+    bool ok = false;
+    const int result = bits.toInt(&ok);
+    if (!ok || result < MIN_WINDOW_BITS || result > MAX_WINDOW_BITS)
+        return false;
+    *windowBits = result;
+    return true;
+}
+
+/*!
+    \internal
+    Parses a permessage-deflate extension offer or response into \a options.
+    A client_max_window_bits parameter without a value is reported as 0.
+    Returns false if \a extension is not a valid permessage-deflate element.
+ */
+bool QWebSocketDeflateOptions::parse(const QString &extension, QWebSocketDeflateOptions *options)
+{
+    Q_ASSERT(options);
+    const QStringList parameters = extension.split(QLatin1Char(';'));
+    if (parameters.first().trimmed().compare(extensionName, Qt::CaseInsensitive) != 0)
+        return false;
+
+    QWebSocketDeflateOptions result;
+    bool seenServerNoContextTakeover = false;
+    bool seenClientNoContextTakeover = false;
+    bool seenServerMaxWindowBits = false;
+    bool seenClientMaxWindowBits = false;
+    for (int i = 1; i < parameters.size(); ++i) {
+        const QString parameter = parameters.at(i).trimmed();
+        const int equals = parameter.indexOf(QLatin1Char('='));
+        const QString name = parameter.left(equals).trimmed().toLower();
+        const QString value = (equals < 0) ? QString() : parameter.mid(equals + 1).trimmed();
+        //every parameter may appear at most once (RFC 7692 section 7)
+        if (name == QStringLiteral("server_no_context_takeover")) {
+            if (seenServerNoContextTakeover || equals >= 0)
+                return false;
+            seenServerNoContextTakeover = true;
+            result.serverNoContextTakeover = true;
+        } else if (name == QStringLiteral("client_no_context_takeover")) {
+            if (seenClientNoContextTakeover || equals >= 0)
+                return false;
+            seenClientNoContextTakeover = true;
+            result.clientNoContextTakeover = true;
+        } else if (name == QStringLiteral("server_max_window_bits")) {
+            if (seenServerMaxWindowBits || !parseWindowBits(value, &result.serverMaxWindowBits))
+                return false;
+            seenServerMaxWindowBits = true;
+        } else if (name == QStringLiteral("client_max_window_bits")) {
+            if (seenClientMaxWindowBits)
+                return false;
+            seenClientMaxWindowBits = true;
+            if (equals < 0)
+                result.clientMaxWindowBits = 0;
+            else if (!parseWindowBits(value, &result.clientMaxWindowBits))
+                return false;
+        } else {
+            return false;
+        }
+    }
+    *options = result;
+    return true;
+}
+
+/*!
+    \internal
+    Decides on the server side whether the client \a offer can be accepted.
+    The server honours every parameter the client asks for, and keeps the
+    client's window at its default when the client leaves the choice to it.
+    Returns true and stores the parameters of the response in \a accepted
+    when the offer is acceptable.
+ */
+bool QWebSocketDeflateOptions::negotiate(const QString &offer, QWebSocketDeflateOptions *accepted)
+{
+    Q_ASSERT(accepted);
+    QWebSocketDeflateOptions options;
+    if (!parse(offer, &options))
+        return false;
+    //the client would not be able to inflate what zlib produces with a larger window
+    if (options.serverMaxWindowBits < MIN_DEFLATE_WINDOW_BITS)
+        return false;
+    //the server is allowed to leave out client_max_window_bits; the client then uses 15
+    if (options.clientMaxWindowBits == 0)
+        options.clientMaxWindowBits = MAX_WINDOW_BITS;
+    *accepted = options;
+    return true;
+}
+
+/*!
+    \internal
+    Returns the extension element describing these options, as sent in a
+    Sec-WebSocket-Extensions header. Default values are left out.
+ */
+QString QWebSocketDeflateOptions::toString() const
+{
+    QString extension = extensionName;
+    if (serverNoContextTakeover)
+        extension += QStringLiteral("; server_no_context_takeover");
+    if (clientNoContextTakeover)
+        extension += QStringLiteral("; client_no_context_takeover");
+    if (serverMaxWindowBits != MAX_WINDOW_BITS)
+        extension += QStringLiteral("; server_max_window_bits=") + QString::number(serverMaxWindowBits);
+    if (clientMaxWindowBits > 0 && clientMaxWindowBits != MAX_WINDOW_BITS)
+        extension += QStringLiteral("; client_max_window_bits=") + QString::number(clientMaxWindowBits);
+    return extension;
+}
+
+/*!
+    \class QWebSocketDeflateBudget
+    Keeps track of the memory reserved for the compression state of the
+    connections accepted by one server. A \a limit of -1 means unlimited.
+    \internal
+ */
+QWebSocketDeflateBudget::QWebSocketDeflateBudget(qint64 limit) :
+    m_mutex(),
+    m_limit(limit),
+    m_used(0),
+    m_maxInflatedSize(DEFAULT_MAX_INFLATED_SIZE)
+{
+}
+
+/*!
+    \internal
+    Changes the limit. Reservations already made are kept, even when they
+    exceed the new limit.
+ */
+void QWebSocketDeflateBudget::setLimit(qint64 limit)
+{
+    QMutexLocker locker(&m_mutex);
+    m_limit = limit;
+}
+
+/*!
+    \internal
+ */
+qint64 QWebSocketDeflateBudget::limit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_limit;
+}
+
+/*!
+    \internal
+ */
+qint64 QWebSocketDeflateBudget::used() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_used;
+}
+
+/*!
+    \internal
+    Reserves \a bytes. Returns false, and reserves nothing, if that would
+    exceed the limit.
+ */
+bool QWebSocketDeflateBudget::reserve(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_limit >= 0 && m_used + bytes > m_limit)
+        return false;
+    m_used += bytes;
+    return true;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketDeflateBudget::release(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    Q_ASSERT(m_used >= bytes);
+    m_used -= bytes;
+}
+
+/*!
+    \internal
+    Limits the size a compressed message may inflate to, for the connections
+    accepted from now on.
+ */
+void QWebSocketDeflateBudget::setMaxInflatedSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxInflatedSize = qMax(bytes, Q_INT64_C(0));
+}
+
+/*!
+    \internal
+ */
+qint64 QWebSocketDeflateBudget::maxInflatedSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maxInflatedSize;
+}
+
+/*!
+    \internal
+    Returns the worst case memory zlib uses for a deflate stream with a window
+    of \a deflateWindowBits and an inflate stream with a window of
+    \a inflateWindowBits (see zconf.h).
+ */
+qint64 QWebSocketDeflate::memoryEstimate(int deflateWindowBits, int inflateWindowBits)
+{
+    deflateWindowBits = qMax(deflateWindowBits, MIN_DEFLATE_WINDOW_BITS);
+    const qint64 deflateSize = (Q_INT64_C(1) << (deflateWindowBits + 2))
+            + (Q_INT64_C(1) << (DEFLATE_MEM_LEVEL + 9)) + qint64(sizeof(z_stream)) + 6 * 1024;
+    const qint64 inflateSize = (Q_INT64_C(1) << inflateWindowBits)
+            + qint64(sizeof(z_stream)) + 7 * 1024;
+    return deflateSize + inflateSize;
+}
+
+/*!
+    \internal
+    Creates the codec for the negotiated \a options. \a isServer selects which
+    half of the options applies to the outgoing direction. \a reserved bytes of
+    \a budget are released when the codec is destroyed.
+ */
+QWebSocketDeflate::QWebSocketDeflate(const QWebSocketDeflateOptions &options, bool isServer,
+                                     const QSharedPointer<QWebSocketDeflateBudget> &budget,
+                                     qint64 reserved) :
+    m_pDeflate(Q_NULLPTR),
+    m_pInflate(Q_NULLPTR),
+    m_deflateWindowBits(isServer ? options.serverMaxWindowBits : options.clientMaxWindowBits),
+    m_inflateWindowBits(isServer ? options.clientMaxWindowBits : options.serverMaxWindowBits),
+    m_deflateNoContextTakeover(isServer ? options.serverNoContextTakeover
+                                        : options.clientNoContextTakeover),
+    m_inflateNoContextTakeover(isServer ? options.clientNoContextTakeover
+                                        : options.serverNoContextTakeover),
+    m_budget(budget),
+    m_reserved(reserved),
+    m_maxInflatedSize(budget ? budget->maxInflatedSize() : DEFAULT_MAX_INFLATED_SIZE)
+{
+    if (m_deflateWindowBits <= 0)
+        m_deflateWindowBits = MAX_WINDOW_BITS;
+    m_deflateWindowBits = qMax(m_deflateWindowBits, MIN_DEFLATE_WINDOW_BITS);
+    if (m_inflateWindowBits <= 0)
+        m_inflateWindowBits = MAX_WINDOW_BITS;
+}
+
+/*!
+    \internal
+ */
+QWebSocketDeflate::~QWebSocketDeflate()
+{
+    if (m_pDeflate) {
+        deflateEnd(&m_pDeflate->stream);
+        delete m_pDeflate;
+    }
+    if (m_pInflate) {
+        inflateEnd(&m_pInflate->stream);
+        delete m_pInflate;
+    }
+    if (m_budget)
+        m_budget->release(m_reserved);
+}
+
+/*!
+    \internal
+    Returns the window size used to compress outgoing messages.
+ */
+int QWebSocketDeflate::deflateWindowBits() const
+{
+    return m_deflateWindowBits;
+}
+
+/*!
+    \internal
+    Returns true if compressed messages refer to earlier ones. When false,
+    the compressed form of a message only depends on deflateWindowBits().
+ */
+bool QWebSocketDeflate::hasDeflateContextTakeover() const
+{
+    return !m_deflateNoContextTakeover;
+}
+
+/*!
+    \internal
+    Compresses the message of \a size bytes at \a data into \a out, replacing
+    its contents. Returns false if zlib failed.
+ */
+bool QWebSocketDeflate::compress(const char *data, int size, QByteArray *out)
+{
+    Q_ASSERT(out);
+    //a sync flush without input adds nothing to a stream that is already
+    //flushed, so send the empty stored block (RFC 7692 section 7.2.3.6)
+    if (size == 0) {
+        *out = QByteArray(1, '\x00');
+        return true;
+    }
+    if (!m_pDeflate) {
+        m_pDeflate = new QWebSocketDeflateStream;
+        memset(&m_pDeflate->stream, 0, sizeof(z_stream));
+        if (deflateInit2(&m_pDeflate->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -m_deflateWindowBits, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete m_pDeflate;
+            m_pDeflate = Q_NULLPTR;
+            return false;
+        }
+    }
+    z_stream &stream = m_pDeflate->stream;
+
+    //deflateBound() does not account for the sync flush block
+    out->resize(int(deflateBound(&stream, uLong(size))) + 16);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream.avail_in = uInt(size);
+    int written = 0;
+    Q_FOREVER {
+        stream.next_out = reinterpret_cast<Bytef *>(out->data() + written);
+        stream.avail_out = uInt(out->size() - written);
+        const int result = deflate(&stream, Z_SYNC_FLUSH);
+        written = out->size() - int(stream.avail_out);
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            deflateReset(&stream);
+            return false;
+        }
+        //output space left over means the flush is complete
+        if (stream.avail_out > 0)
+            break;
+        out->resize(out->size() * 2);
+    }
+    Q_ASSERT(written >= 4 && memcmp(out->constData() + written - 4, FLUSH_TRAILER, 4) == 0);
+    out->resize(written - 4);
+
+    if (m_deflateNoContextTakeover)
+        deflateReset(&stream);
+    return true;
+}
+
+/*!
+    \internal
+    Returns the size a compressed message may inflate to.
+ */
+qint64 QWebSocketDeflate::maxInflatedSize() const
+{
+    return m_maxInflatedSize;
+}
+
+/*!
+    \internal
+    Decompresses \a size bytes of a compressed message and appends the output
+    to \a out. \a isFinal must be set for the last frame of the message.
+    Returns TooMuchData if the data inflates beyond \a maxSize bytes, and
+    InvalidData if it is not valid; \a out is left unchanged then.
+ */
+QWebSocketDeflate::DecompressResult QWebSocketDeflate::decompress(const char *data, int size,
+                                                                  bool isFinal, QByteArray *out,
+                                                                  quint64 maxSize)
+{
+    Q_ASSERT(out);
+    if (!m_pInflate) {
+        m_pInflate = new QWebSocketDeflateStream;
+        memset(&m_pInflate->stream, 0, sizeof(z_stream));
+        if (inflateInit2(&m_pInflate->stream, -m_inflateWindowBits) != Z_OK) {
+            delete m_pInflate;
+            m_pInflate = Q_NULLPTR;
+            return InvalidData;
+        }
+    }
+    z_stream &stream = m_pInflate->stream;
+
+    const int start = out->size();
+    int written = start;
+    //never more than one byte beyond the limit, nor past what a QByteArray holds
+    const qint64 maxOutput = qMin(qint64(qMin(maxSize, quint64(INT_MAX))) + 1,
+                                  qint64(INT_MAX) - start);
+    out->resize(start + int(qMin(qMax(qint64(size) * 4, qint64(MIN_OUTPUT_SIZE)), maxOutput)));
+    bool isStreamEnd = false;
+    for (int pass = 0; pass < 2 && !isStreamEnd; ++pass) {
+        if (pass == 0) {
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            stream.avail_in = uInt(size);
+        } else if (isFinal) {
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(FLUSH_TRAILER));
+            stream.avail_in = sizeof(FLUSH_TRAILER);
+        } else {
+            break;
+        }
+        Q_FOREVER {
+            stream.next_out = reinterpret_cast<Bytef *>(out->data() + written);
+            stream.avail_out = uInt(out->size() - written);
+            const int result = inflate(&stream, Z_SYNC_FLUSH);
+            written = out->size() - int(stream.avail_out);
+            //a peer may end the message with a final deflate block (RFC 7692
+            //section 7.2.3.3); the next message then starts a new stream
+            if (result == Z_STREAM_END) {
+                inflateReset(&stream);
+                isStreamEnd = true;
+                break;
+            }
+            if (result != Z_OK && result != Z_BUF_ERROR) {
+                out->resize(start);
+                inflateReset(&stream);
+                return InvalidData;
+            }
+            const qint64 inflated = written - start;
+            if (quint64(inflated) > maxSize || (stream.avail_out == 0 && inflated >= maxOutput)) {
+                out->resize(start);
+                inflateReset(&stream);
+                return TooMuchData;
+            }
+            if (stream.avail_out > 0 && stream.avail_in == 0)
+                break;
+            if (stream.avail_out == 0) {
+                //grow geometrically, but never past maxOutput
+                const qint64 grow = qMin(qMax(inflated, qint64(MIN_OUTPUT_SIZE)),
+                                         maxOutput - inflated);
+                out->resize(written + int(grow));
+            }
+            else if (result == Z_BUF_ERROR)
+                break;
+        }
+    }
+    if (quint64(written - start) > maxSize) {
+        out->resize(start);
+        inflateReset(&stream);
+        return TooMuchData;
+    }
+    out->resize(written);
+
+    if (isFinal && m_inflateNoContextTakeover && !isStreamEnd)
+        inflateReset(&stream);
+    return Decompressed;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETDEFLATE_P_H
+#define QWEBSOCKETDEFLATE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+struct QWebSocketDeflateStream;
+
+/*
+    Parameters of the permessage-deflate extension (RFC 7692, section 7).
+ */
+struct Q_AUTOTEST_EXPORT QWebSocketDeflateOptions
+{
+    QWebSocketDeflateOptions();
+
+    bool serverNoContextTakeover;
+    bool clientNoContextTakeover;
+    int serverMaxWindowBits;
+    //0 in an offer means "client_max_window_bits" without a value
+    int clientMaxWindowBits;
+
+    static const QString extensionName;
+
+    static bool parse(const QString &extension, QWebSocketDeflateOptions *options);
+    static bool negotiate(const QString &offer, QWebSocketDeflateOptions *accepted);
+    QString toString() const;
+};
+
+/*
+    Memory budget for the compression state of the connections of a server,
+    and the size compressed messages may inflate to. Shared with the
+    sockets, which may outlive the server.
+ */
+class QWebSocketDeflateBudget
+{
+public:
+    explicit QWebSocketDeflateBudget(qint64 limit = -1);
+
+    void setLimit(qint64 limit);
+    qint64 limit() const;
+    qint64 used() const;
+
+    bool reserve(qint64 bytes);
+    void release(qint64 bytes);
+
+    void setMaxInflatedSize(qint64 bytes);
+    qint64 maxInflatedSize() const;
+
+private:
+    Q_DISABLE_COPY(QWebSocketDeflateBudget)
+
+    mutable QMutex m_mutex;
+    qint64 m_limit;
+    qint64 m_used;
+    qint64 m_maxInflatedSize;
+};
+
+/*
+    Compressor and decompressor of one connection. The zlib streams are
+    created on first use and reset rather than recreated between messages
+    when context takeover is off.
+ */
+class Q_AUTOTEST_EXPORT QWebSocketDeflate
+{
+public:
+    enum DecompressResult
+    {
+        Decompressed,
+        InvalidData,
+        TooMuchData
+    };
+
+    QWebSocketDeflate(const QWebSocketDeflateOptions &options, bool isServer,
+                      const QSharedPointer<QWebSocketDeflateBudget> &budget = QSharedPointer<QWebSocketDeflateBudget>(),
+                      qint64 reserved = 0);
+    ~QWebSocketDeflate();
+
+    int deflateWindowBits() const;
+    bool hasDeflateContextTakeover() const;
+
+    bool compress(const char *data, int size, QByteArray *out);
+    DecompressResult decompress(const char *data, int size, bool isFinal, QByteArray *out,
+                                quint64 maxSize);
+    qint64 maxInflatedSize() const;
+
+    static qint64 memoryEstimate(int deflateWindowBits, int inflateWindowBits);
+
+private:
+    Q_DISABLE_COPY(QWebSocketDeflate)
+
+    QWebSocketDeflateStream *m_pDeflate;
+    QWebSocketDeflateStream *m_pInflate;
+    int m_deflateWindowBits;
+    int m_inflateWindowBits;
+    bool m_deflateNoContextTakeover;
+    bool m_inflateNoContextTakeover;
+    QSharedPointer<QWebSocketDeflateBudget> m_budget;
+    qint64 m_reserved;
+    qint64 m_maxInflatedSize;
+};
+
+QT_END_NAMESPACE
+
+#endif // QWEBSOCKETDEFLATE_P_H
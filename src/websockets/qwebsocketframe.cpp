@@ -35,8 +35,9 @@
     \class QWebSocketFrame
     The class QWebSocketFrame is responsible for reading, validating and
     interpreting frames from a WebSocket.
-    It reads data from a QIODevice, validates it against RFC 6455, and parses it into a
-    frame (data, control).
+    It is fed the bytes received from a WebSocket with feed(), validates them against
+    RFC 6455, and parses them into a frame (data, control). Parsing is incremental: a
+    frame can be split over any number of feed() calls.
     Whenever an error is detected, isValid() returns false.
 
     \note The QWebSocketFrame class does not look at valid sequences of frames.
@@ -53,6 +54,8 @@
 #include <QtCore/QtEndian>
 #include <QtCore/QDebug>
 
+#include <string.h>
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -69,7 +72,12 @@ QWebSocketFrame::QWebSocketFrame() :
     m_opCode(QWebSocketProtocol::OpCodeReservedC),
     m_length(0),
     m_payload(),
-    m_isValid(false)
+    m_payloadView(Q_NULLPTR),
+    m_isValid(false),
+    m_processingState(PS_READ_HEADER),
+    m_hasMask(false),
+    m_payloadLength(0),
+    m_partialSize(0)
 {
 }
 
@@ -87,8 +95,14 @@ QWebSocketFrame::QWebSocketFrame(const QWebSocketFrame &other) :
     m_opCode(other.m_opCode),
     m_length(other.m_length),
     m_payload(other.m_payload),
-    m_isValid(other.m_isValid)
+    m_payloadView(other.m_payloadView),
+    m_isValid(other.m_isValid),
+    m_processingState(other.m_processingState),
+    m_hasMask(other.m_hasMask),
+    m_payloadLength(other.m_payloadLength),
+    m_partialSize(other.m_partialSize)
 {
+    memcpy(m_partial, other.m_partial, sizeof(m_partial));
 }
 
 /*!
@@ -106,7 +120,13 @@ QWebSocketFrame &QWebSocketFrame::operator =(const QWebSocketFrame &other)
     m_opCode = other.m_opCode;
     m_length = other.m_length;
     m_payload = other.m_payload;
+    m_payloadView = other.m_payloadView;
     m_isValid = other.m_isValid;
+    m_processingState = other.m_processingState;
+    m_hasMask = other.m_hasMask;
+    m_payloadLength = other.m_payloadLength;
+    memcpy(m_partial, other.m_partial, sizeof(m_partial));
+    m_partialSize = other.m_partialSize;
 
     return *this;
 }
@@ -126,8 +146,15 @@ QWebSocketFrame::QWebSocketFrame(QWebSocketFrame &&other) :
     m_opCode(qMove(other.m_opCode)),
     m_length(qMove(other.m_length)),
     m_payload(qMove(other.m_payload)),
-    m_isValid(qMove(other.m_isValid))
-{}
+    m_payloadView(qMove(other.m_payloadView)),
+    m_isValid(qMove(other.m_isValid)),
+    m_processingState(qMove(other.m_processingState)),
+    m_hasMask(qMove(other.m_hasMask)),
+    m_payloadLength(qMove(other.m_payloadLength)),
+    m_partialSize(qMove(other.m_partialSize))
+{
+    memcpy(m_partial, other.m_partial, sizeof(m_partial));
+}
 
 
 /*!
@@ -145,7 +172,14 @@ QWebSocketFrame &QWebSocketFrame::operator =(QWebSocketFrame &&other)
     qSwap(m_opCode, other.m_opCode);
     qSwap(m_length, other.m_length);
     qSwap(m_payload, other.m_payload);
+    qSwap(m_payloadView, other.m_payloadView);
     qSwap(m_isValid, other.m_isValid);
+    qSwap(m_processingState, other.m_processingState);
+    qSwap(m_hasMask, other.m_hasMask);
+    qSwap(m_payloadLength, other.m_payloadLength);
+    for (int i = 0; i < int(sizeof(m_partial)); ++i)
+        qSwap(m_partial[i], other.m_partial[i]);
+    qSwap(m_partialSize, other.m_partialSize);
 
     return *this;
 }
@@ -168,7 +202,14 @@ void QWebSocketFrame::swap(QWebSocketFrame &other)
         qSwap(m_opCode, other.m_opCode);
         qSwap(m_length, other.m_length);
         qSwap(m_payload, other.m_payload);
+        qSwap(m_payloadView, other.m_payloadView);
         qSwap(m_isValid, other.m_isValid);
+        qSwap(m_processingState, other.m_processingState);
+        qSwap(m_hasMask, other.m_hasMask);
+        qSwap(m_payloadLength, other.m_payloadLength);
+        for (int i = 0; i < int(sizeof(m_partial)); ++i)
+            qSwap(m_partial[i], other.m_partial[i]);
+        qSwap(m_partialSize, other.m_partialSize);
     }
 }
 
@@ -273,9 +314,31 @@ QWebSocketProtocol::OpCode QWebSocketFrame::opCode() const
  */
 QByteArray QWebSocketFrame::payload() const
 {
+    if (m_payloadView)
+        return QByteArray(m_payloadView, int(m_payloadLength));
     return m_payload;
 }
 
+/*!
+    Returns the unmasked payload without copying it. When the whole payload
+    was contained in the buffer given to feed(), it points into that buffer
+    and is only valid as long as the buffer is.
+
+    \internal
+ */
+const char *QWebSocketFrame::payloadData() const
+{
+    return m_payloadView ? m_payloadView : m_payload.constData();
+}
+
+/*!
+    \internal
+ */
+int QWebSocketFrame::payloadSize() const
+{
+    return m_payloadView ? int(m_payloadLength) : m_payload.size();
+}
+
 /*!
     Resets all member variables, and invalidates the object.
 
@@ -293,7 +356,12 @@ void QWebSocketFrame::clear()
     m_opCode = QWebSocketProtocol::OpCodeReservedC;
     m_length = 0;
     m_payload.clear();
+    m_payloadView = Q_NULLPTR;
     m_isValid = false;
+    m_processingState = PS_READ_HEADER;
+    m_hasMask = false;
+    m_payloadLength = 0;
+    m_partialSize = 0;
 }
 
 /*!
@@ -304,219 +372,218 @@ bool QWebSocketFrame::isValid() const
     return m_isValid;
 }
 
+/*!
+    Returns true once feed() has parsed a whole frame, or found an error.
+
+    \internal
+ */
+bool QWebSocketFrame::isComplete() const
+{
+    return m_processingState == PS_DISPATCH_RESULT;
+}
+
+/*!
+    Returns \a size header bytes, taking them straight from \a data when they
+    are all there and collecting them across calls otherwise. Returns
+    Q_NULLPTR if more data is needed; \a data is advanced past the bytes used.
+
+    \internal
+ */
+const uchar *QWebSocketFrame::gather(char *&data, char *end, int size)
+{
+    if (m_partialSize == 0 && end - data >= size) {
+        const uchar *bytes = reinterpret_cast<const uchar *>(data);
+        data += size;
+        return bytes;
+    }
+    const int count = qMin(size - m_partialSize, int(end - data));
+    memcpy(m_partial + m_partialSize, data, count);
+    m_partialSize += count;
+    data += count;
+    if (m_partialSize < size)
+        return Q_NULLPTR;
+    m_partialSize = 0;
+    return m_partial;
+}
+
 // The arm compiler of Visual Studio 2013 Update 3 crashes when
-// trying to optimize QWebSocketFrame::readFrame. Hence turn
+// trying to optimize QWebSocketFrame::feed. Hence turn
 // those off for this snippet
 #if (defined(Q_OS_WINPHONE) || defined(Q_OS_WINRT)) && defined(__ARM__)
 #  pragma optimize("", off)
 #endif
 
-#define WAIT_FOR_MORE_DATA(dataSizeInBytes)  \
-    { returnState = processingState; \
-      processingState = PS_WAIT_FOR_MORE_DATA; dataWaitSize = dataSizeInBytes; }
-
 /*!
+    Parses the next bytes of the frame from the \a size bytes at \a data and
+    returns how many of them belong to it. Parsing stops at the end of the
+    frame, after which isComplete() returns true; the remaining bytes are the
+    start of the next frame. Otherwise all bytes were consumed and the state
+    is kept for the next call.
+
+    A masked payload is unmasked in place in \a data. If it is contained in
+    \a data as a whole it is not copied, see payloadData().
+
     \internal
  */
-QWebSocketFrame QWebSocketFrame::readFrame(QIODevice *pIoDevice)
+int QWebSocketFrame::feed(char *data, int size)
 {
-    bool isDone = false;
-    qint64 bytesRead = 0;
-    QWebSocketFrame frame;
-    quint64 dataWaitSize = 0;
-    Q_UNUSED(dataWaitSize); // value is used in MACRO, Q_UNUSED to avoid compiler warnings
-    ProcessingState processingState = PS_READ_HEADER;
-    ProcessingState returnState = PS_READ_HEADER;
-    bool hasMask = false;
-    quint64 payloadLength = 0;
-
-    while (!isDone)
-    {
-        switch (processingState) {
-        case PS_WAIT_FOR_MORE_DATA:
-            //TODO: waitForReadyRead should really be changed
-            //now, when a WebSocket is used in a GUI thread
-            //the GUI will hang for at most 5 seconds
-            //maybe, a QStateMachine should be used
-            if (!pIoDevice->waitForReadyRead(5000)) {
-                frame.setError(QWebSocketProtocol::CloseCodeGoingAway,
-                               tr("Timeout when reading data from socket."));
-                processingState = PS_DISPATCH_RESULT;
-            } else {
-                processingState = returnState;
-            }
-            break;
-
-        case PS_READ_HEADER:
-            if (Q_LIKELY(pIoDevice->bytesAvailable() >= 2)) {
-                //FIN, RSV1-3, Opcode
-                char header[2] = {0};
-                bytesRead = pIoDevice->read(header, 2);
-                frame.m_isFinalFrame = (header[0] & 0x80) != 0;
-                frame.m_rsv1 = (header[0] & 0x40);
-                frame.m_rsv2 = (header[0] & 0x20);
-                frame.m_rsv3 = (header[0] & 0x10);
-                frame.m_opCode = static_cast<QWebSocketProtocol::OpCode>(header[0] & 0x0F);
-
-                //Mask, PayloadLength
-                hasMask = (header[1] & 0x80) != 0;
-                frame.m_length = (header[1] & 0x7F);
-
-                switch (frame.m_length)
+    char *const begin = data;
+    char *const end = data + size;
+
+    while (m_processingState != PS_DISPATCH_RESULT) {
+        switch (m_processingState) {
+        case PS_READ_HEADER: {
+            const uchar *header = gather(data, end, 2);
+            if (!header)
+                return int(data - begin);
+
+            //FIN, RSV1-3, Opcode
+            m_isFinalFrame = (header[0] & 0x80) != 0;
+            m_rsv1 = (header[0] & 0x40);
+            m_rsv2 = (header[0] & 0x20);
+            m_rsv3 = (header[0] & 0x10);
+            m_opCode = static_cast<QWebSocketProtocol::OpCode>(header[0] & 0x0F);
+
+            //Mask, PayloadLength
+            m_hasMask = (header[1] & 0x80) != 0;
+            m_length = (header[1] & 0x7F);
+
+            switch (m_length)
+            {
+                case 126:
                 {
-                    case 126:
-                    {
-                        processingState = PS_READ_PAYLOAD_LENGTH;
-                        break;
-                    }
-                    case 127:
-                    {
-                        processingState = PS_READ_BIG_PAYLOAD_LENGTH;
-                        break;
-                    }
-                    default:
-                    {
-                        payloadLength = frame.m_length;
-                        processingState = hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
-                        break;
-                    }
+                    m_processingState = PS_READ_PAYLOAD_LENGTH;
+                    break;
+                }
+                case 127:
+                {
+                    m_processingState = PS_READ_BIG_PAYLOAD_LENGTH;
+                    break;
+                }
+                default:
+                {
+                    m_payloadLength = m_length;
+                    m_processingState = m_hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
+                    break;
                 }
-                if (!frame.checkValidity())
-                    processingState = PS_DISPATCH_RESULT;
-            } else {
-                WAIT_FOR_MORE_DATA(2);
             }
+            if (!checkValidity())
+                m_processingState = PS_DISPATCH_RESULT;
             break;
+        }
 
-        case PS_READ_PAYLOAD_LENGTH:
-            if (Q_LIKELY(pIoDevice->bytesAvailable() >= 2)) {
-                uchar length[2] = {0};
-                bytesRead = pIoDevice->read(reinterpret_cast<char *>(length), 2);
-                if (Q_UNLIKELY(bytesRead == -1)) {
-                    frame.setError(QWebSocketProtocol::CloseCodeGoingAway,
-                                   tr("Error occurred while reading from the network: %1")
-                                        .arg(pIoDevice->errorString()));
-                    processingState = PS_DISPATCH_RESULT;
-                } else {
-                    payloadLength = qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(length));
-                    if (Q_UNLIKELY(payloadLength < 126)) {
-                        //see http://tools.ietf.org/html/rfc6455#page-28 paragraph 5.2
-                        //"in all cases, the minimal number of bytes MUST be used to encode
-                        //the length, for example, the length of a 124-byte-long string
-                        //can't be encoded as the sequence 126, 0, 124"
-                        frame.setError(QWebSocketProtocol::CloseCodeProtocolError,
-                                       tr("Lengths smaller than 126 " \
-                                                   "must be expressed as one byte."));
-                        processingState = PS_DISPATCH_RESULT;
-                    } else {
-                        processingState = hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
-                    }
-                }
+        case PS_READ_PAYLOAD_LENGTH: {
+            const uchar *length = gather(data, end, 2);
+            if (!length)
+                return int(data - begin);
+
+            m_payloadLength = qFromBigEndian<quint16>(length);
+            if (Q_UNLIKELY(m_payloadLength < 126)) {
+                //see http://tools.ietf.org/html/rfc6455#page-28 paragraph 5.2
+                //"in all cases, the minimal number of bytes MUST be used to encode
+                //the length, for example, the length of a 124-byte-long string
+                //can't be encoded as the sequence 126, 0, 124"
+                setError(QWebSocketProtocol::CloseCodeProtocolError,
+                         tr("Lengths smaller than 126 " \
+                                     "must be expressed as one byte."));
+                m_processingState = PS_DISPATCH_RESULT;
             } else {
-                WAIT_FOR_MORE_DATA(2);
+                m_processingState = m_hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
             }
             break;
+        }
 
-        case PS_READ_BIG_PAYLOAD_LENGTH:
-            if (Q_LIKELY(pIoDevice->bytesAvailable() >= 8)) {
-                uchar length[8] = {0};
-                bytesRead = pIoDevice->read(reinterpret_cast<char *>(length), 8);
-                if (Q_UNLIKELY(bytesRead < 8)) {
-                    frame.setError(QWebSocketProtocol::CloseCodeAbnormalDisconnection,
-                                   tr("Something went wrong during "\
-                                               "reading from the network."));
-                    processingState = PS_DISPATCH_RESULT;
-                } else {
-                    //Most significant bit must be set to 0 as
-                    //per http://tools.ietf.org/html/rfc6455#section-5.2
-                    payloadLength = qFromBigEndian<quint64>(length);
-                    if (Q_UNLIKELY(payloadLength & (quint64(1) << 63))) {
-                        frame.setError(QWebSocketProtocol::CloseCodeProtocolError,
-                                       tr("Highest bit of payload length is not 0."));
-                        processingState = PS_DISPATCH_RESULT;
-                    } else if (Q_UNLIKELY(payloadLength <= 0xFFFFu)) {
-                        //see http://tools.ietf.org/html/rfc6455#page-28 paragraph 5.2
-                        //"in all cases, the minimal number of bytes MUST be used to encode
-                        //the length, for example, the length of a 124-byte-long string
-                        //can't be encoded as the sequence 126, 0, 124"
-                        frame.setError(QWebSocketProtocol::CloseCodeProtocolError,
-                                       tr("Lengths smaller than 65536 (2^16) " \
-                                                   "must be expressed as 2 bytes."));
-                        processingState = PS_DISPATCH_RESULT;
-                    } else {
-                        processingState = hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
-                    }
-                }
+        case PS_READ_BIG_PAYLOAD_LENGTH: {
+            const uchar *length = gather(data, end, 8);
+            if (!length)
+                return int(data - begin);
+
+            //Most significant bit must be set to 0 as
+            //per http://tools.ietf.org/html/rfc6455#section-5.2
+            m_payloadLength = qFromBigEndian<quint64>(length);
+            if (Q_UNLIKELY(m_payloadLength & (quint64(1) << 63))) {
+                setError(QWebSocketProtocol::CloseCodeProtocolError,
+                         tr("Highest bit of payload length is not 0."));
+                m_processingState = PS_DISPATCH_RESULT;
+            } else if (Q_UNLIKELY(m_payloadLength <= 0xFFFFu)) {
+                //see http://tools.ietf.org/html/rfc6455#page-28 paragraph 5.2
+                //"in all cases, the minimal number of bytes MUST be used to encode
+                //the length, for example, the length of a 124-byte-long string
+                //can't be encoded as the sequence 126, 0, 124"
+                setError(QWebSocketProtocol::CloseCodeProtocolError,
+                         tr("Lengths smaller than 65536 (2^16) " \
+                                     "must be expressed as 2 bytes."));
+                m_processingState = PS_DISPATCH_RESULT;
             } else {
-                WAIT_FOR_MORE_DATA(8);
+                m_processingState = m_hasMask ? PS_READ_MASK : PS_READ_PAYLOAD;
             }
-
             break;
+        }
 
-        case PS_READ_MASK:
-            if (Q_LIKELY(pIoDevice->bytesAvailable() >= 4)) {
-                bytesRead = pIoDevice->read(reinterpret_cast<char *>(&frame.m_mask),
-                                            sizeof(frame.m_mask));
-                if (bytesRead == -1) {
-                    frame.setError(QWebSocketProtocol::CloseCodeGoingAway,
-                                   tr("Error while reading from the network: %1.")
-                                        .arg(pIoDevice->errorString()));
-                    processingState = PS_DISPATCH_RESULT;
-                } else {
-                    frame.m_mask = qFromBigEndian(frame.m_mask);
-                    processingState = PS_READ_PAYLOAD;
-                }
-            } else {
-                WAIT_FOR_MORE_DATA(4);
-            }
+        case PS_READ_MASK: {
+            const uchar *mask = gather(data, end, 4);
+            if (!mask)
+                return int(data - begin);
+
+            m_mask = qFromBigEndian<quint32>(mask);
+            m_processingState = PS_READ_PAYLOAD;
             break;
+        }
 
         case PS_READ_PAYLOAD:
-            if (!payloadLength) {
-                processingState = PS_DISPATCH_RESULT;
-            } else if (Q_UNLIKELY(payloadLength > MAX_FRAME_SIZE_IN_BYTES)) {
-                frame.setError(QWebSocketProtocol::CloseCodeTooMuchData,
-                               tr("Maximum framesize exceeded."));
-                processingState = PS_DISPATCH_RESULT;
+            if (!m_payloadLength) {
+                m_processingState = PS_DISPATCH_RESULT;
+            } else if (Q_UNLIKELY(m_payloadLength > MAX_FRAME_SIZE_IN_BYTES)) {
+                setError(QWebSocketProtocol::CloseCodeTooMuchData,
+                         tr("Maximum framesize exceeded."));
+                m_processingState = PS_DISPATCH_RESULT;
             } else {
-                quint64 bytesAvailable = quint64(pIoDevice->bytesAvailable());
-                if (bytesAvailable >= payloadLength) {
-                    frame.m_payload = pIoDevice->read(payloadLength);
-                    //payloadLength can be safely cast to an integer,
-                    //because MAX_FRAME_SIZE_IN_BYTES = MAX_INT
-                    if (Q_UNLIKELY(frame.m_payload.length() != int(payloadLength))) {
-                        //some error occurred; refer to the Qt documentation of QIODevice::read()
-                        frame.setError(QWebSocketProtocol::CloseCodeAbnormalDisconnection,
-                                       tr("Some serious error occurred " \
-                                                   "while reading from the network."));
-                        processingState = PS_DISPATCH_RESULT;
-                    } else {
-                        if (hasMask)
-                            QWebSocketProtocol::mask(&frame.m_payload, frame.m_mask);
-                        processingState = PS_DISPATCH_RESULT;
-                    }
-                } else {
-                    //if payload is too big, then this will timeout
-                    WAIT_FOR_MORE_DATA(payloadLength);
+                //payloadLength can be safely cast to an integer,
+                //because MAX_FRAME_SIZE_IN_BYTES = MAX_INT
+                const int received = m_payload.size();
+                const int missing = int(m_payloadLength) - received;
+                const int available = int(end - data);
+                if (received == 0 && available >= missing) {
+                    // The whole payload is at hand: unmask it where it is.
+                    if (m_hasMask)
+                        QWebSocketProtocol::mask(data, m_payloadLength, m_mask);
+                    m_payloadView = data;
+                    data += m_payloadLength;
+                    m_processingState = PS_DISPATCH_RESULT;
+                    break;
                 }
-            }
-            break;
 
-        case PS_DISPATCH_RESULT:
-            processingState = PS_READ_HEADER;
-            isDone = true;
+                const int count = qMin(missing, available);
+                if (!count)
+                    return int(data - begin);
+                if (m_hasMask) {
+                    // Continue the mask where the previous part left off.
+                    const int shift = (received & 3) * 8;
+                    const quint32 mask = shift ? (m_mask << shift) | (m_mask >> (32 - shift))
+                                               : m_mask;
+                    QWebSocketProtocol::mask(data, count, mask);
+                }
+                // Grows with the data received rather than with the announced
+                // length, which the peer may not honour.
+                if (received == 0)
+                    m_payload.reserve(qMin(missing, 64 * 1024));
+                m_payload.append(data, count);
+                data += count;
+                if (count == missing)
+                    m_processingState = PS_DISPATCH_RESULT;
+            }
             break;
 
         default:
             //should not come here
             qWarning() << "DataProcessor::process: Found invalid state. This should not happen!";
-            frame.clear();
-            isDone = true;
+            clear();
+            m_processingState = PS_DISPATCH_RESULT;
             break;
         }	//end switch
     }
 
-    return frame;
+    return int(data - begin);
 }
 
 #if (defined(Q_OS_WINPHONE) || defined(Q_OS_WINRT)) && defined(__ARM__)
@@ -539,7 +606,9 @@ void QWebSocketFrame::setError(QWebSocketProtocol::CloseCode code, const QString
  */
 bool QWebSocketFrame::checkValidity()
 {
-    if (Q_UNLIKELY(m_rsv1 || m_rsv2 || m_rsv3)) {
+    //RSV1 on data frames is only valid with permessage-deflate,
+    //which is checked by QWebSocketDataProcessor
+    if (Q_UNLIKELY(m_rsv2 || m_rsv3 || (m_rsv1 && isControlFrame()))) {
         setError(QWebSocketProtocol::CloseCodeProtocolError, tr("Rsv field is non-zero"));
     } else if (Q_UNLIKELY(QWebSocketProtocol::isOpCodeReserved(m_opCode))) {
         setError(QWebSocketProtocol::CloseCodeProtocolError, tr("Used reserved opcode"));
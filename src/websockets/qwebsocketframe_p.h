@@ -45,8 +45,6 @@
 
 QT_BEGIN_NAMESPACE
 
-class QIODevice;
-
 const quint64 MAX_FRAME_SIZE_IN_BYTES = INT_MAX - 1;
 const quint64 MAX_MESSAGE_SIZE_IN_BYTES = INT_MAX - 1;
 
@@ -80,12 +78,15 @@ public:
     int rsv3() const;
     QWebSocketProtocol::OpCode opCode() const;
     QByteArray payload() const;
+    const char *payloadData() const;
+    int payloadSize() const;
 
     void clear();
 
     bool isValid() const;
+    bool isComplete() const;
 
-    static QWebSocketFrame readFrame(QIODevice *pIoDevice);
+    int feed(char *data, int size);
 
 private:
     QWebSocketProtocol::CloseCode m_closeCode;
@@ -99,6 +100,7 @@ private:
 
     quint8 m_length;
     QByteArray m_payload;
+    const char *m_payloadView;
 
     bool m_isValid;
 
@@ -109,10 +111,16 @@ private:
         PS_READ_BIG_PAYLOAD_LENGTH,
         PS_READ_MASK,
         PS_READ_PAYLOAD,
-        PS_DISPATCH_RESULT,
-        PS_WAIT_FOR_MORE_DATA
+        PS_DISPATCH_RESULT
     };
 
+    ProcessingState m_processingState;
+    bool m_hasMask;
+    quint64 m_payloadLength;
+    uchar m_partial[8];
+    int m_partialSize;
+
+    const uchar *gather(char *&data, char *end, int size);
     void setError(QWebSocketProtocol::CloseCode code, const QString &closeReason);
     bool checkValidity();
 };
@@ -0,0 +1,325 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "qwebsockethandshakeparser_p.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \internal
+    Constructs a parser for a handshake of the given \a type. Header lines
+    longer than \a maxHeaderLineLength, more than \a maxHeaders headers and a
+    head longer than all those lines together make the handshake invalid.
+ */
+QWebSocketHandshakeParser::QWebSocketHandshakeParser(Type type, int maxHeaderLineLength,
+                                                     int maxHeaders) :
+    m_type(type),
+    m_maxHeaderLineLength(maxHeaderLineLength),
+    m_maxHeaders(maxHeaders),
+    //the request or status line and the empty line count as header lines too
+    m_maxSize(maxHeaderLineLength * (maxHeaders + 2)),
+    m_status(Incomplete),
+    m_size(0),
+    m_url(),
+    m_statusMessage(),
+    m_headerField(),
+    m_headerValue(),
+    m_isReadingValue(false),
+    m_headers()
+{
+    reset();
+}
+
+/*!
+    \internal
+    Prepares the parser for a new handshake.
+ */
+void QWebSocketHandshakeParser::reset()
+{
+    http_parser_init(&m_parser, m_type == Request ? HTTP_REQUEST : HTTP_RESPONSE);
+    m_parser.data = this;
+    m_status = Incomplete;
+    m_size = 0;
+    m_url.clear();
+    m_statusMessage.clear();
+    m_headerField.clear();
+    m_headerValue.clear();
+    m_isReadingValue = false;
+    m_headers.clear();
+}
+
+/*!
+    \internal
+    Parses the next \a size bytes of the handshake at \a data and returns how
+    many of them belong to it. Once status() is no longer Incomplete, the
+    remaining bytes are not touched.
+ */
+int QWebSocketHandshakeParser::parse(const char *data, int size)
+{
+    if (m_status != Incomplete || size <= 0)
+        return 0;
+    const int parsed = int(http_parser_execute(&m_parser, settings(), data,
+                                               size_t(qMin(size, m_maxSize - m_size))));
+    m_size += parsed;
+    //message complete pauses the parser
+    if (m_status == Incomplete) {
+        if (HTTP_PARSER_ERRNO(&m_parser) != HPE_OK) {
+            m_status = Invalid;
+        } else if (m_size >= m_maxSize) {
+            m_parser.http_errno = HPE_HEADER_OVERFLOW;
+            m_status = Invalid;
+        }
+    }
+    return parsed;
+}
+
+/*!
+    \internal
+    Returns the most bytes a handshake may take.
+ */
+int QWebSocketHandshakeParser::maxSize() const
+{
+    return m_maxSize;
+}
+
+/*!
+    \internal
+ */
+QWebSocketHandshakeParser::Status QWebSocketHandshakeParser::status() const
+{
+    return m_status;
+}
+
+/*!
+    \internal
+    Returns the number of bytes parsed so far.
+ */
+int QWebSocketHandshakeParser::size() const
+{
+    return m_size;
+}
+
+/*!
+    \internal
+ */
+QString QWebSocketHandshakeParser::method() const
+{
+    return QString::fromLatin1(http_method_str(static_cast<http_method>(m_parser.method)));
+}
+
+/*!
+    \internal
+ */
+QByteArray QWebSocketHandshakeParser::url() const
+{
+    return m_url;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::httpMajorVersion() const
+{
+    return m_parser.http_major;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::httpMinorVersion() const
+{
+    return m_parser.http_minor;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::statusCode() const
+{
+    return m_parser.status_code;
+}
+
+/*!
+    \internal
+ */
+QString QWebSocketHandshakeParser::statusMessage() const
+{
+    return QString::fromLatin1(m_statusMessage);
+}
+
+/*!
+    \internal
+    Returns why the handshake is invalid.
+ */
+QString QWebSocketHandshakeParser::errorString() const
+{
+    return QString::fromLatin1(http_errno_description(HTTP_PARSER_ERRNO(&m_parser)));
+}
+
+/*!
+    \internal
+    Returns the headers; names are lower case and repeated headers are
+    combined into one comma separated value.
+ */
+QHash<QString, QString> QWebSocketHandshakeParser::headers() const
+{
+    return m_headers;
+}
+
+/*!
+    \internal
+ */
+const http_parser_settings *QWebSocketHandshakeParser::settings()
+{
+    static const http_parser_settings parserSettings = {
+        Q_NULLPTR,                  //on_message_begin
+        Q_NULLPTR,                  //on_protocol
+        &onUrl,
+        &onSpecRequest,
+        &onStatus,
+        &onHeaderField,
+        &onHeaderValue,
+        &onHeadersComplete,
+        Q_NULLPTR,                  //on_body
+        &onMessageComplete,
+        Q_NULLPTR,                  //on_chunk_header
+        Q_NULLPTR                   //on_chunk_complete
+    };
+    return &parserSettings;
+}
+
+/*!
+    \internal
+    Appends a piece of a token; returns false when the line gets too long.
+ */
+bool QWebSocketHandshakeParser::append(QByteArray *pTarget, const char *at, size_t length)
+{
+    size_t lineLength = size_t(pTarget->size()) + length;
+    if (pTarget == &m_headerValue)
+        lineLength += size_t(m_headerField.size());
+    if (Q_UNLIKELY(lineLength > size_t(m_maxHeaderLineLength)))
+        return false;
+    pTarget->append(at, int(length));
+    return true;
+}
+
+/*!
+    \internal
+    Moves the header read last into the header hash.
+ */
+bool QWebSocketHandshakeParser::insertHeader()
+{
+    if (m_headerField.isEmpty())
+        return true;
+    const QString field = QString::fromLatin1(m_headerField).toLower();
+    const QString value = QString::fromLatin1(m_headerValue);
+    m_headerField.clear();
+    m_headerValue.clear();
+    m_isReadingValue = false;
+
+    QHash<QString, QString>::iterator it = m_headers.find(field);
+    if (it == m_headers.end()) {
+        if (Q_UNLIKELY(m_headers.size() >= m_maxHeaders))
+            return false;
+        m_headers.insert(field, value);
+    } else {
+        //see RFC 7230, section 3.2.2
+        *it += QStringLiteral(", ") + value;
+    }
+    return true;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::onUrl(http_parser *parser, const char *at, size_t length)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    return pParser->append(&pParser->m_url, at, length) ? 0 : -1;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::onStatus(http_parser *parser, const char *at, size_t length)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    return pParser->append(&pParser->m_statusMessage, at, length) ? 0 : -1;
+}
+
+/*!
+    \internal
+    A flash policy file request is no handshake.
+ */
+int QWebSocketHandshakeParser::onSpecRequest(http_parser *parser, const char *at, size_t length)
+{
+    Q_UNUSED(parser);
+    Q_UNUSED(at);
+    Q_UNUSED(length);
+    return -1;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::onHeaderField(http_parser *parser, const char *at, size_t length)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    //a new field starts once the previous one has a value
+    if (pParser->m_isReadingValue && !pParser->insertHeader())
+        return -1;
+    return pParser->append(&pParser->m_headerField, at, length) ? 0 : -1;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::onHeaderValue(http_parser *parser, const char *at, size_t length)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    pParser->m_isReadingValue = true;
+    return pParser->append(&pParser->m_headerValue, at, length) ? 0 : -1;
+}
+
+/*!
+    \internal
+    A handshake has no body we care about, so it ends with the headers.
+ */
+int QWebSocketHandshakeParser::onHeadersComplete(http_parser *parser)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    return pParser->insertHeader() ? 1 : -1;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketHandshakeParser::onMessageComplete(http_parser *parser)
+{
+    QWebSocketHandshakeParser *pParser = static_cast<QWebSocketHandshakeParser *>(parser->data);
+    pParser->m_status = Complete;
+    //stop right here; what follows are WebSocket frames
+    http_parser_pause(parser, 1);
+    return 0;
+}
+
+QT_END_NAMESPACE
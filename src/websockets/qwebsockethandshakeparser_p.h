@@ -0,0 +1,124 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETHANDSHAKEPARSER_P_H
+#define QWEBSOCKETHANDSHAKEPARSER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+#include "http_parser.h"
+
+QT_BEGIN_NAMESPACE
+
+//both constants are taken from the default settings of Apache
+//see: http://httpd.apache.org/docs/2.2/mod/core.html#limitrequestfieldsize and
+//http://httpd.apache.org/docs/2.2/mod/core.html#limitrequestfields
+const int MAX_HEADERLINE_LENGTH = 8 * 1024; //maximum length of a http header line
+const int MAX_HEADERLINES = 100;            //maximum number of http header lines
+
+/*
+    Parses the HTTP head of a handshake request or response with the same
+    http_parser the HTTP server uses. Data can be fed in pieces; parsing stops
+    right after the empty line, so the bytes following the head are left for
+    the WebSocket frames.
+ */
+class QWebSocketHandshakeParser
+{
+    Q_DISABLE_COPY(QWebSocketHandshakeParser)
+
+public:
+    enum Type
+    {
+        Request,
+        Response
+    };
+
+    enum Status
+    {
+        Incomplete,
+        Complete,
+        Invalid
+    };
+
+    explicit QWebSocketHandshakeParser(Type type,
+                                       int maxHeaderLineLength = MAX_HEADERLINE_LENGTH,
+                                       int maxHeaders = MAX_HEADERLINES);
+
+    void reset();
+    int parse(const char *data, int size);
+    int maxSize() const;
+
+    Status status() const;
+    int size() const;
+    QString method() const;
+    QByteArray url() const;
+    int httpMajorVersion() const;
+    int httpMinorVersion() const;
+    int statusCode() const;
+    QString statusMessage() const;
+    QString errorString() const;
+    QHash<QString, QString> headers() const;
+
+private:
+    static int onUrl(http_parser *parser, const char *at, size_t length);
+    static int onStatus(http_parser *parser, const char *at, size_t length);
+    static int onHeaderField(http_parser *parser, const char *at, size_t length);
+    static int onHeaderValue(http_parser *parser, const char *at, size_t length);
+    static int onSpecRequest(http_parser *parser, const char *at, size_t length);
+    static int onHeadersComplete(http_parser *parser);
+    static int onMessageComplete(http_parser *parser);
+
+    static const http_parser_settings *settings();
+    bool append(QByteArray *pTarget, const char *at, size_t length);
+    bool insertHeader();
+
+    http_parser m_parser;
+    Type m_type;
+    int m_maxHeaderLineLength;
+    int m_maxHeaders;
+    int m_maxSize;
+    Status m_status;
+    int m_size;
+    QByteArray m_url;
+    QByteArray m_statusMessage;
+    QByteArray m_headerField;
+    QByteArray m_headerValue;
+    bool m_isReadingValue;
+    QHash<QString, QString> m_headers;
+};
+
+QT_END_NAMESPACE
+
+#endif // QWEBSOCKETHANDSHAKEPARSER_P_H
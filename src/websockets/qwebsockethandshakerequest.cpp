@@ -34,10 +34,11 @@
 #include "qwebsockethandshakerequest_p.h"
 #include "qwebsocketprotocol.h"
 #include "qwebsocketprotocol_p.h"
+#include "qwebsockethandshakeparser_p.h"
 
 #include <QtCore/QString>
-#include <QtCore/QMap>
-#include <QtCore/QTextStream>
+#include <QtCore/QHash>
+#include <QtCore/QIODevice>
 #include <QtCore/QUrl>
 #include <QtCore/QList>
 #include <QtCore/QStringList>
@@ -113,7 +114,7 @@ bool QWebSocketHandshakeRequest::isValid() const
 /*!
     \internal
  */
-QMap<QString, QString> QWebSocketHandshakeRequest::headers() const
+QHash<QString, QString> QWebSocketHandshakeRequest::headers() const
 {
     return m_headers;
 }
@@ -183,88 +184,49 @@ QUrl QWebSocketHandshakeRequest::requestUrl() const
 }
 
 /*!
-    Reads a line of text from the given textstream (terminated by CR/LF).
-    If an empty line was detected, an empty string is returned.
-    When an error occurs, a null string is returned.
     \internal
+    Feeds the bytes buffered in \a pDevice to \a pParser, which keeps the
+    state of the handshake between calls, leaving the bytes after the
+    handshake in the device. Returns false while the handshake is incomplete;
+    the request is invalid afterwards if the handshake could not be parsed.
  */
-static QString readLine(QTextStream &stream, int maxHeaderLineLength)
+bool QWebSocketHandshakeRequest::readHandshake(QIODevice *pDevice,
+                                               QWebSocketHandshakeParser *pParser)
 {
-    QString line;
-    char c;
-    while (!stream.atEnd()) {
-        stream >> c;
-        if (stream.status() != QTextStream::Ok)
-            return QString();
-        if (c == char('\r')) {
-            //eat the \n character
-            stream >> c;
-            line.append(QStringLiteral(""));
-            break;
-        } else {
-            line.append(QChar::fromLatin1(c));
-            if (line.length() > maxHeaderLineLength)
-                return QString();
-        }
+    clear();
+    if (Q_UNLIKELY(!pDevice || !pParser))
+        return true;
+    //the parser keeps what it has seen, so only new bytes are fed to it
+    const QByteArray data = pDevice->peek(qMin(pDevice->bytesAvailable(),
+                                               qint64(pParser->maxSize() - pParser->size())));
+    pDevice->read(pParser->parse(data.constData(), data.size()));
+    switch (pParser->status()) {
+    case QWebSocketHandshakeParser::Incomplete:
+        return false;
+    case QWebSocketHandshakeParser::Complete:
+        setHandshake(pParser->method(), QUrl::fromEncoded(pParser->url()),
+                     QStringLiteral("%1.%2").arg(pParser->httpMajorVersion())
+                                            .arg(pParser->httpMinorVersion()).toFloat(),
+                     pParser->headers());
+        break;
+    case QWebSocketHandshakeParser::Invalid:
+        break;
     }
-    return line;
+    return true;
 }
 
 /*!
+    \brief Takes the request from a request line and headers that were already parsed
+    Header names in \a headers must be lower case.
     \internal
  */
-void QWebSocketHandshakeRequest::readHandshake(QTextStream &textStream, int maxHeaderLineLength,
-                                               int maxHeaders)
+void QWebSocketHandshakeRequest::setHandshake(const QString &verb, const QUrl &requestUrl,
+                                              float httpVersion,
+                                              const QHash<QString, QString> &headers)
 {
     clear();
-    if (Q_UNLIKELY(textStream.status() != QTextStream::Ok))
-        return;
-    const QString requestLine = readLine(textStream, maxHeaderLineLength);
-    if (requestLine.isNull()) {
-        clear();
-        return;
-    }
-    const QStringList tokens = requestLine.split(' ', QString::SkipEmptyParts);
-    if (Q_UNLIKELY(tokens.length() < 3)) {
-        clear();
-        return;
-    }
-    const QString verb(tokens.at(0));
-    const QString resourceName(tokens.at(1));
-    const QString httpProtocol(tokens.at(2));
-    bool conversionOk = false;
-    const float httpVersion = httpProtocol.midRef(5).toFloat(&conversionOk);
-
-    if (Q_UNLIKELY(!conversionOk)) {
-        clear();
-        return;
-    }
-    QString headerLine = readLine(textStream, maxHeaderLineLength);
-    if (headerLine.isNull()) {
-        clear();
-        return;
-    }
-    m_headers.clear();
-    while (!headerLine.isEmpty()) {
-        const QStringList headerField = headerLine.split(QStringLiteral(": "),
-                                                         QString::SkipEmptyParts);
-        if (Q_UNLIKELY(headerField.length() < 2)) {
-            clear();
-            return;
-        }
-        m_headers.insertMulti(headerField.at(0).toLower(), headerField.at(1));
-        if (m_headers.size() > maxHeaders) {
-            clear();
-            return;
-        }
-        headerLine = readLine(textStream, maxHeaderLineLength);
-        if (headerLine.isNull()) {
-            clear();
-            return;
-        }
-    }
-
-    m_requestUrl = QUrl::fromEncoded(resourceName.toLatin1());
+    m_headers = headers;
+    m_requestUrl = requestUrl;
     QString host = m_headers.value(QStringLiteral("host"), QString());
     if (m_requestUrl.isRelative()) {
         // see http://tools.ietf.org/html/rfc6455#page-17
@@ -332,11 +294,11 @@ void QWebSocketHandshakeRequest::readHandshake(QTextStream &textStream, int maxH
     //TODO: authentication field
 
     m_isValid = !(host.isEmpty() ||
-                  resourceName.isEmpty() ||
+                  requestUrl.isEmpty() ||
                   m_versions.isEmpty() ||
                   m_key.isEmpty() ||
                   (verb != QStringLiteral("GET")) ||
-                  (!conversionOk || (httpVersion < 1.1f)) ||
+                  (httpVersion < 1.1f) ||
                   (upgrade.toLower() != QStringLiteral("websocket")) ||
                   (!connectionValues.contains(QStringLiteral("upgrade"), Qt::CaseInsensitive)));
     if (Q_UNLIKELY(!m_isValid))
@@ -45,7 +45,7 @@
 //
 
 #include <QtCore/QObject>
-#include <QtCore/QMap>
+#include <QtCore/QHash>
 #include <QtCore/QString>
 #include <QtCore/QUrl>
 
@@ -53,7 +53,8 @@
 
 QT_BEGIN_NAMESPACE
 
-class QTextStream;
+class QIODevice;
+class QWebSocketHandshakeParser;
 
 class Q_AUTOTEST_EXPORT QWebSocketHandshakeRequest
 {
@@ -68,7 +69,7 @@ public:
     int port() const;
     bool isSecure() const;
     bool isValid() const;
-    QMap<QString, QString> headers() const;
+    QHash<QString, QString> headers() const;
     QList<QWebSocketProtocol::Version> versions() const;
     QString key() const;
     QString origin() const;
@@ -78,14 +79,16 @@ public:
     QString resourceName() const;
     QString host() const;
 
-    void readHandshake(QTextStream &textStream, int maxHeaderLineLength, int maxHeaders);
+    bool readHandshake(QIODevice *pDevice, QWebSocketHandshakeParser *pParser);
+    void setHandshake(const QString &verb, const QUrl &requestUrl, float httpVersion,
+                      const QHash<QString, QString> &headers);
 
 private:
 
     int m_port;
     bool m_isSecure;
     bool m_isValid;
-    QMap<QString, QString> m_headers;
+    QHash<QString, QString> m_headers;
     QList<QWebSocketProtocol::Version> m_versions;
     QString m_key;
     QString m_origin;
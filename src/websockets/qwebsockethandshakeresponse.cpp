@@ -33,6 +33,7 @@
 
 #include "qwebsockethandshakeresponse_p.h"
 #include "qwebsockethandshakerequest_p.h"
+#include "qwebsocketdeflate_p.h"
 #include "qwebsocketprotocol.h"
 #include "qwebsocketprotocol_p.h"
 
@@ -143,10 +144,20 @@ QString QWebSocketHandshakeResponse::getHandshakeResponse(
             const QString acceptKey = calculateAcceptKey(request.key());
             const QList<QString> matchingProtocols =
                     supportedProtocols.toSet().intersect(request.protocols().toSet()).toList();
-            //TODO: extensions must be kept in the order in which they arrive
-            //cannot use set.intersect() to get the supported extensions
-            const QList<QString> matchingExtensions =
-                    supportedExtensions.toSet().intersect(request.extensions().toSet()).toList();
+            //extension offers are considered in the order in which they arrive;
+            //a permessage-deflate offer carries parameters that must be negotiated
+            const QStringList offeredExtensions = request.extensions();
+            QString matchingExtension;
+            for (int i = 0; i < offeredExtensions.size() && matchingExtension.isEmpty(); ++i) {
+                const QString &offer = offeredExtensions.at(i);
+                QWebSocketDeflateOptions deflateOptions;
+                if (supportedExtensions.contains(QWebSocketDeflateOptions::extensionName)
+                        && QWebSocketDeflateOptions::negotiate(offer, &deflateOptions)) {
+                    matchingExtension = deflateOptions.toString();
+                } else if (supportedExtensions.contains(offer)) {
+                    matchingExtension = offer;
+                }
+            }
             QList<QWebSocketProtocol::Version> matchingVersions =
                     request.versions().toSet().intersect(supportedVersions.toSet()).toList();
             std::sort(matchingVersions.begin(), matchingVersions.end(),
@@ -165,8 +176,8 @@ QString QWebSocketHandshakeResponse::getHandshakeResponse(
                     m_acceptedProtocol = matchingProtocols.first();
                     response << QStringLiteral("Sec-WebSocket-Protocol: ") % m_acceptedProtocol;
                 }
-                if (!matchingExtensions.isEmpty()) {
-                    m_acceptedExtension = matchingExtensions.first();
+                if (!matchingExtension.isEmpty()) {
+                    m_acceptedExtension = matchingExtension;
                     response << QStringLiteral("Sec-WebSocket-Extensions: ") % m_acceptedExtension;
                 }
                 QString origin = request.origin().trimmed();
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*!
+    \class QWebSocketHub
+
+    \inmodule QtWebSockets
+    \brief Delivers published messages to the WebSockets subscribed to a topic.
+
+    Sockets are subscribed to topics with subscribe(), from the thread they
+    live in; publish() may be called from any thread. The subscribers of
+    every thread are kept in a shard of their own, which only that thread
+    touches: a publication is posted once to each thread with subscribers
+    and fanned out there, so publishing takes no lock on the subscriber sets.
+    Messages are prepared once (see QWebSocketPreparedMessage) and their
+    frames are shared by all subscribers.
+
+    A subscriber whose socket has more than 64 KiB waiting to be written
+    gets further messages queued, up to maxQueuedMessages(). When the queue
+    is full, slowConsumerPolicy() decides whether the oldest queued message
+    is dropped or the socket is closed.
+
+    Subscriptions end when the socket disconnects or is destroyed.
+
+    \sa QWebSocketServer, QWebSocketPreparedMessage
+*/
+
+/*!
+    \enum QWebSocketHub::SlowConsumerPolicy
+
+    Decides what happens to a subscriber whose queue is full.
+
+    \value DropOldestMessage The oldest queued message is dropped, so the
+    subscriber sees the latest messages once it catches up.
+    \value DisconnectConsumer The socket is closed with
+    QWebSocketProtocol::CloseCodePolicyViolated and unsubscribed.
+*/
+
+#include "qwebsockethub.h"
+#include "qwebsockethub_p.h"
+#include "qwebsocket.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QThread>
+
+QT_BEGIN_NAMESPACE
+
+//more bytes than this waiting in a socket make its subscriber queue messages
+const qint64 MAX_PENDING_BYTES = 64 * 1024;
+const int DEFAULT_MAX_QUEUED_MESSAGES = 256;
+
+namespace {
+
+class PublishEvent : public QEvent
+{
+public:
+    PublishEvent(const QString &topic, const QWebSocketPreparedMessage &message) :
+        QEvent(QEvent::User),
+        topic(topic),
+        message(message)
+    {
+    }
+
+    const QString topic;
+    const QWebSocketPreparedMessage message;
+};
+
+}
+
+/*!
+    \internal
+ */
+QWebSocketHubState::QWebSocketHubState() :
+    maxQueuedMessages(DEFAULT_MAX_QUEUED_MESSAGES),
+    slowConsumerPolicy(QWebSocketHub::DropOldestMessage),
+    droppedMessages(0),
+    lock(),
+    shards()
+{
+}
+
+/*!
+    \internal
+ */
+QWebSocketHubShard::QWebSocketHubShard(const QSharedPointer<QWebSocketHubState> &state) :
+    QObject(),
+    m_state(state),
+    m_subscribers(),
+    m_topics(),
+    m_subscriberCount(0)
+{
+}
+
+/*!
+    \internal
+ */
+QWebSocketHubShard::~QWebSocketHubShard()
+{
+    qDeleteAll(m_subscribers);
+}
+
+/*!
+    \internal
+    Returns true if the shard has subscribers. Called from publishing threads.
+ */
+bool QWebSocketHubShard::hasSubscribers() const
+{
+    return m_subscriberCount.load() > 0;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::subscribe(QWebSocket *pWebSocket, const QString &topic)
+{
+    Subscriber *&pSubscriber = m_subscribers[pWebSocket];
+    if (!pSubscriber) {
+        pSubscriber = new Subscriber;
+        m_subscriberCount.ref();
+        connect(pWebSocket, &QWebSocket::bytesWritten, this, [this, pWebSocket]() {
+            drain(pWebSocket);
+        });
+        connect(pWebSocket, &QWebSocket::disconnected, this, [this, pWebSocket]() {
+            remove(pWebSocket, false);
+        });
+        connect(pWebSocket, &QObject::destroyed, this, [this, pWebSocket]() {
+            remove(pWebSocket, true);
+        });
+    }
+    if (!pSubscriber->topics.contains(topic)) {
+        pSubscriber->topics.insert(topic);
+        m_topics[topic].insert(pWebSocket);
+    }
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::unsubscribe(QWebSocket *pWebSocket, const QString &topic)
+{
+    Subscriber *pSubscriber = m_subscribers.value(pWebSocket);
+    if (!pSubscriber || !pSubscriber->topics.remove(topic))
+        return;
+    QHash<QString, QSet<QWebSocket *> >::iterator it = m_topics.find(topic);
+    it.value().remove(pWebSocket);
+    if (it.value().isEmpty())
+        m_topics.erase(it);
+    if (pSubscriber->topics.isEmpty())
+        remove(pWebSocket, false);
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::unsubscribeAll(QWebSocket *pWebSocket)
+{
+    remove(pWebSocket, false);
+}
+
+/*!
+    \internal
+    Forgets \a pWebSocket; \a isDestroyed tells that it must not be used anymore.
+ */
+void QWebSocketHubShard::remove(QWebSocket *pWebSocket, bool isDestroyed)
+{
+    Subscriber *pSubscriber = m_subscribers.take(pWebSocket);
+    if (!pSubscriber)
+        return;
+    Q_FOREACH (const QString &topic, pSubscriber->topics) {
+        QHash<QString, QSet<QWebSocket *> >::iterator it = m_topics.find(topic);
+        it.value().remove(pWebSocket);
+        if (it.value().isEmpty())
+            m_topics.erase(it);
+    }
+    delete pSubscriber;
+    m_subscriberCount.deref();
+    if (!isDestroyed)
+        QObject::disconnect(pWebSocket, Q_NULLPTR, this, Q_NULLPTR);
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::customEvent(QEvent *event)
+{
+    if (event->type() == QEvent::User) {
+        PublishEvent *pEvent = static_cast<PublishEvent *>(event);
+        deliver(pEvent->topic, pEvent->message);
+    }
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::deliver(const QString &topic, const QWebSocketPreparedMessage &message)
+{
+    //a copy: sending may close sockets, which changes the subscriber sets
+    const QSet<QWebSocket *> subscribers = m_topics.value(topic);
+    QSet<QWebSocket *>::const_iterator it = subscribers.constBegin();
+    for (; it != subscribers.constEnd(); ++it) {
+        if (Subscriber *pSubscriber = m_subscribers.value(*it))
+            send(*it, pSubscriber, message);
+    }
+}
+
+/*!
+    \internal
+    Sends \a message right away if the socket keeps up, queues it otherwise
+    and applies the slow consumer policy when the queue is full.
+ */
+void QWebSocketHubShard::send(QWebSocket *pWebSocket, Subscriber *pSubscriber,
+                              const QWebSocketPreparedMessage &message)
+{
+    if (pSubscriber->queue.isEmpty() && pWebSocket->bytesToWrite() <= MAX_PENDING_BYTES) {
+        pWebSocket->sendPreparedMessage(message);
+        return;
+    }
+    if (pSubscriber->queue.size() >= m_state->maxQueuedMessages.load()) {
+        if (m_state->slowConsumerPolicy.load() == QWebSocketHub::DisconnectConsumer) {
+            m_state->droppedMessages.fetchAndAddRelaxed(pSubscriber->queue.size() + 1);
+            remove(pWebSocket, false);
+            pWebSocket->close(QWebSocketProtocol::CloseCodePolicyViolated,
+                              QWebSocketHub::tr("Subscriber does not keep up."));
+            return;
+        }
+        m_state->droppedMessages.fetchAndAddRelaxed(1);
+        //without a queue the new message is the one dropped
+        if (pSubscriber->queue.isEmpty())
+            return;
+        pSubscriber->queue.dequeue();
+    }
+    pSubscriber->queue.enqueue(message);
+}
+
+/*!
+    \internal
+ */
+void QWebSocketHubShard::drain(QWebSocket *pWebSocket)
+{
+    //looked up again every time: a slot connected to the socket may unsubscribe it
+    Subscriber *pSubscriber;
+    while ((pSubscriber = m_subscribers.value(pWebSocket))
+           && !pSubscriber->queue.isEmpty()
+           && pWebSocket->bytesToWrite() <= MAX_PENDING_BYTES) {
+        const QWebSocketPreparedMessage message = pSubscriber->queue.dequeue();
+        pWebSocket->sendPreparedMessage(message);
+    }
+}
+
+/*!
+    \internal
+ */
+QWebSocketHubPrivate::QWebSocketHubPrivate(QWebSocketHub * const pWebSocketHub) :
+    QObjectPrivate(),
+    q_ptr(pWebSocketHub),
+    m_state(new QWebSocketHubState)
+{
+}
+
+/*!
+    \internal
+    Shards of other threads that are still running are deleted by their
+    thread, at the latest when it finishes; the others are deleted here.
+ */
+QWebSocketHubPrivate::~QWebSocketHubPrivate()
+{
+    QWriteLocker locker(&m_state->lock);
+    QHash<QThread *, QWebSocketHubShard *>::const_iterator it;
+    for (it = m_state->shards.constBegin(); it != m_state->shards.constEnd(); ++it) {
+        //a stopped thread, or the main thread once exec() has returned,
+        //would never process a deleteLater()
+        if (it.key() == QThread::currentThread() || !it.key()->isRunning())
+            delete it.value();
+        else
+            it.value()->deleteLater();
+    }
+    m_state->shards.clear();
+}
+
+/*!
+    \internal
+    Returns the shard of the calling thread, creating it if \a create is true.
+ */
+QWebSocketHubShard *QWebSocketHubPrivate::shard(bool create)
+{
+    QThread *pThread = QThread::currentThread();
+    {
+        QReadLocker locker(&m_state->lock);
+        if (QWebSocketHubShard *pShard = m_state->shards.value(pThread))
+            return pShard;
+    }
+    if (!create)
+        return Q_NULLPTR;
+
+    QWebSocketHubShard *pShard = new QWebSocketHubShard(m_state);
+    {
+        QWriteLocker locker(&m_state->lock);
+        m_state->shards.insert(pThread, pShard);
+    }
+    //whoever takes the shard out of the map deletes it, the thread or the hub
+    const QSharedPointer<QWebSocketHubState> state = m_state;
+    QObject::connect(pThread, &QThread::finished, pShard, [state, pThread]() {
+        QWriteLocker locker(&state->lock);
+        if (QWebSocketHubShard *pShard = state->shards.take(pThread))
+            pShard->deleteLater();
+    }, Qt::DirectConnection);
+    return pShard;
+}
+
+/*!
+    Creates a hub with the given \a parent.
+ */
+QWebSocketHub::QWebSocketHub(QObject *parent) :
+    QObject(*(new QWebSocketHubPrivate(this)), parent)
+{
+}
+
+/*!
+    Destroys the hub. Messages published before are still delivered.
+ */
+QWebSocketHub::~QWebSocketHub()
+{
+}
+
+/*!
+    Sets the number of messages queued for a subscriber that does not keep
+    up to \a count. The default is 256.
+
+    \sa setSlowConsumerPolicy()
+ */
+void QWebSocketHub::setMaxQueuedMessages(int count)
+{
+    Q_D(QWebSocketHub);
+    d->m_state->maxQueuedMessages.store(qMax(count, 0));
+}
+
+/*!
+    Returns the number of messages queued for a subscriber that does not
+    keep up.
+ */
+int QWebSocketHub::maxQueuedMessages() const
+{
+    Q_D(const QWebSocketHub);
+    return d->m_state->maxQueuedMessages.load();
+}
+
+/*!
+    Sets what happens to a subscriber whose queue is full to \a policy.
+    The default is DropOldestMessage.
+
+    \sa setMaxQueuedMessages(), droppedMessages()
+ */
+void QWebSocketHub::setSlowConsumerPolicy(SlowConsumerPolicy policy)
+{
+    Q_D(QWebSocketHub);
+    d->m_state->slowConsumerPolicy.store(policy);
+}
+
+/*!
+    Returns the policy for subscribers that do not keep up.
+ */
+QWebSocketHub::SlowConsumerPolicy QWebSocketHub::slowConsumerPolicy() const
+{
+    Q_D(const QWebSocketHub);
+    return static_cast<SlowConsumerPolicy>(d->m_state->slowConsumerPolicy.load());
+}
+
+/*!
+    Returns the number of messages that were not delivered because a
+    subscriber did not keep up.
+ */
+quint64 QWebSocketHub::droppedMessages() const
+{
+    Q_D(const QWebSocketHub);
+    return d->m_state->droppedMessages.load();
+}
+
+/*!
+    Subscribes \a pWebSocket to \a topic. Must be called from the thread
+    \a pWebSocket lives in.
+ */
+void QWebSocketHub::subscribe(QWebSocket *pWebSocket, const QString &topic)
+{
+    Q_D(QWebSocketHub);
+    Q_ASSERT(pWebSocket);
+    Q_ASSERT(pWebSocket->thread() == QThread::currentThread());
+    d->shard(true)->subscribe(pWebSocket, topic);
+}
+
+/*!
+    Unsubscribes \a pWebSocket from \a topic. Must be called from the thread
+    \a pWebSocket lives in.
+ */
+void QWebSocketHub::unsubscribe(QWebSocket *pWebSocket, const QString &topic)
+{
+    Q_D(QWebSocketHub);
+    if (QWebSocketHubShard *pShard = d->shard(false))
+        pShard->unsubscribe(pWebSocket, topic);
+}
+
+/*!
+    Unsubscribes \a pWebSocket from all topics and drops its queued messages.
+    Must be called from the thread \a pWebSocket lives in.
+ */
+void QWebSocketHub::unsubscribeAll(QWebSocket *pWebSocket)
+{
+    Q_D(QWebSocketHub);
+    if (QWebSocketHubShard *pShard = d->shard(false))
+        pShard->unsubscribeAll(pWebSocket);
+}
+
+/*!
+    Publishes \a message to the subscribers of \a topic. May be called from
+    any thread; the message is delivered by the threads of the subscribers.
+ */
+void QWebSocketHub::publish(const QString &topic, const QWebSocketPreparedMessage &message)
+{
+    Q_D(QWebSocketHub);
+    if (message.isNull())
+        return;
+    QReadLocker locker(&d->m_state->lock);
+    QHash<QThread *, QWebSocketHubShard *>::const_iterator it = d->m_state->shards.constBegin();
+    for (; it != d->m_state->shards.constEnd(); ++it) {
+        if (it.value()->hasSubscribers())
+            QCoreApplication::postEvent(it.value(), new PublishEvent(topic, message));
+    }
+}
+
+/*!
+    Publishes the text \a message to the subscribers of \a topic.
+
+    \sa publish(), publishBinaryMessage()
+ */
+void QWebSocketHub::publishTextMessage(const QString &topic, const QString &message)
+{
+    publish(topic, QWebSocketPreparedMessage(message));
+}
+
+/*!
+    Publishes the binary message \a data to the subscribers of \a topic.
+
+    \sa publish(), publishTextMessage()
+ */
+void QWebSocketHub::publishBinaryMessage(const QString &topic, const QByteArray &data)
+{
+    publish(topic, QWebSocketPreparedMessage(data));
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETHUB_H
+#define QWEBSOCKETHUB_H
+
+#include "QtWebSockets/qwebsockets_global.h"
+#include "QtWebSockets/qwebsocketpreparedmessage.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QWebSocket;
+class QWebSocketHubPrivate;
+
+class Q_WEBSOCKETS_EXPORT QWebSocketHub : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(QWebSocketHub)
+    Q_DECLARE_PRIVATE(QWebSocketHub)
+
+    Q_ENUMS(SlowConsumerPolicy)
+
+public:
+    enum SlowConsumerPolicy {
+        DropOldestMessage,
+        DisconnectConsumer
+    };
+
+    explicit QWebSocketHub(QObject *parent = Q_NULLPTR);
+    virtual ~QWebSocketHub();
+
+    void setMaxQueuedMessages(int count);
+    int maxQueuedMessages() const;
+    void setSlowConsumerPolicy(SlowConsumerPolicy policy);
+    SlowConsumerPolicy slowConsumerPolicy() const;
+    quint64 droppedMessages() const;
+
+    void subscribe(QWebSocket *pWebSocket, const QString &topic);
+    void unsubscribe(QWebSocket *pWebSocket, const QString &topic);
+    void unsubscribeAll(QWebSocket *pWebSocket);
+
+    void publish(const QString &topic, const QWebSocketPreparedMessage &message);
+    void publishTextMessage(const QString &topic, const QString &message);
+    void publishBinaryMessage(const QString &topic, const QByteArray &data);
+};
+
+QT_END_NAMESPACE
+
+#endif // QWEBSOCKETHUB_H
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETHUB_P_H
+#define QWEBSOCKETHUB_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <private/qobject_p.h>
+
+#include "qwebsockethub.h"
+#include "qwebsocketpreparedmessage.h"
+
+QT_BEGIN_NAMESPACE
+
+class QThread;
+class QWebSocketHubShard;
+
+/*
+    State shared by a hub and its shards; a shard may still be processing
+    publications after the hub is gone.
+ */
+struct QWebSocketHubState
+{
+    QWebSocketHubState();
+
+    QAtomicInt maxQueuedMessages;
+    QAtomicInt slowConsumerPolicy;
+    QAtomicInteger<quint64> droppedMessages;
+
+    //write locked only when a thread subscribes for the first time or finishes
+    QReadWriteLock lock;
+    QHash<QThread *, QWebSocketHubShard *> shards;
+};
+
+/*
+    The subscribers of one thread. Only that thread touches the subscriber
+    sets; publications reach it as posted events.
+ */
+class QWebSocketHubShard : public QObject
+{
+public:
+    explicit QWebSocketHubShard(const QSharedPointer<QWebSocketHubState> &state);
+    virtual ~QWebSocketHubShard();
+
+    void subscribe(QWebSocket *pWebSocket, const QString &topic);
+    void unsubscribe(QWebSocket *pWebSocket, const QString &topic);
+    void unsubscribeAll(QWebSocket *pWebSocket);
+
+    bool hasSubscribers() const;
+
+protected:
+    void customEvent(QEvent *event) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(QWebSocketHubShard)
+
+    struct Subscriber
+    {
+        QSet<QString> topics;
+        QQueue<QWebSocketPreparedMessage> queue;
+    };
+
+    void deliver(const QString &topic, const QWebSocketPreparedMessage &message);
+    void send(QWebSocket *pWebSocket, Subscriber *pSubscriber,
+              const QWebSocketPreparedMessage &message);
+    void drain(QWebSocket *pWebSocket);
+    void remove(QWebSocket *pWebSocket, bool isDestroyed);
+
+    QSharedPointer<QWebSocketHubState> m_state;
+    QHash<QWebSocket *, Subscriber *> m_subscribers;
+    QHash<QString, QSet<QWebSocket *> > m_topics;
+    QAtomicInt m_subscriberCount;
+};
+
+class QWebSocketHubPrivate : public QObjectPrivate
+{
+    Q_DISABLE_COPY(QWebSocketHubPrivate)
+
+public:
+    Q_DECLARE_PUBLIC(QWebSocketHub)
+    explicit QWebSocketHubPrivate(QWebSocketHub * const pWebSocketHub);
+    virtual ~QWebSocketHubPrivate();
+
+    QWebSocketHubShard *shard(bool create);
+
+    QWebSocketHub * const q_ptr;
+    QSharedPointer<QWebSocketHubState> m_state;
+};
+
+QT_END_NAMESPACE
+
+#endif // QWEBSOCKETHUB_P_H
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*!
+    \class QWebSocketPreparedMessage
+
+    \inmodule QtWebSockets
+    \brief A message that is encoded once and sent to many WebSockets.
+
+    Sending the same message with QWebSocket::sendTextMessage() to many
+    sockets converts it to UTF-8 and frames it for every socket.
+    A QWebSocketPreparedMessage holds the encoded payload, and the frames a
+    server socket sends are built from it once and shared by all sockets.
+    When permessage-deflate is negotiated without server context takeover,
+    the compressed frames are cached as well, once per window size.
+    Sockets that must mask their frames, and compressing sockets whose
+    output depends on earlier messages, only share the encoded payload.
+
+    QWebSocketPreparedMessage is implicitly shared and can be passed between
+    threads.
+
+    \sa broadcast(), QWebSocket::sendPreparedMessage()
+*/
+
+#include "qwebsocketpreparedmessage.h"
+#include "qwebsocketpreparedmessage_p.h"
+#include "qwebsocket.h"
+
+#include <QtCore/QThread>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \internal
+ */
+QWebSocketPreparedMessagePrivate::QWebSocketPreparedMessagePrivate(const QByteArray &payload,
+                                                                   bool isBinary) :
+    QSharedData(),
+    payload(payload),
+    isBinary(isBinary),
+    mutex(),
+    frames()
+{
+}
+
+/*!
+    Constructs a null prepared message.
+
+    \sa isNull()
+ */
+QWebSocketPreparedMessage::QWebSocketPreparedMessage() :
+    d()
+{
+}
+
+/*!
+    Constructs a prepared text message from \a message.
+ */
+QWebSocketPreparedMessage::QWebSocketPreparedMessage(const QString &message) :
+    d(new QWebSocketPreparedMessagePrivate(message.toUtf8(), false))
+{
+}
+
+/*!
+    Constructs a prepared binary message from \a data.
+ */
+QWebSocketPreparedMessage::QWebSocketPreparedMessage(const QByteArray &data) :
+    d(new QWebSocketPreparedMessagePrivate(data, true))
+{
+}
+
+/*!
+    Constructs a copy of \a other. The encoded frames are shared.
+ */
+QWebSocketPreparedMessage::QWebSocketPreparedMessage(const QWebSocketPreparedMessage &other) :
+    d(other.d)
+{
+}
+
+/*!
+    Destroys the prepared message.
+ */
+QWebSocketPreparedMessage::~QWebSocketPreparedMessage()
+{
+}
+
+/*!
+    Assigns \a other to this prepared message and returns a reference to it.
+ */
+QWebSocketPreparedMessage &QWebSocketPreparedMessage::operator=(
+        const QWebSocketPreparedMessage &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+    Returns true if this is a null prepared message.
+ */
+bool QWebSocketPreparedMessage::isNull() const
+{
+    return !d;
+}
+
+/*!
+    Returns true if this is a binary message, false if it is a text message.
+ */
+bool QWebSocketPreparedMessage::isBinary() const
+{
+    return d ? d->isBinary : false;
+}
+
+/*!
+    Returns the payload of the message; UTF-8 for a text message.
+ */
+QByteArray QWebSocketPreparedMessage::payload() const
+{
+    return d ? d->payload : QByteArray();
+}
+
+/*!
+    Sends \a message to all \a sockets and returns the number of sockets it
+    was sent or queued to.
+
+    Sockets living in the calling thread are written to immediately. For a
+    socket of another thread, QWebSocket::sendPreparedMessage() is queued to
+    that thread; the message is dropped if the socket is destroyed before
+    the call is delivered. The sockets must not be destroyed while this
+    function runs.
+ */
+int QWebSocketPreparedMessage::broadcast(const QList<QWebSocket *> &sockets,
+                                         const QWebSocketPreparedMessage &message)
+{
+    static const int metaTypeId = qRegisterMetaType<QWebSocketPreparedMessage>();
+    Q_UNUSED(metaTypeId);
+
+    if (message.isNull())
+        return 0;
+    QThread *const currentThread = QThread::currentThread();
+    int count = 0;
+    for (int i = 0; i < sockets.size(); ++i) {
+        QWebSocket *pSocket = sockets.at(i);
+        if (Q_UNLIKELY(!pSocket))
+            continue;
+        if (pSocket->thread() == currentThread) {
+            if (pSocket->state() != QAbstractSocket::ConnectedState)
+                continue;
+            pSocket->sendPreparedMessage(message);
+        } else {
+            QMetaObject::invokeMethod(pSocket, "sendPreparedMessage", Qt::QueuedConnection,
+                                      Q_ARG(QWebSocketPreparedMessage, message));
+        }
+        ++count;
+    }
+    return count;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETPREPAREDMESSAGE_H
+#define QWEBSOCKETPREPAREDMESSAGE_H
+
+#include "QtWebSockets/qwebsockets_global.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QExplicitlySharedDataPointer>
+#include <QtCore/QList>
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+
+QT_BEGIN_NAMESPACE
+
+class QWebSocket;
+class QWebSocketPrivate;
+class QWebSocketPreparedMessagePrivate;
+
+class Q_WEBSOCKETS_EXPORT QWebSocketPreparedMessage
+{
+public:
+    QWebSocketPreparedMessage();
+    explicit QWebSocketPreparedMessage(const QString &message);
+    explicit QWebSocketPreparedMessage(const QByteArray &data);
+    QWebSocketPreparedMessage(const QWebSocketPreparedMessage &other);
+    ~QWebSocketPreparedMessage();
+
+    QWebSocketPreparedMessage &operator=(const QWebSocketPreparedMessage &other);
+
+    bool isNull() const;
+    bool isBinary() const;
+    QByteArray payload() const;
+
+    static int broadcast(const QList<QWebSocket *> &sockets,
+                         const QWebSocketPreparedMessage &message);
+
+private:
+    QExplicitlySharedDataPointer<QWebSocketPreparedMessagePrivate> d;
+
+    friend class QWebSocketPrivate;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QWebSocketPreparedMessage)
+
+#endif // QWEBSOCKETPREPAREDMESSAGE_H
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2011-2014 Nikhil Marathe <nsm.nikhil@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef QWEBSOCKETPREPAREDMESSAGE_P_H
+#define QWEBSOCKETPREPAREDMESSAGE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedData>
+
+QT_BEGIN_NAMESPACE
+
+class QWebSocketPreparedMessagePrivate : public QSharedData
+{
+public:
+    QWebSocketPreparedMessagePrivate(const QByteArray &payload, bool isBinary);
+
+    const QByteArray payload;
+    const bool isBinary;
+
+    //encoded server frames by deflate window bits, 0 for uncompressed;
+    //built on first use by whichever thread sends the message first
+    QMutex mutex;
+    QHash<int, QByteArray> frames;
+
+private:
+    Q_DISABLE_COPY(QWebSocketPreparedMessagePrivate)
+};
+
+QT_END_NAMESPACE
+
+#endif // QWEBSOCKETPREPAREDMESSAGE_P_H
@@ -36,6 +36,13 @@
 #include <QtCore/QSet>
 #include <QtCore/QtEndian>
 
+#include <string.h>
+
+#if defined(Q_PROCESSOR_X86) && (defined(Q_CC_GNU) || defined(Q_CC_CLANG))
+#define QWEBSOCKET_MASK_SIMD
+#include <immintrin.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -196,23 +203,168 @@ void QWebSocketProtocol::mask(QByteArray *payload, quint32 maskingKey)
     mask(payload->data(), payload->size(), maskingKey);
 }
 
+namespace {
+
+typedef void (*MaskFunction)(uchar *payload, quint64 size, const uchar *key);
+
+// key holds the four masking bytes in the order they apply to the payload.
+inline void maskBytes(uchar *payload, quint64 size, const uchar *key)
+{
+    for (quint64 i = 0; i < size; ++i)
+        payload[i] ^= key[i & 3];
+}
+
+// Rotates key so that it starts with the byte applying after skipping
+// offset payload bytes.
+inline void rotateKey(uchar *rotated, const uchar *key, quint64 offset)
+{
+    for (int i = 0; i < 4; ++i)
+        rotated[i] = key[(offset + i) & 3];
+}
+
+void maskScalar(uchar *payload, quint64 size, const uchar *key)
+{
+    // Eight bytes at a time; memcpy compiles to unaligned loads and stores
+    // and keeps the key in payload byte order on any endianness.
+    quint32 key32;
+    memcpy(&key32, key, 4);
+    const quint64 key64 = (quint64(key32) << 32) | key32;
+    while (size >= 8) {
+        quint64 word;
+        memcpy(&word, payload, 8);
+        word ^= key64;
+        memcpy(payload, &word, 8);
+        payload += 8;
+        size -= 8;
+    }
+    maskBytes(payload, size, key);
+}
+
+#ifdef QWEBSOCKET_MASK_SIMD
+
+__attribute__((target("sse2")))
+void maskSse2(uchar *payload, quint64 size, const uchar *key)
+{
+    // Words up to the first 16 byte boundary, then aligned vectors.
+    quint64 head = (16 - (quintptr(payload) & 15)) & 15;
+    if (head > size)
+        head = size;
+    maskScalar(payload, head, key);
+    payload += head;
+    size -= head;
+
+    uchar rotated[4];
+    rotateKey(rotated, key, head);
+    int key32;
+    memcpy(&key32, rotated, 4);
+    const __m128i k = _mm_set1_epi32(key32);
+
+    while (size >= 64) {
+        __m128i *p = reinterpret_cast<__m128i *>(payload);
+        __m128i a = _mm_xor_si128(_mm_load_si128(p), k);
+        __m128i b = _mm_xor_si128(_mm_load_si128(p + 1), k);
+        __m128i c = _mm_xor_si128(_mm_load_si128(p + 2), k);
+        __m128i d = _mm_xor_si128(_mm_load_si128(p + 3), k);
+        _mm_store_si128(p, a);
+        _mm_store_si128(p + 1, b);
+        _mm_store_si128(p + 2, c);
+        _mm_store_si128(p + 3, d);
+        payload += 64;
+        size -= 64;
+    }
+    while (size >= 16) {
+        __m128i *p = reinterpret_cast<__m128i *>(payload);
+        _mm_store_si128(p, _mm_xor_si128(_mm_load_si128(p), k));
+        payload += 16;
+        size -= 16;
+    }
+    maskScalar(payload, size, rotated);
+}
+
+__attribute__((target("avx2")))
+void maskAvx2(uchar *payload, quint64 size, const uchar *key)
+{
+    quint64 head = (32 - (quintptr(payload) & 31)) & 31;
+    if (head > size)
+        head = size;
+    maskScalar(payload, head, key);
+    payload += head;
+    size -= head;
+
+    uchar rotated[4];
+    rotateKey(rotated, key, head);
+    int key32;
+    memcpy(&key32, rotated, 4);
+    const __m256i k = _mm256_set1_epi32(key32);
+
+    while (size >= 128) {
+        __m256i *p = reinterpret_cast<__m256i *>(payload);
+        __m256i a = _mm256_xor_si256(_mm256_load_si256(p), k);
+        __m256i b = _mm256_xor_si256(_mm256_load_si256(p + 1), k);
+        __m256i c = _mm256_xor_si256(_mm256_load_si256(p + 2), k);
+        __m256i d = _mm256_xor_si256(_mm256_load_si256(p + 3), k);
+        _mm256_store_si256(p, a);
+        _mm256_store_si256(p + 1, b);
+        _mm256_store_si256(p + 2, c);
+        _mm256_store_si256(p + 3, d);
+        payload += 128;
+        size -= 128;
+    }
+    while (size >= 32) {
+        __m256i *p = reinterpret_cast<__m256i *>(payload);
+        _mm256_store_si256(p, _mm256_xor_si256(_mm256_load_si256(p), k));
+        payload += 32;
+        size -= 32;
+    }
+    // Leave AVX state clean for SSE code running after us.
+    _mm256_zeroupper();
+    maskScalar(payload, size, rotated);
+}
+
+#endif
+
+MaskFunction resolveMask()
+{
+#ifdef QWEBSOCKET_MASK_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return maskAvx2;
+    if (__builtin_cpu_supports("sse2"))
+        return maskSse2;
+#endif
+    return maskScalar;
+}
+
+// Payloads below this size are not worth the alignment head of the vector
+// kernels.
+const quint64 SimdThreshold = 64;
+
+}
+
 /*!
     Masks the \a payload of length \a size with the given \a maskingKey and
     stores the result back in \a payload.
 
+    Uses AVX2 or SSE2 when the CPU supports them and eight bytes at a time
+    otherwise.
+
     \internal
 */
 void QWebSocketProtocol::mask(char *payload, quint64 size, quint32 maskingKey)
 {
     Q_ASSERT(payload);
-    const quint8 mask[] = { quint8((maskingKey & 0xFF000000u) >> 24),
-                            quint8((maskingKey & 0x00FF0000u) >> 16),
-                            quint8((maskingKey & 0x0000FF00u) >> 8),
-                            quint8((maskingKey & 0x000000FFu))
-                          };
-    int i = 0;
-    while (size-- > 0)
-        *payload++ ^= mask[i++ % 4];
+    const uchar key[] = { uchar((maskingKey & 0xFF000000u) >> 24),
+                          uchar((maskingKey & 0x00FF0000u) >> 16),
+                          uchar((maskingKey & 0x0000FF00u) >> 8),
+                          uchar((maskingKey & 0x000000FFu))
+                        };
+    uchar *p = reinterpret_cast<uchar *>(payload);
+    if (size < SimdThreshold) {
+        maskScalar(p, size, key);
+        return;
+    }
+    static const MaskFunction maskFunction = resolveMask();
+    maskFunction(p, size, key);
 }
 
 QT_END_NAMESPACE
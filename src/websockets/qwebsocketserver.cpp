@@ -546,6 +546,143 @@ void QWebSocketServer::setMaxPendingConnections(int numConnections)
     d->setMaxPendingConnections(numConnections);
 }
 
+/*!
+    Enables or disables the permessage-deflate extension (RFC 7692) for the
+    connections accepted from now on. When \a enabled, the server accepts
+    the first permessage-deflate offer of a client that it can satisfy;
+    messages of such a connection are then compressed as a whole.
+    Compression is disabled by default.
+
+    \sa isCompressionEnabled(), setCompressionMemoryLimit(), setMaxInflatedMessageSize()
+ */
+void QWebSocketServer::setCompressionEnabled(bool enabled)
+{
+    Q_D(QWebSocketServer);
+    d->setCompressionEnabled(enabled);
+}
+
+/*!
+    Returns true if the server accepts the permessage-deflate extension.
+
+    \sa setCompressionEnabled()
+ */
+bool QWebSocketServer::isCompressionEnabled() const
+{
+    Q_D(const QWebSocketServer);
+    return d->isCompressionEnabled();
+}
+
+/*!
+    Limits the memory used for the compression state of the connections of
+    this server to \a bytes. Each compressed connection accounts for the
+    worst case of its compressor and decompressor, about 300 KiB. Clients
+    connecting while the limit is reached are accepted without compression.
+    A limit of -1, the default, means unlimited.
+
+    \sa compressionMemoryLimit(), setCompressionEnabled()
+ */
+void QWebSocketServer::setCompressionMemoryLimit(qint64 bytes)
+{
+    Q_D(QWebSocketServer);
+    d->setCompressionMemoryLimit(bytes);
+}
+
+/*!
+    Returns the memory limit for the compression state of the connections of
+    this server, or -1 if there is none.
+
+    \sa setCompressionMemoryLimit()
+ */
+qint64 QWebSocketServer::compressionMemoryLimit() const
+{
+    Q_D(const QWebSocketServer);
+    return d->compressionMemoryLimit();
+}
+
+/*!
+    Limits the size a compressed message may inflate to, for the connections
+    accepted from now on, to \a bytes. Connections receiving a message that
+    inflates beyond it are closed with QWebSocketProtocol::CloseCodeTooMuchData.
+    The default is 64 MiB.
+
+    \sa maxInflatedMessageSize(), setCompressionEnabled()
+ */
+void QWebSocketServer::setMaxInflatedMessageSize(qint64 bytes)
+{
+    Q_D(QWebSocketServer);
+    d->setMaxInflatedMessageSize(bytes);
+}
+
+/*!
+    Returns the size a compressed message may inflate to.
+
+    \sa setMaxInflatedMessageSize()
+ */
+qint64 QWebSocketServer::maxInflatedMessageSize() const
+{
+    Q_D(const QWebSocketServer);
+    return d->maxInflatedMessageSize();
+}
+
+/*!
+    Serves the connections of this server on up to \a maxThreads worker threads, with at most
+    \a maxConnectionsPerThread connections each, like QHttpServer does. The handshake, frame
+    processing and sending of a connection all run on its worker thread, which is the thread
+    affinity of the QWebSocket returned by nextPendingConnection(). Use queued connections, or
+    objects moved to that thread, to talk to it; QWebSocketPreparedMessage::broadcast() and
+    QWebSocketHub already take care of this.
+
+    The originAuthenticationRequired() signal is then emitted on the worker threads, so its
+    receivers must be connected with Qt::DirectConnection and be thread-safe. Connections over
+    the maxPendingConnections() limit are closed after the handshake.
+
+    Must be called before listen(), and is only supported in \l{NonSecureMode}. A
+    \a maxThreads of 0, the default, serves all connections on the thread of the server.
+
+    \sa workerThreads()
+ */
+void QWebSocketServer::setWorkerThreads(int maxThreads, int maxConnectionsPerThread)
+{
+    Q_D(QWebSocketServer);
+    d->setWorkerThreads(maxThreads, maxConnectionsPerThread);
+}
+
+/*!
+    Returns the maximum number of worker threads serving connections, or 0 if all connections
+    are served on the thread of the server.
+
+    \sa setWorkerThreads()
+ */
+int QWebSocketServer::workerThreads() const
+{
+    Q_D(const QWebSocketServer);
+    return d->workerThreads();
+}
+
+/*!
+    Closes connections that have not sent a complete handshake within
+    \a msec milliseconds of being accepted. The default is 10 seconds; a
+    negative value waits forever.
+
+    \sa handshakeTimeoutMS()
+ */
+void QWebSocketServer::setHandshakeTimeout(int msec)
+{
+    Q_D(QWebSocketServer);
+    d->setHandshakeTimeout(msec);
+}
+
+/*!
+    Returns the handshake timeout in milliseconds, or -1 if there is none.
+
+    \sa setHandshakeTimeout()
+ */
+int QWebSocketServer::handshakeTimeoutMS() const
+{
+    Q_D(const QWebSocketServer);
+    return d->handshakeTimeout();
+}
+
 /*!
     Sets the socket descriptor this server should use when listening for incoming connections to
     \a socketDescriptor.
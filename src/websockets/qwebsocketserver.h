@@ -80,6 +80,18 @@ public:
     void setMaxPendingConnections(int numConnections);
     int maxPendingConnections() const;
 
+    void setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+    void setCompressionMemoryLimit(qint64 bytes);
+    qint64 compressionMemoryLimit() const;
+    void setMaxInflatedMessageSize(qint64 bytes);
+    qint64 maxInflatedMessageSize() const;
+
+    void setWorkerThreads(int maxThreads, int maxConnectionsPerThread = 10);
+    int workerThreads() const;
+    void setHandshakeTimeout(int msec);
+    int handshakeTimeoutMS() const;
+
     quint16 serverPort() const;
     QHostAddress serverAddress() const;
     QUrl serverUrl() const;
@@ -37,23 +37,233 @@
 #include "qsslserver_p.h"
 #endif
 #include "qwebsocketprotocol.h"
+#include "qwebsockethandshakeparser_p.h"
 #include "qwebsockethandshakerequest_p.h"
 #include "qwebsockethandshakeresponse_p.h"
 #include "qwebsocket.h"
 #include "qwebsocket_p.h"
 #include "qwebsocketcorsauthenticator.h"
-
+#include "qwebsocketdeflate_p.h"
+#include "../qhttpserver.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QTimer>
+#include <QtCore/QTimerEvent>
 #include <QtNetwork/QTcpServer>
 #include <QtNetwork/QTcpSocket>
 #include <QtNetwork/QNetworkProxy>
 
 QT_BEGIN_NAMESPACE
 
-//both constants are taken from the default settings of Apache
-//see: http://httpd.apache.org/docs/2.2/mod/core.html#limitrequestfieldsize and
-//http://httpd.apache.org/docs/2.2/mod/core.html#limitrequestfields
-const int MAX_HEADERLINE_LENGTH = 8 * 1024; //maximum length of a http request header line
-const int MAX_HEADERLINES = 100;            //maximum number of http request header lines
+/*!
+    \internal
+ */
+QWebSocketServerWorkerState::QWebSocketServerWorkerState() :
+    mutex(),
+    pServer(Q_NULLPTR),
+    pRelay(Q_NULLPTR),
+    emitting(0),
+    idle()
+{
+}
+
+/*!
+    \internal
+ */
+QWebSocketServerHandshakeEvent::QWebSocketServerHandshakeEvent(QWebSocket *pWebSocket,
+                                                               QWebSocketProtocol::CloseCode error,
+                                                               const QString &errorString) :
+    QEvent(QEvent::User),
+    m_pWebSocket(pWebSocket),
+    m_error(error),
+    m_errorString(errorString)
+{
+}
+
+/*!
+    \internal
+    Also runs when the relay is destroyed with the event still queued.
+ */
+QWebSocketServerHandshakeEvent::~QWebSocketServerHandshakeEvent()
+{
+    if (m_pWebSocket)
+        m_pWebSocket->deleteLater();
+}
+
+/*!
+    \internal
+ */
+QWebSocketServerRelay::QWebSocketServerRelay(QWebSocketServerPrivate *pServer, QObject *parent) :
+    QObject(parent),
+    m_pServer(pServer)
+{
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerRelay::customEvent(QEvent *event)
+{
+    if (event->type() == QEvent::User)
+        m_pServer->workerHandshakeDone(static_cast<QWebSocketServerHandshakeEvent *>(event));
+}
+
+/*!
+    \internal
+    Created on the thread of the server, like QHttpConnection, and moved to
+    the worker thread the socket already lives on. Nothing owns the socket
+    until the handshake is done, so the handshake deletes it when the client
+    disconnects or takes longer than \a handshakeTimeout milliseconds.
+ */
+QWebSocketServerHandshake::QWebSocketServerHandshake(
+        QTcpSocket *pTcpSocket,
+        const QSharedPointer<QWebSocketServerWorkerState> &state,
+        const QString &serverName, bool compressionEnabled,
+        const QSharedPointer<QWebSocketDeflateBudget> &pDeflateBudget,
+        int handshakeTimeout) :
+    QObject(Q_NULLPTR),
+    m_pTcpSocket(pTcpSocket),
+    m_state(state),
+    m_serverName(serverName),
+    m_compressionEnabled(compressionEnabled),
+    m_pDeflateBudget(pDeflateBudget),
+    m_handshakeParser(QWebSocketHandshakeParser::Request),
+    m_handshakeTimeout(handshakeTimeout),
+    m_timer(),
+    m_isDiscarded(false)
+{
+    //parented to the socket once running on its thread, see adoptSocket()
+    moveToThread(pTcpSocket->thread());
+    QObject::connect(pTcpSocket, &QTcpSocket::readyRead,
+                     this, &QWebSocketServerHandshake::handshakeReceived, Qt::QueuedConnection);
+    QObject::connect(pTcpSocket, &QTcpSocket::disconnected,
+                     this, &QWebSocketServerHandshake::discard);
+    //the handshake may have arrived before the connection was made
+    QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerHandshake::customEvent(QEvent *event)
+{
+    if (event->type() != QEvent::User)
+        return;
+    if (m_handshakeTimeout >= 0)
+        m_timer.start(m_handshakeTimeout, this);
+    //the client may also have gone before the connections were made
+    if (!handshakeReceived() && m_pTcpSocket->state() == QAbstractSocket::UnconnectedState)
+        discard();
+}
+
+/*!
+    \internal
+    Gives up on a handshake that takes too long.
+ */
+void QWebSocketServerHandshake::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() != m_timer.timerId()) {
+        QObject::timerEvent(event);
+        return;
+    }
+    m_pTcpSocket->disconnect(this);
+    m_pTcpSocket->abort();
+    discard();
+}
+
+/*!
+    \internal
+    Deletes the socket, and with it the handshake, before the handshake is done.
+ */
+void QWebSocketServerHandshake::discard()
+{
+    if (m_isDiscarded)
+        return;
+    m_isDiscarded = true;
+    m_timer.stop();
+    m_pTcpSocket->disconnect(this);
+    m_pTcpSocket->deleteLater();
+    deleteLater();
+}
+
+/*!
+    \internal
+    Makes the socket own the handshake; only done from the socket's thread.
+ */
+void QWebSocketServerHandshake::adoptSocket()
+{
+    if (!parent())
+        setParent(m_pTcpSocket);
+}
+
+/*!
+    \internal
+    Returns false while the handshake is incomplete.
+ */
+bool QWebSocketServerHandshake::handshakeReceived()
+{
+    //a queued readyRead may still arrive after discard()
+    if (m_isDiscarded)
+        return true;
+    adoptSocket();
+    //see QWebSocketServerPrivate::handshakeReceived()
+    QWebSocketHandshakeRequest request(m_pTcpSocket->peerPort(), false);
+    if (!request.readHandshake(m_pTcpSocket, &m_handshakeParser))
+        return false;
+    m_timer.stop();
+    m_pTcpSocket->disconnect(this);
+
+    QWebSocket *pWebSocket = Q_NULLPTR;
+    if (request.isValid()) {
+        QWebSocketCorsAuthenticator corsAuthenticator(request.origin());
+        //receivers must be connected with Qt::DirectConnection; the server
+        //waits for emitting handshakes before it goes away, see close()
+        QWebSocketServer *pServer = Q_NULLPTR;
+        {
+            QMutexLocker locker(&m_state->mutex);
+            pServer = m_state->pServer;
+            if (pServer)
+                ++m_state->emitting;
+        }
+        if (pServer) {
+            Q_EMIT pServer->originAuthenticationRequired(&corsAuthenticator);
+            QMutexLocker locker(&m_state->mutex);
+            if (--m_state->emitting == 0)
+                m_state->idle.wakeAll();
+        }
+
+        QWebSocketProtocol::CloseCode error = QWebSocketProtocol::CloseCodeNormal;
+        QString errorString;
+        pWebSocket = QWebSocketServerPrivate::upgrade(m_pTcpSocket, request, m_serverName,
+                                                      corsAuthenticator.allowed(),
+                                                      m_compressionEnabled, m_pDeflateBudget,
+                                                      &error, &errorString);
+        if (pWebSocket) {
+            //the server's socket does not belong to anyone
+            m_pTcpSocket->setParent(pWebSocket);
+        }
+
+        QMutexLocker locker(&m_state->mutex);
+        if (m_state->pRelay) {
+            QCoreApplication::postEvent(m_state->pRelay,
+                                        new QWebSocketServerHandshakeEvent(pWebSocket, error,
+                                                                           errorString));
+        } else if (pWebSocket) {
+            pWebSocket->deleteLater();
+        }
+    }
+
+    if (pWebSocket) {
+        deleteLater();
+    } else {
+        m_pTcpSocket->close();
+        m_pTcpSocket->deleteLater();
+    }
+    return true;
+}
 
 /*!
     \internal
@@ -69,7 +279,13 @@ QWebSocketServerPrivate::QWebSocketServerPrivate(const QString &serverName,
     m_pendingConnections(),
     m_error(QWebSocketProtocol::CloseCodeNormal),
     m_errorString(),
-    m_maxPendingConnections(30)
+    m_maxPendingConnections(30),
+    m_compressionEnabled(false),
+    m_pDeflateBudget(new QWebSocketDeflateBudget),
+    m_workerThreads(0),
+    m_handshakeTimeout(10000),
+    m_pWorkerState(),
+    m_handshakeParsers()
 {
     Q_ASSERT(pWebSocketServer);
 }
@@ -82,8 +298,7 @@ void QWebSocketServerPrivate::init()
     if (m_secureMode == NonSecureMode) {
         m_pTcpServer = new QTcpServer(q_ptr);
         if (Q_LIKELY(m_pTcpServer))
-            QObjectPrivate::connect(m_pTcpServer, &QTcpServer::newConnection,
-                                    this, &QWebSocketServerPrivate::onNewConnection);
+            connectTcpServer();
         else
             qFatal("Could not allocate memory for tcp server.");
     } else {
@@ -106,11 +321,22 @@ void QWebSocketServerPrivate::init()
     QObject::connect(m_pTcpServer, &QTcpServer::acceptError, q_ptr, &QWebSocketServer::acceptError);
 }
 
+/*!
+    \internal
+    Connects the newConnection() signal of a non-secure server.
+ */
+void QWebSocketServerPrivate::connectTcpServer()
+{
+    QObjectPrivate::connect(m_pTcpServer, &QTcpServer::newConnection,
+                            this, &QWebSocketServerPrivate::onNewConnection);
+}
+
 /*!
     \internal
  */
 QWebSocketServerPrivate::~QWebSocketServerPrivate()
 {
+    qDeleteAll(m_handshakeParsers);
 }
 
 /*!
@@ -120,10 +346,20 @@ void QWebSocketServerPrivate::close(bool aboutToDestroy)
 {
     Q_Q(QWebSocketServer);
     m_pTcpServer->close();
+    if (aboutToDestroy && m_pWorkerState) {
+        //handshakes still running on worker threads clean up after themselves
+        QMutexLocker locker(&m_pWorkerState->mutex);
+        m_pWorkerState->pServer = Q_NULLPTR;
+        m_pWorkerState->pRelay = Q_NULLPTR;
+        while (m_pWorkerState->emitting)
+            m_pWorkerState->idle.wait(&m_pWorkerState->mutex);
+    }
     while (!m_pendingConnections.isEmpty()) {
         QWebSocket *pWebSocket = m_pendingConnections.dequeue();
-        pWebSocket->close(QWebSocketProtocol::CloseCodeGoingAway,
-                          QWebSocketServer::tr("Server closed."));
+        //sockets of worker threads send the close frame from there when deleted
+        if (pWebSocket->thread() == QThread::currentThread())
+            pWebSocket->close(QWebSocketProtocol::CloseCodeGoingAway,
+                              QWebSocketServer::tr("Server closed."));
         pWebSocket->deleteLater();
     }
     if (!aboutToDestroy) {
@@ -292,6 +528,64 @@ qintptr QWebSocketServerPrivate::socketDescriptor() const
     return m_pTcpServer->socketDescriptor();
 }
 
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::setWorkerThreads(int maxThreads, int maxConnectionsPerThread)
+{
+    if (Q_UNLIKELY(m_secureMode == SecureMode)) {
+        qWarning("QWebSocketServer: Worker threads are not supported in secure mode.");
+        return;
+    }
+    if (Q_UNLIKELY(m_pTcpServer->isListening())) {
+        qWarning("QWebSocketServer: Worker threads must be set before listen().");
+        return;
+    }
+    Q_Q(QWebSocketServer);
+    const int maxPendingConnections = m_pTcpServer->maxPendingConnections();
+    delete m_pTcpServer;
+    if (maxThreads > 0) {
+        if (!m_pWorkerState) {
+            m_pWorkerState = QSharedPointer<QWebSocketServerWorkerState>::create();
+            m_pWorkerState->pServer = q;
+            m_pWorkerState->pRelay = new QWebSocketServerRelay(this, q);
+        }
+        m_pTcpServer = new QMtTcpServer(q, maxThreads, qMax(1, maxConnectionsPerThread),
+                                        maxPendingConnections);
+        m_workerThreads = maxThreads;
+    } else {
+        m_pTcpServer = new QTcpServer(q);
+        m_pTcpServer->setMaxPendingConnections(maxPendingConnections);
+        m_workerThreads = 0;
+    }
+    connectTcpServer();
+    QObject::connect(m_pTcpServer, &QTcpServer::acceptError, q, &QWebSocketServer::acceptError);
+}
+
+/*!
+    \internal
+ */
+int QWebSocketServerPrivate::workerThreads() const
+{
+    return m_workerThreads;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::setHandshakeTimeout(int msec)
+{
+    m_handshakeTimeout = msec < 0 ? -1 : msec;
+}
+
+/*!
+    \internal
+ */
+int QWebSocketServerPrivate::handshakeTimeout() const
+{
+    return m_handshakeTimeout;
+}
+
 /*!
     \internal
  */
@@ -317,7 +611,57 @@ QStringList QWebSocketServerPrivate::supportedProtocols() const
 QStringList QWebSocketServerPrivate::supportedExtensions() const
 {
     QStringList supportedExtensions;
-    return supportedExtensions;	//no extensions are currently supported
+    if (m_compressionEnabled)
+        supportedExtensions << QWebSocketDeflateOptions::extensionName;
+    return supportedExtensions;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::setCompressionEnabled(bool enabled)
+{
+    m_compressionEnabled = enabled;
+}
+
+/*!
+    \internal
+ */
+bool QWebSocketServerPrivate::isCompressionEnabled() const
+{
+    return m_compressionEnabled;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::setCompressionMemoryLimit(qint64 bytes)
+{
+    m_pDeflateBudget->setLimit(bytes);
+}
+
+/*!
+    \internal
+ */
+qint64 QWebSocketServerPrivate::compressionMemoryLimit() const
+{
+    return m_pDeflateBudget->limit();
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::setMaxInflatedMessageSize(qint64 bytes)
+{
+    m_pDeflateBudget->setMaxInflatedSize(bytes);
+}
+
+/*!
+    \internal
+ */
+qint64 QWebSocketServerPrivate::maxInflatedMessageSize() const
+{
+    return m_pDeflateBudget->maxInflatedSize();
 }
 
 /*!
@@ -376,8 +720,34 @@ void QWebSocketServerPrivate::setError(QWebSocketProtocol::CloseCode code, const
  */
 void QWebSocketServerPrivate::onNewConnection()
 {
+    if (m_pWorkerState) {
+        //QMtTcpServer hands out sockets that already live on a worker thread
+        QMtTcpServer *pMtTcpServer = static_cast<QMtTcpServer *>(m_pTcpServer);
+        while (pMtTcpServer->hasPendingConnections()) {
+            QTcpSocket *pTcpSocket = pMtTcpServer->nextPendingConnection();
+            if (pTcpSocket)
+                new QWebSocketServerHandshake(pTcpSocket, m_pWorkerState, m_serverName,
+                                              m_compressionEnabled, m_pDeflateBudget,
+                                              m_handshakeTimeout);
+        }
+        return;
+    }
     while (m_pTcpServer->hasPendingConnections()) {
         QTcpSocket *pTcpSocket = m_pTcpServer->nextPendingConnection();
+        //the handshake is parsed as it arrives
+        m_handshakeParsers.insert(pTcpSocket,
+                                  new QWebSocketHandshakeParser(QWebSocketHandshakeParser::Request));
+        QObject::connect(pTcpSocket, &QObject::destroyed, q_ptr, [this](QObject *pObject) {
+            delete m_handshakeParsers.take(static_cast<QTcpSocket *>(pObject));
+        });
+        if (m_handshakeTimeout >= 0) {
+            QTimer::singleShot(m_handshakeTimeout, pTcpSocket, [this, pTcpSocket]() {
+                if (m_handshakeParsers.contains(pTcpSocket)) {
+                    pTcpSocket->abort();
+                    pTcpSocket->deleteLater();
+                }
+            });
+        }
         //use a queued connection because a QSslSocket
         //needs the event loop to process incoming data
         //if not queued, data is incomplete when handshakeReceived is called
@@ -418,14 +788,19 @@ void QWebSocketServerPrivate::handshakeReceived()
     //For Safari, the handshake is delivered at once
     //FIXME: For FireFox, the readyRead signal is never emitted
     //This is a bug in FireFox (see https://bugzilla.mozilla.org/show_bug.cgi?id=594502)
-    if (!pTcpSocket->canReadLine()) {
+    //The parser of the socket keeps the parts that arrived so far.
+    QWebSocketHandshakeParser *pParser = m_handshakeParsers.value(pTcpSocket, Q_NULLPTR);
+    if (Q_UNLIKELY(!pParser))
         return;
-    }
+    bool isSecure = false;
+    QWebSocketHandshakeRequest request(pTcpSocket->peerPort(), isSecure);
+    if (!request.readHandshake(pTcpSocket, pParser))
+        return;
+    delete m_handshakeParsers.take(pTcpSocket);
     disconnect(pTcpSocket, &QTcpSocket::readyRead,
                this, &QWebSocketServerPrivate::handshakeReceived);
     Q_Q(QWebSocketServer);
     bool success = false;
-    bool isSecure = false;
 
     if (m_pendingConnections.length() >= maxPendingConnections()) {
         pTcpSocket->close();
@@ -435,45 +810,21 @@ void QWebSocketServerPrivate::handshakeReceived()
         return;
     }
 
-    QWebSocketHandshakeRequest request(pTcpSocket->peerPort(), isSecure);
-    QTextStream textStream(pTcpSocket);
-    request.readHandshake(textStream, MAX_HEADERLINE_LENGTH, MAX_HEADERLINES);
-
     if (request.isValid()) {
         QWebSocketCorsAuthenticator corsAuthenticator(request.origin());
         Q_EMIT q->originAuthenticationRequired(&corsAuthenticator);
 
-        QWebSocketHandshakeResponse response(request,
-                                             m_serverName,
-                                             corsAuthenticator.allowed(),
-                                             supportedVersions(),
-                                             supportedProtocols(),
-                                             supportedExtensions());
-
-        if (response.isValid()) {
-            QTextStream httpStream(pTcpSocket);
-            httpStream << response;
-            httpStream.flush();
-
-            if (response.canUpgrade()) {
-                QWebSocket *pWebSocket = QWebSocketPrivate::upgradeFrom(pTcpSocket,
-                                                                        request,
-                                                                        response);
-                if (pWebSocket) {
-                    addPendingConnection(pWebSocket);
-                    Q_EMIT q->newConnection();
-                    success = true;
-                } else {
-                    setError(QWebSocketProtocol::CloseCodeAbnormalDisconnection,
-                             QWebSocketServer::tr("Upgrade to WebSocket failed."));
-                }
-            }
-            else {
-                setError(response.error(), response.errorString());
-            }
+        QWebSocketProtocol::CloseCode error = QWebSocketProtocol::CloseCodeNormal;
+        QString errorString;
+        QWebSocket *pWebSocket = upgrade(pTcpSocket, request, m_serverName,
+                                         corsAuthenticator.allowed(), m_compressionEnabled,
+                                         m_pDeflateBudget, &error, &errorString);
+        if (pWebSocket) {
+            addPendingConnection(pWebSocket);
+            Q_EMIT q->newConnection();
+            success = true;
         } else {
-            setError(QWebSocketProtocol::CloseCodeProtocolError,
-                     QWebSocketServer::tr("Invalid response received."));
+            setError(error, errorString);
         }
     }
     if (!success) {
@@ -481,4 +832,92 @@ void QWebSocketServerPrivate::handshakeReceived()
     }
 }
 
+/*!
+    \internal
+    Answers a valid handshake \a request read from \a pTcpSocket. Returns the
+    WebSocket, or Q_NULLPTR with the reason in \a pError and \a pErrorString.
+    Safe to call on any thread.
+ */
+QWebSocket *QWebSocketServerPrivate::upgrade(QTcpSocket *pTcpSocket,
+                                             const QWebSocketHandshakeRequest &request,
+                                             const QString &serverName, bool isOriginAllowed,
+                                             bool compressionEnabled,
+                                             const QSharedPointer<QWebSocketDeflateBudget> &pDeflateBudget,
+                                             QWebSocketProtocol::CloseCode *pError,
+                                             QString *pErrorString)
+{
+    //the window sizes are only known after negotiation, so reserve for the largest;
+    //compression is not offered to clients that would exceed the memory limit
+    const qint64 deflateMemory = QWebSocketDeflate::memoryEstimate(15, 15);
+    qint64 deflateReserved = 0;
+    QStringList extensions;
+    if (compressionEnabled && pDeflateBudget->reserve(deflateMemory)) {
+        deflateReserved = deflateMemory;
+        extensions << QWebSocketDeflateOptions::extensionName;
+    }
+
+    QList<QWebSocketProtocol::Version> versions;
+    versions << QWebSocketProtocol::currentVersion();	//we only support V13
+    QWebSocketHandshakeResponse response(request,
+                                         serverName,
+                                         isOriginAllowed,
+                                         versions,
+                                         QStringList(),
+                                         extensions);
+
+    QWebSocket *pWebSocket = Q_NULLPTR;
+    if (response.isValid()) {
+        QTextStream httpStream(pTcpSocket);
+        httpStream << response;
+        httpStream.flush();
+
+        if (response.canUpgrade()) {
+            //the socket takes over the reservation
+            pWebSocket = QWebSocketPrivate::upgradeFrom(pTcpSocket,
+                                                        request,
+                                                        response,
+                                                        Q_NULLPTR,
+                                                        pDeflateBudget,
+                                                        deflateReserved);
+            deflateReserved = 0;
+            if (!pWebSocket) {
+                *pError = QWebSocketProtocol::CloseCodeAbnormalDisconnection;
+                *pErrorString = QWebSocketServer::tr("Upgrade to WebSocket failed.");
+            }
+        }
+        else {
+            *pError = response.error();
+            *pErrorString = response.errorString();
+        }
+    } else {
+        *pError = QWebSocketProtocol::CloseCodeProtocolError;
+        *pErrorString = QWebSocketServer::tr("Invalid response received.");
+    }
+    if (deflateReserved)
+        pDeflateBudget->release(deflateReserved);
+    return pWebSocket;
+}
+
+/*!
+    \internal
+ */
+void QWebSocketServerPrivate::workerHandshakeDone(QWebSocketServerHandshakeEvent *event)
+{
+    Q_Q(QWebSocketServer);
+    QWebSocket *pWebSocket = event->m_pWebSocket;
+    if (!pWebSocket) {
+        setError(event->m_error, event->m_errorString);
+        return;
+    }
+    //the handshake is already answered, so the only way to refuse is closing
+    if (m_pendingConnections.length() >= maxPendingConnections()) {
+        setError(QWebSocketProtocol::CloseCodeAbnormalDisconnection,
+                 QWebSocketServer::tr("Too many pending connections."));
+        return;
+    }
+    event->m_pWebSocket = Q_NULLPTR;
+    addPendingConnection(pWebSocket);
+    Q_EMIT q->newConnection();
+}
+
 QT_END_NAMESPACE
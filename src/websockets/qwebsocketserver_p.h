@@ -44,12 +44,19 @@
 // We mean it.
 //
 
+#include <QtCore/QBasicTimer>
+#include <QtCore/QEvent>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <QtCore/QObject>
 #include <QtCore/QQueue>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QString>
+#include <QtCore/QWaitCondition>
 #include <QtNetwork/QHostAddress>
 #include <private/qobject_p.h>
 #include "qwebsocket.h"
+#include "qwebsockethandshakeparser_p.h"
 
 #ifndef QT_NO_SSL
 #include <QtNetwork/QSslConfiguration>
@@ -59,7 +66,97 @@
 QT_BEGIN_NAMESPACE
 
 class QTcpServer;
+class QTcpSocket;
 class QWebSocketServer;
+class QWebSocketDeflateBudget;
+class QWebSocketHandshakeRequest;
+class QWebSocketServerPrivate;
+
+/*
+    State shared by a server and the handshakes running on its worker
+    threads; a handshake may still complete after the server is gone.
+ */
+struct QWebSocketServerWorkerState
+{
+    QWebSocketServerWorkerState();
+
+    QMutex mutex;
+    //both 0 once the server is destroyed
+    QWebSocketServer *pServer;
+    QObject *pRelay;
+    //handshakes emitting a signal of pServer outside the mutex
+    int emitting;
+    QWaitCondition idle;
+};
+
+/*
+    The outcome of a handshake on a worker thread, posted to the relay of
+    the server. Owns the WebSocket until the server takes it.
+ */
+class QWebSocketServerHandshakeEvent : public QEvent
+{
+public:
+    QWebSocketServerHandshakeEvent(QWebSocket *pWebSocket, QWebSocketProtocol::CloseCode error,
+                                   const QString &errorString);
+    virtual ~QWebSocketServerHandshakeEvent();
+
+    QWebSocket *m_pWebSocket;
+    QWebSocketProtocol::CloseCode m_error;
+    QString m_errorString;
+};
+
+/*
+    Lives on the thread of the server and hands the outcome of worker
+    handshakes to it.
+ */
+class QWebSocketServerRelay : public QObject
+{
+public:
+    QWebSocketServerRelay(QWebSocketServerPrivate *pServer, QObject *parent);
+
+protected:
+    void customEvent(QEvent *event) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(QWebSocketServerRelay)
+
+    QWebSocketServerPrivate * const m_pServer;
+};
+
+/*
+    Reads the handshake of one connection on the worker thread that owns
+    its socket, with the settings the server had when it was accepted.
+ */
+class QWebSocketServerHandshake : public QObject
+{
+public:
+    QWebSocketServerHandshake(QTcpSocket *pTcpSocket,
+                              const QSharedPointer<QWebSocketServerWorkerState> &state,
+                              const QString &serverName, bool compressionEnabled,
+                              const QSharedPointer<QWebSocketDeflateBudget> &pDeflateBudget,
+                              int handshakeTimeout);
+
+protected:
+    void customEvent(QEvent *event) Q_DECL_OVERRIDE;
+    void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(QWebSocketServerHandshake)
+
+    void adoptSocket();
+    bool handshakeReceived();
+    void discard();
+
+    QTcpSocket * const m_pTcpSocket;
+    QSharedPointer<QWebSocketServerWorkerState> m_state;
+    QString m_serverName;
+    bool m_compressionEnabled;
+    QSharedPointer<QWebSocketDeflateBudget> m_pDeflateBudget;
+    QWebSocketHandshakeParser m_handshakeParser;
+    int m_handshakeTimeout;
+    QBasicTimer m_timer;
+    bool m_isDiscarded;
+};
 
 class QWebSocketServerPrivate : public QObjectPrivate
 {
@@ -95,8 +192,18 @@ public:
     QWebSocketProtocol::CloseCode serverError() const;
     quint16 serverPort() const;
     void setMaxPendingConnections(int numConnections);
+    void setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+    void setCompressionMemoryLimit(qint64 bytes);
+    qint64 compressionMemoryLimit() const;
+    void setMaxInflatedMessageSize(qint64 bytes);
+    qint64 maxInflatedMessageSize() const;
     bool setSocketDescriptor(qintptr socketDescriptor);
     qintptr socketDescriptor() const;
+    void setWorkerThreads(int maxThreads, int maxConnectionsPerThread);
+    int workerThreads() const;
+    void setHandshakeTimeout(int msec);
+    int handshakeTimeout() const;
 
     QList<QWebSocketProtocol::Version> supportedVersions() const;
     QStringList supportedProtocols() const;
@@ -114,6 +221,12 @@ public:
 
     void setError(QWebSocketProtocol::CloseCode code, const QString &errorString);
 
+    static QWebSocket *upgrade(QTcpSocket *pTcpSocket, const QWebSocketHandshakeRequest &request,
+                               const QString &serverName, bool isOriginAllowed,
+                               bool compressionEnabled,
+                               const QSharedPointer<QWebSocketDeflateBudget> &pDeflateBudget,
+                               QWebSocketProtocol::CloseCode *pError, QString *pErrorString);
+
     QWebSocketServer * const q_ptr;
 
 private:
@@ -124,14 +237,25 @@ private:
     QWebSocketProtocol::CloseCode m_error;
     QString m_errorString;
     int m_maxPendingConnections;
+    bool m_compressionEnabled;
+    QSharedPointer<QWebSocketDeflateBudget> m_pDeflateBudget;
+    int m_workerThreads;
+    int m_handshakeTimeout;
+    QSharedPointer<QWebSocketServerWorkerState> m_pWorkerState;
+    //parsers of the handshakes still being read on the server's thread
+    QHash<QTcpSocket *, QWebSocketHandshakeParser *> m_handshakeParsers;
 
     void addPendingConnection(QWebSocket *pWebSocket);
     void setErrorFromSocketError(QAbstractSocket::SocketError error,
                                  const QString &errorDescription);
 
+    void connectTcpServer();
     void onNewConnection();
     void onCloseConnection();
     void handshakeReceived();
+    void workerHandshakeDone(QWebSocketServerHandshakeEvent *event);
+
+    friend class QWebSocketServerRelay;
 };
 
 QT_END_NAMESPACE